@@ -129,6 +129,8 @@ public:
     fprintf(file, "struct %s {\n", baseName);
     fprintf(file, "  %sType type;\n\n", baseName);
     fprintf(file, "  %s(%sType type);\n\n", baseName, baseName);
+    fprintf(file, "  void *operator new(size_t size);\n");
+    fprintf(file, "  void operator delete(void *pointer);\n\n");
     fprintf(file, "  virtual void accept(%sVisitor *visitor) = 0;\n", baseName);
     fprintf(file, "};\n\n", baseName);
     defineVisitor(file, baseName, types);
@@ -152,12 +154,22 @@ public:
 
     writeHeader(file);
     fprintf(file, "#include \"%s.hpp\"\n", toLowerCase(baseName));
+    fprintf(file, "#include \"arena.hpp\"\n");
 
     // Base class constructor
     fprintf(file, "\n%s::%s(%sType type) {\n", baseName, baseName, baseName);
     fprintf(file, "  this->type = type;\n");
     fprintf(file, "}\n");
 
+    // Nodes belong to the arena of the compilation building them
+    fprintf(file, "\nvoid *%s::operator new(size_t size) {\n", baseName);
+    fprintf(file, "  return astArena ? astArena->allocate(size) : ::operator new(size);\n");
+    fprintf(file, "}\n");
+    fprintf(file, "\nvoid %s::operator delete(void *pointer) {\n", baseName);
+    fprintf(file, "  if (!astArena || !astArena->owns(pointer))\n");
+    fprintf(file, "    ::operator delete(pointer);\n");
+    fprintf(file, "}\n");
+
     // The AST classes.
     for (int index = 0; types[index] != NULL; index++) {
       char *type = (char *) types[index];
@@ -273,19 +285,19 @@ int main(int argc, const char *argv[]) {
   const char *outputDir = argv[1];
 
   const char *array1[] = {
-    "Reference   : Token name, int8_t index, bool upvalueFlag",
+    "Reference   : Token name, int index, bool upvalueFlag, Compiler* _compiler",
     "UIAttribute : Token name, Expr* handler, int _uiIndex, int _index",
     "UIDirective : int childDir, int attCount, UIAttributeExpr** attributes, UIDirectiveExpr* previous, UIDirectiveExpr* lastChild, int viewIndex, bool childrenViewFlag, int _layoutIndexes[NUM_DIRS], long _eventFlags",
     "Assign      : ReferenceExpr* varExp, Token op, Expr* value, OpCode opCode, bool suffixFlag",
     "Binary      : Expr* left, Token op, Expr* right, OpCode opCode, bool notFlag",
     "Grouping    : Token name, int count, Expr** expressions, int popLevels, Expr* ui, Compiler _compiler",
-    "Array       : int count, Expr** expressions, ObjFunction* function",
-    "Call        : Expr* callee, Token paren, int count, Expr** arguments, bool newFlag, Expr* handler",
-    "ArrayElement: Expr* callee, Token bracket, int count, Expr** indexes",
+    "Array       : int count, Expr** expressions, Type _elementType",
+    "Call        : Expr* callee, Token paren, int count, Expr** arguments, bool newFlag, Expr* handler, ObjFunction* _function",
+    "ArrayElement: Expr* callee, Token bracket, int count, Expr** indexes, bool _uncheckedFlag",
     "Declaration : Type type, Token name, Expr* initExpr",
     "Function    : Type type, Token name, int count, Expr** params, Expr* body, ObjFunction* function",
     "Get         : Expr* object, Token name, int index",
-    "List        : int count, Expr** expressions, ExprType listType, Declaration* _declaration",
+    "List        : int count, Expr** expressions, ExprType listType, Compiler* _compiler, int _index",
     "Literal     : ValueType type, As as",
     "Logical     : Expr* left, Token op, Expr* right",
     "Opcode      : OpCode op, Expr* right",
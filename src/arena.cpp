@@ -0,0 +1,104 @@
+/*
+ * The QED Programming Language
+ * Copyright (C) 2022-2023  Hocus Codus Software inc.
+ *
+ * All rights reserved.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "arena.hpp"
+
+#define HEADER_SIZE \
+  ((sizeof(Arena::Block) + ARENA_ALIGNMENT - 1) & ~(size_t) (ARENA_ALIGNMENT - 1))
+
+Arena *astArena = NULL;
+
+static inline char *blockData(Arena::Block *block) {
+  return (char *) block + HEADER_SIZE;
+}
+
+Arena::Arena() {
+  blocks = NULL;
+  last = NULL;
+  bytes = 0;
+}
+
+Arena::~Arena() {
+  release();
+}
+
+void *Arena::allocate(size_t size) {
+  size = (size + ARENA_ALIGNMENT - 1) & ~(size_t) (ARENA_ALIGNMENT - 1);
+
+  if (blocks == NULL || blocks->used + size > blocks->size) {
+    size_t blockSize = size > ARENA_BLOCK_SIZE - HEADER_SIZE ? size : ARENA_BLOCK_SIZE - HEADER_SIZE;
+    Block *block = (Block *) calloc(1, HEADER_SIZE + blockSize);
+
+    if (block == NULL) exit(1);
+
+    block->next = blocks;
+    block->size = blockSize;
+    block->used = 0;
+    blocks = block;
+  }
+
+  last = blockData(blocks) + blocks->used;
+  blocks->used += size;
+  bytes += size;
+  return last;
+}
+
+// Grows in place when pointer is the latest allocation
+void *Arena::resize(void *pointer, size_t oldSize, size_t newSize) {
+  if (newSize == 0)
+    return NULL;
+
+  if (pointer != NULL && pointer == last) {
+    size_t offset = (char *) pointer - blockData(blocks);
+    size_t size = (newSize + ARENA_ALIGNMENT - 1) & ~(size_t) (ARENA_ALIGNMENT - 1);
+
+    if (offset + size <= blocks->size) {
+      if (offset + size < blocks->used)
+        memset((char *) pointer + size, 0, blocks->used - offset - size);
+
+      bytes += size - (blocks->used - offset);
+      blocks->used = offset + size;
+      return pointer;
+    }
+  }
+
+  void *result = allocate(newSize);
+
+  if (pointer != NULL)
+    memcpy(result, pointer, oldSize < newSize ? oldSize : newSize);
+
+  return result;
+}
+
+char *Arena::copy(const char *chars) {
+  size_t length = strlen(chars);
+  char *result = (char *) allocate(length + 1);
+
+  memcpy(result, chars, length + 1);
+  return result;
+}
+
+bool Arena::owns(const void *pointer) {
+  for (Block *block = blocks; block != NULL; block = block->next)
+    if (pointer >= blockData(block) && pointer < blockData(block) + block->size)
+      return true;
+
+  return false;
+}
+
+void Arena::release() {
+  while (blocks != NULL) {
+    Block *next = blocks->next;
+
+    free(blocks);
+    blocks = next;
+  }
+
+  last = NULL;
+  bytes = 0;
+}
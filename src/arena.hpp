@@ -0,0 +1,49 @@
+/*
+ * The QED Programming Language
+ * Copyright (C) 2022-2023  Hocus Codus Software inc.
+ *
+ * All rights reserved.
+ */
+#ifndef qed_arena_h
+#define qed_arena_h
+
+#include <stddef.h>
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGNMENT 16
+
+#define ARENA_ARRAY(type, count) \
+    (type *) astArena->allocate(sizeof(type) * (count))
+
+#define ARENA_RESIZE(type, pointer, oldCount, newCount) \
+    (type *) astArena->resize(pointer, sizeof(type) * (oldCount), sizeof(type) * (newCount))
+
+// Bump allocator owning everything built for one compilation: the AST
+// nodes, their arrays and the generated source; it is all released at once
+// when the arena goes. Blocks come zeroed, so the node fields that the
+// constructors leave alone start out NULL
+struct Arena {
+  struct Block {
+    Block *next;
+    size_t size;
+    size_t used;
+  };
+
+  Block *blocks;
+  void *last;
+  size_t bytes;
+
+  Arena();
+  ~Arena();
+
+  void *allocate(size_t size);
+  void *resize(void *pointer, size_t oldSize, size_t newSize);
+  char *copy(const char *chars);
+  bool owns(const void *pointer);
+  void release();
+};
+
+// The arena of the compilation in progress, NULL outside of one
+extern Arena *astArena;
+
+#endif
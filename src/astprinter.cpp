@@ -377,7 +377,9 @@ void ASTPrinter::printType(Type *type) {
 
 void ASTPrinter::printObjType(Obj *obj) {
   switch(obj->type) {
-    case OBJ_STRING: printf("String"); return;
+    case OBJ_STRING:
+    case OBJ_ROPE:
+    case OBJ_SLICE: printf("String"); return;
     case OBJ_FUNCTION: {
       ObjString *name = ((ObjCallable *) obj)->name;
 
@@ -12,13 +12,16 @@ void Chunk::init() {
   count = 0;
   capacity = 0;
   code = NULL;
+  opCodes = NULL;
   lines = NULL;
+  constantTypes = NULL;
   initValueArray(&constants);
 }
 
 void Chunk::uninit() {
   FREE_ARRAY(uint8_t, code, capacity);
   FREE_ARRAY(int, lines, capacity);
+  FREE_ARRAY(ValueType, constantTypes, constants.capacity);
   freeValueArray(&constants);
 }
 
@@ -40,9 +43,15 @@ void Chunk::writeChunk(uint8_t byte, int line) {
   lines[count++] = line;
 }
 
-int Chunk::addConstant(Value value) {
+int Chunk::addConstant(Value value, ValueType type) {
   int index = constants.count;
+  int oldCapacity = constants.capacity;
 
   writeValueArray(&constants, value);
+
+  if (constants.capacity != oldCapacity)
+    constantTypes = RESIZE_ARRAY(ValueType, constantTypes, oldCapacity, constants.capacity);
+
+  constantTypes[index] = type;
   return index;
 }
@@ -10,80 +10,151 @@
 #include "common.h"
 #include "value.h"
 
-typedef enum {
-  OP_CONSTANT,
-  OP_TRUE,
-  OP_FALSE,
-  OP_POP,
-  OP_GET_LOCAL_DIR,
-  OP_ADD_LOCAL,
-  OP_MAX_LOCAL,
-  OP_GET_LOCAL,
-  OP_SET_LOCAL,
-  OP_GET_UPVALUE,
-  OP_SET_UPVALUE,
-  OP_GET_PROPERTY,
-  OP_SET_PROPERTY,
-  OP_INT_TO_FLOAT,
-  OP_FLOAT_TO_INT,
-  OP_INT_TO_STRING,
-  OP_FLOAT_TO_STRING,
-  OP_BOOL_TO_STRING,
-  OP_EQUAL_STRING,
-  OP_GREATER_STRING,
-  OP_ADD_STRING,
-  OP_LESS_STRING,
-  OP_EQUAL_INT,
-  OP_GREATER_INT,
-  OP_LESS_INT,
-  OP_ADD_INT,
-  OP_SUBTRACT_INT,
-  OP_MULTIPLY_INT,
-  OP_DIVIDE_INT,
-  OP_EQUAL_FLOAT,
-  OP_GREATER_FLOAT,
-  OP_LESS_FLOAT,
-  OP_ADD_FLOAT,
-  OP_SUBTRACT_FLOAT,
-  OP_MULTIPLY_FLOAT,
-  OP_DIVIDE_FLOAT,
-  OP_NOT,
-  OP_NEGATE_FLOAT,
-  OP_NEGATE_INT,
-  OP_BITWISE_OR,
-  OP_BITWISE_AND,
-  OP_BITWISE_XOR,
-  OP_LOGICAL_OR,
-  OP_LOGICAL_AND,
-  OP_SHIFT_LEFT,
-  OP_SHIFT_RIGHT,
-  OP_SHIFT_URIGHT,
-  OP_PRINT,
-  OP_JUMP,
-  OP_JUMP_IF_FALSE,
-  OP_POP_JUMP_IF_FALSE,
-  OP_NEW,
-  OP_CALL,
-  OP_ARRAY_INDEX,
-  OP_CLOSURE,
-  OP_CLOSE_UPVALUE,
-  OP_RETURN,
-  OP_HALT
-} OpCode;
+// Three-address register instructions, OP_R_<identifier> dest a b and
+// OP_R_<identifier>_K dest a constant, generated by RegisterGenerator
+// REGISTER_HELPER_OP_DEF entries call a function instead of an operator
+#define REGISTER_OPS_DEF \
+    REGISTER_OP_DEF( ADD_INT, INT_VAL, AS_INT, long, + ) \
+    REGISTER_OP_DEF( SUBTRACT_INT, INT_VAL, AS_INT, long, - ) \
+    REGISTER_OP_DEF( MULTIPLY_INT, INT_VAL, AS_INT, long, * ) \
+    REGISTER_OP_DEF( DIVIDE_INT, INT_VAL, AS_INT, long, / ) \
+    REGISTER_OP_DEF( EQUAL_INT, BOOL_VAL, AS_INT, long, == ) \
+    REGISTER_OP_DEF( GREATER_INT, BOOL_VAL, AS_INT, long, > ) \
+    REGISTER_OP_DEF( LESS_INT, BOOL_VAL, AS_INT, long, < ) \
+    REGISTER_OP_DEF( ADD_FLOAT, FLOAT_VAL, AS_FLOAT, double, + ) \
+    REGISTER_OP_DEF( SUBTRACT_FLOAT, FLOAT_VAL, AS_FLOAT, double, - ) \
+    REGISTER_OP_DEF( MULTIPLY_FLOAT, FLOAT_VAL, AS_FLOAT, double, * ) \
+    REGISTER_OP_DEF( DIVIDE_FLOAT, FLOAT_VAL, AS_FLOAT, double, / ) \
+    REGISTER_HELPER_OP_DEF( EQUAL_FLOAT, BOOL_VAL, AS_FLOAT, double, floatsEqual ) \
+    REGISTER_OP_DEF( GREATER_FLOAT, BOOL_VAL, AS_FLOAT, double, > ) \
+    REGISTER_OP_DEF( LESS_FLOAT, BOOL_VAL, AS_FLOAT, double, < ) \
+    REGISTER_OP_DEF( BITWISE_OR, INT_VAL, AS_INT, long, | ) \
+    REGISTER_OP_DEF( BITWISE_AND, INT_VAL, AS_INT, long, & ) \
+    REGISTER_OP_DEF( BITWISE_XOR, INT_VAL, AS_INT, long, ^ ) \
+    REGISTER_OP_DEF( SHIFT_LEFT, INT_VAL, AS_INT, long, << ) \
+    REGISTER_OP_DEF( SHIFT_RIGHT, INT_VAL, AS_INT, long, >> ) \
+
+// Register operands below REGISTER_TEMP are frame slots, the others index
+// the temporaries above the stack top, which never live across a push
+#define REGISTER_TEMP 0x80
+#define REGISTER_MAX 0x80
+
+#define OPCODES_DEF \
+    OPCODE_DEF( OP_CONSTANT ), \
+    OPCODE_DEF( OP_TRUE ), \
+    OPCODE_DEF( OP_FALSE ), \
+    OPCODE_DEF( OP_POP ), \
+    OPCODE_DEF( OP_GET_LOCAL_DIR ), \
+    OPCODE_DEF( OP_ADD_LOCAL ), \
+    OPCODE_DEF( OP_MAX_LOCAL ), \
+    OPCODE_DEF( OP_GET_LOCAL ), \
+    OPCODE_DEF( OP_SET_LOCAL ), \
+    OPCODE_DEF( OP_SET_LOCAL_POP ), \
+    OPCODE_DEF( OP_ADD_LOCAL_CONST ), \
+    OPCODE_DEF( OP_SUBTRACT_LOCAL_CONST ), \
+    OPCODE_DEF( OP_MULTIPLY_LOCAL_CONST ), \
+    OPCODE_DEF( OP_INC_LOCAL ), \
+    OPCODE_DEF( OP_GET_UPVALUE ), \
+    OPCODE_DEF( OP_SET_UPVALUE ), \
+    OPCODE_DEF( OP_GET_PROPERTY ), \
+    OPCODE_DEF( OP_SET_PROPERTY ), \
+    OPCODE_DEF( OP_INT_TO_FLOAT ), \
+    OPCODE_DEF( OP_FLOAT_TO_INT ), \
+    OPCODE_DEF( OP_INT_TO_STRING ), \
+    OPCODE_DEF( OP_FLOAT_TO_STRING ), \
+    OPCODE_DEF( OP_BOOL_TO_STRING ), \
+    OPCODE_DEF( OP_EQUAL_STRING ), \
+    OPCODE_DEF( OP_GREATER_STRING ), \
+    OPCODE_DEF( OP_ADD_STRING ), \
+    OPCODE_DEF( OP_LESS_STRING ), \
+    OPCODE_DEF( OP_EQUAL_INT ), \
+    OPCODE_DEF( OP_GREATER_INT ), \
+    OPCODE_DEF( OP_LESS_INT ), \
+    OPCODE_DEF( OP_ADD_INT ), \
+    OPCODE_DEF( OP_SUBTRACT_INT ), \
+    OPCODE_DEF( OP_MULTIPLY_INT ), \
+    OPCODE_DEF( OP_DIVIDE_INT ), \
+    OPCODE_DEF( OP_EQUAL_FLOAT ), \
+    OPCODE_DEF( OP_GREATER_FLOAT ), \
+    OPCODE_DEF( OP_LESS_FLOAT ), \
+    OPCODE_DEF( OP_ADD_FLOAT ), \
+    OPCODE_DEF( OP_SUBTRACT_FLOAT ), \
+    OPCODE_DEF( OP_MULTIPLY_FLOAT ), \
+    OPCODE_DEF( OP_DIVIDE_FLOAT ), \
+    OPCODE_DEF( OP_NOT ), \
+    OPCODE_DEF( OP_NEGATE_FLOAT ), \
+    OPCODE_DEF( OP_NEGATE_INT ), \
+    OPCODE_DEF( OP_BITWISE_OR ), \
+    OPCODE_DEF( OP_BITWISE_AND ), \
+    OPCODE_DEF( OP_BITWISE_XOR ), \
+    OPCODE_DEF( OP_LOGICAL_OR ), \
+    OPCODE_DEF( OP_LOGICAL_AND ), \
+    OPCODE_DEF( OP_SHIFT_LEFT ), \
+    OPCODE_DEF( OP_SHIFT_RIGHT ), \
+    OPCODE_DEF( OP_SHIFT_URIGHT ), \
+    OPCODE_DEF( OP_MAX_INT ), \
+    OPCODE_DEF( OP_PACK_POINT ), \
+    OPCODE_DEF( OP_POINT_X ), \
+    OPCODE_DEF( OP_POINT_Y ), \
+    OPCODE_DEF( OP_CLOCK ), \
+    OPCODE_DEF( OP_PRINT ), \
+    OPCODE_DEF( OP_JUMP ), \
+    OPCODE_DEF( OP_JUMP_IF_FALSE ), \
+    OPCODE_DEF( OP_POP_JUMP_IF_FALSE ), \
+    OPCODE_DEF( OP_JUMP_IF_NOT_EQUAL_INT ), \
+    OPCODE_DEF( OP_JUMP_IF_NOT_GREATER_INT ), \
+    OPCODE_DEF( OP_JUMP_IF_NOT_LESS_INT ), \
+    OPCODE_DEF( OP_JUMP_IF_NOT_LESS_LOCAL_CONST ), \
+    OPCODE_DEF( OP_NEW ), \
+    OPCODE_DEF( OP_CALL ), \
+    OPCODE_DEF( OP_CALL_DIRECT ), \
+    OPCODE_DEF( OP_CALL_NATIVE ), \
+    OPCODE_DEF( OP_ARRAY ), \
+    OPCODE_DEF( OP_ARRAY_GET ), \
+    OPCODE_DEF( OP_ARRAY_GET_UNCHECKED ), \
+    OPCODE_DEF( OP_ARRAY_SET ), \
+    OPCODE_DEF( OP_ARRAY_SET_UNCHECKED ), \
+    OPCODE_DEF( OP_ARRAY_LEN ), \
+    OPCODE_DEF( OP_CLOSURE ), \
+    OPCODE_DEF( OP_CLOSE_UPVALUE ), \
+    OPCODE_DEF( OP_RETURN ), \
+    OPCODE_DEF( OP_HALT ), \
+    OPCODE_DEF( OP_JIT ), \
+    OPCODE_DEF( OP_R_MOVE ), \
+    OPCODE_DEF( OP_R_LOADK ), \
+    OPCODE_DEF( OP_R_PUSH ), \
+    OPCODE_DEF( OP_R_JUMP_IF_FALSE ), \
+    REGISTER_OPS_DEF \
+
+#define REGISTER_HELPER_OP_DEF REGISTER_OP_DEF
+#define REGISTER_OP_DEF( identifier, valueConst, convertMacro, primitiveType, op ) \
+    OPCODE_DEF( OP_R_ ## identifier ), OPCODE_DEF( OP_R_ ## identifier ## _K ),
+#define OPCODE_DEF( identifier )  identifier
+typedef enum { OPCODES_DEF } OpCode;
+#undef OPCODE_DEF
+#undef REGISTER_OP_DEF
+#undef REGISTER_HELPER_OP_DEF
 
 struct Chunk {
   int count;
   int capacity;
   uint8_t *code;
+  uint8_t *opCodes; // the opcodes the JIT patched to OP_JIT, NULL until then
   int *lines;
   ValueArray constants;
+  ValueType *constantTypes; // Values are untagged, the collector reads these
 
   void init();
   void uninit();
   void reset();
 
   void writeChunk(uint8_t byte, int line);
-  int addConstant(Value value);
+  int addConstant(Value value, ValueType type);
+
+  // The opcode of the instruction at offset, seen through any OP_JIT patch
+  uint8_t opCode(int offset) {
+    return opCodes && code[offset] == OP_JIT ? opCodes[offset] : code[offset];
+  }
 };
 
 #endif
\ No newline at end of file
@@ -8,9 +8,12 @@
 #include <string.h>
 #include <array>
 #include <set>
+#include <vector>
 #include "codegen.hpp"
+#include "regcodegen.hpp"
 #include "attrset.hpp"
 #include "debug.hpp"
+#include "stackmap.hpp"
 
 CodeGenerator::CodeGenerator(Parser &parser, ObjFunction *function) : ExprVisitor(), parser(parser) {
   this->function = function;
@@ -26,7 +29,7 @@ void CodeGenerator::visitAssignExpr(AssignExpr *expr) {
   if (expr->value)
     accept<int>(expr->value, 0);
   else
-    emitConstant(INT_VAL(1));
+    emitConstant(INT_VAL(1), VAL_INT);
 
   if (expr->opCode != OP_FALSE)
     emitByte(expr->opCode);
@@ -48,10 +51,12 @@ void CodeGenerator::visitUIDirectiveExpr(UIDirectiveExpr *expr) {
 void CodeGenerator::visitBinaryExpr(BinaryExpr *expr) {
   if (expr->op.type == TOKEN_WHILE) {
     int loopStart = currentChunk()->count;
+    int exitJump = registerFlag ? RegisterGenerator(*this).emitJumpIfFalse(expr->left) : -1;
 
-    accept<int>(expr->left, 0);
-
-    int exitJump = emitJump(OP_POP_JUMP_IF_FALSE);
+    if (exitJump == -1) {
+      accept<int>(expr->left, 0);
+      exitJump = emitJump(OP_POP_JUMP_IF_FALSE);
+    }
 
     accept<int>(expr->right, 0);
     emitLoop(loopStart);
@@ -59,15 +64,18 @@ void CodeGenerator::visitBinaryExpr(BinaryExpr *expr) {
     return;
   }
 
+  if (registerFlag && RegisterGenerator(*this).emitValue(expr))
+    return;
+
 //  if (expr->left)
     accept<int>(expr->left, 0);
 //  else
-//    emitConstant(FLOAT_VAL(-1));
+//    emitConstant(FLOAT_VAL(-1), VAL_FLOAT);
 
   if (expr->right)
     accept<int>(expr->right, 0);
   else
-    emitConstant(FLOAT_VAL(-1));
+    emitConstant(FLOAT_VAL(-1), VAL_FLOAT);
 
   emitByte(expr->opCode);
 
@@ -76,7 +84,33 @@ void CodeGenerator::visitBinaryExpr(BinaryExpr *expr) {
 }
 
 void CodeGenerator::visitCallExpr(CallExpr *expr) {
-  accept<int>(expr->callee, 0);
+  Obj *native = expr->_function ? expr->_function->native : NULL;
+
+  // a QNI function called by name runs right on the arguments, no frame,
+  // or is replaced by its intrinsic opcode
+  if (native && native->type == OBJ_NATIVE && expr->callee->type == EXPR_REFERENCE) {
+    int opCode = ((ObjNative *) native)->opCode;
+
+    for (int index = 0; index < expr->count; index++)
+      accept<int>(expr->arguments[index]);
+
+    if (opCode != -1)
+      emitByte(opCode);
+    else {
+      emitBytes(OP_CALL_NATIVE, makeObjConstant(&expr->_function->obj));
+      emitByte(expr->count);
+    }
+    return;
+  }
+
+  // an upvalue-free function called by name needs no closure of its own
+  bool direct = expr->_function && !expr->newFlag && !native && !expr->_function->upvalueCount &&
+                expr->callee->type == EXPR_REFERENCE;
+
+  if (direct)
+    emitBytes(OP_CONSTANT, makeObjConstant(&expr->_function->getSharedClosure()->obj));
+  else
+    accept<int>(expr->callee, 0);
 
   for (int index = 0; index < expr->count; index++)
     accept<int>(expr->arguments[index]);
@@ -85,18 +119,15 @@ void CodeGenerator::visitCallExpr(CallExpr *expr) {
     if (expr->handler)
       accept<int>(expr->handler);
     else
-      emitConstant(INT_VAL(-1));
+      emitConstant(OBJ_VAL(NULL), VAL_OBJ); // no return handler
 
-  emitBytes(expr->newFlag ? OP_NEW : OP_CALL, expr->count);
+  emitBytes(expr->newFlag ? OP_NEW : direct ? OP_CALL_DIRECT : OP_CALL, expr->count);
 }
 
 void CodeGenerator::visitArrayElementExpr(ArrayElementExpr *expr) {
   accept<int>(expr->callee, 0);
-
-  for (int index = 0; index < expr->count; index++)
-    accept<int>(expr->indexes[index]);
-
-  emitBytes(OP_ARRAY_INDEX, expr->count);
+  accept<int>(expr->indexes[0], 0);
+  emitByte(expr->_uncheckedFlag ? OP_ARRAY_GET_UNCHECKED : OP_ARRAY_GET);
 }
 
 void CodeGenerator::visitDeclarationExpr(DeclarationExpr *expr) {
@@ -111,7 +142,7 @@ void CodeGenerator::visitFunctionExpr(FunctionExpr *expr) {
   if (parser.hadError)
     return;
 
-  emitBytes(OP_CLOSURE, makeConstant(OBJ_VAL(expr->function)));
+  emitBytes(OP_CLOSURE, makeConstant(OBJ_VAL(expr->function), VAL_OBJ));
 
   for (int i = 0; i < expr->function->upvalueCount; i++) {
     emitByte(expr->function->upvalues[i].isField ? 1 : 0);
@@ -121,7 +152,11 @@ void CodeGenerator::visitFunctionExpr(FunctionExpr *expr) {
 
 void CodeGenerator::visitGetExpr(GetExpr *expr) {
   accept<int>(expr->object, 0);
-  emitBytes(OP_GET_PROPERTY, expr->index);
+
+  if (expr->index == ARRAY_LENGTH_INDEX)
+    emitByte(OP_ARRAY_LEN);
+  else
+    emitBytes(OP_GET_PROPERTY, expr->index);
 }
 
 void CodeGenerator::visitGroupingExpr(GroupingExpr *expr) {
@@ -214,19 +249,12 @@ void CodeGenerator::visitGroupingExpr(GroupingExpr *expr) {
 }
 
 void CodeGenerator::visitArrayExpr(ArrayExpr *expr) {
-  CodeGenerator generator(parser, expr->function);
-
   for (int index = 0; index < expr->count; index++)
-    generator.emitCode(expr->expressions[index]);
-
-  generator.endCompiler();
-
-  if (parser.hadError)
-    return;
+    accept<int>(expr->expressions[index], 0);
 
-  emitBytes(OP_CLOSURE, makeConstant(OBJ_VAL(expr->function)));
-  emitConstant(INT_VAL(-1));
-  emitBytes(OP_NEW, 0);
+  // the array type, to type the elements of the new array
+  emitBytes(OP_ARRAY, makeConstant(OBJ_VAL(newArray(expr->_elementType, 0)), VAL_OBJ));
+  emitByte(expr->count);
 }
 
 void CodeGenerator::visitListExpr(ListExpr *expr) {
@@ -238,7 +266,7 @@ void CodeGenerator::visitListExpr(ListExpr *expr) {
       break;
     }
     case EXPR_CALL: {
-      ObjFunction *function = (ObjFunction *) expr->_declaration->type.objType;
+      ObjFunction *function = (ObjFunction *) expr->_compiler->getDeclaration(expr->_index).type.objType;
       CodeGenerator generator(parser, function);
       Expr *bodyExpr = function->bodyExpr;
 
@@ -250,7 +278,7 @@ void CodeGenerator::visitListExpr(ListExpr *expr) {
       if (parser.hadError)
         return;
 
-      emitBytes(OP_CLOSURE, makeConstant(OBJ_VAL(function)));
+      emitBytes(OP_CLOSURE, makeConstant(OBJ_VAL(function), VAL_OBJ));
 
       for (int i = 0; i < function->upvalueCount; i++) {
         emitByte(function->upvalues[i].isField ? 1 : 0);
@@ -266,7 +294,11 @@ void CodeGenerator::visitListExpr(ListExpr *expr) {
 }
 
 void CodeGenerator::visitLiteralExpr(LiteralExpr *expr) {
-  emitConstant(VALUE(expr->type, expr->as));
+  // strings are interned, so an equal literal is the very same constant
+  if (expr->type == VAL_OBJ && expr->as.obj->type == OBJ_STRING)
+    emitBytes(OP_CONSTANT, makeObjConstant(expr->as.obj));
+  else
+    emitConstant(VALUE(expr->type, expr->as), expr->type);
 }
 
 void CodeGenerator::visitLogicalExpr(LogicalExpr *expr) {
@@ -295,6 +327,9 @@ void CodeGenerator::visitLogicalExpr(LogicalExpr *expr) {
 }
 
 void CodeGenerator::visitOpcodeExpr(OpcodeExpr *expr) {
+  if (registerFlag && expr->op == OP_POP && RegisterGenerator(*this).emitStatement(expr->right))
+    return;
+
   if (expr->right != NULL)
     expr->right->accept(this);
 
@@ -309,6 +344,16 @@ void CodeGenerator::visitReturnExpr(ReturnExpr *expr) {
 }
 
 void CodeGenerator::visitSetExpr(SetExpr *expr) {
+  if (expr->object->type == EXPR_ARRAYELEMENT) {
+    ArrayElementExpr *elementExpr = (ArrayElementExpr *) expr->object;
+
+    accept<int>(elementExpr->callee, 0);
+    accept<int>(elementExpr->indexes[0], 0);
+    accept<int>(expr->value, 0);
+    emitByte(elementExpr->_uncheckedFlag ? OP_ARRAY_SET_UNCHECKED : OP_ARRAY_SET);
+    return;
+  }
+
   accept<int>(expr->object, 0);
   accept<int>(expr->value, 0);
   emitBytes(OP_SET_PROPERTY, expr->index);
@@ -322,9 +367,12 @@ void CodeGenerator::visitSuperExpr(SuperExpr *expr) {
 }
 
 void CodeGenerator::visitTernaryExpr(TernaryExpr *expr) {
-  expr->left->accept(this);
+  int thenJump = registerFlag ? RegisterGenerator(*this).emitJumpIfFalse(expr->left) : -1;
 
-  int thenJump = emitJump(OP_POP_JUMP_IF_FALSE);
+  if (thenJump == -1) {
+    expr->left->accept(this);
+    thenJump = emitJump(OP_POP_JUMP_IF_FALSE);
+  }
   expr->middle->accept(this);
 
   if (expr->right) {
@@ -349,9 +397,9 @@ void CodeGenerator::visitUnaryExpr(UnaryExpr *expr) {
 
   switch (expr->op.type) {
     case TOKEN_PRINT:         emitByte(OP_PRINT); break;
-//    case TOKEN_MINUS:         emitByte(OP_PRINT); break;
+    case TOKEN_MINUS:         break; // negated by the resolver
     case TOKEN_BANG:          emitByte(OP_NOT); break;
-    case TOKEN_PERCENT:       emitConstant(FLOAT_VAL(100)); emitByte(OP_DIVIDE_FLOAT); break;
+    case TOKEN_PERCENT:       emitConstant(FLOAT_VAL(100), VAL_FLOAT); emitByte(OP_DIVIDE_FLOAT); break;
     default: return; // Unreachable.
   }
 }
@@ -409,8 +457,8 @@ void CodeGenerator::emitHalt() {/*
   emitByte(OP_HALT);
 }
 
-uint8_t CodeGenerator::makeConstant(Value value) {
-  int constant = currentChunk()->addConstant(value);
+uint8_t CodeGenerator::makeConstant(Value value, ValueType type) {
+  int constant = currentChunk()->addConstant(value, type);
 
   if (constant > UINT8_MAX) {
     parser.error("Too many constants in one chunk.");
@@ -420,8 +468,19 @@ uint8_t CodeGenerator::makeConstant(Value value) {
   return (uint8_t)constant;
 }
 
-void CodeGenerator::emitConstant(Value value) {
-  emitBytes(OP_CONSTANT, makeConstant(value));
+// Reuses the slot of a constant referencing the same object
+uint8_t CodeGenerator::makeObjConstant(Obj *object) {
+  ValueArray *constants = &currentChunk()->constants;
+
+  for (int index = 0; index < constants->count && index <= UINT8_MAX; index++)
+    if (AS_OBJ(constants->values[index]) == object)
+      return index;
+
+  return makeConstant(OBJ_VAL(object), VAL_OBJ);
+}
+
+void CodeGenerator::emitConstant(Value value, ValueType type) {
+  emitBytes(OP_CONSTANT, makeConstant(value, type));
 }
 
 void CodeGenerator::patchJump(int offset) {
@@ -438,6 +497,263 @@ void CodeGenerator::patchJump(int offset) {
 
 void CodeGenerator::endCompiler() {
   emitHalt();
+#ifndef NO_PEEPHOLE
+  while (peephole());
+#endif
+  // call() reserves this much stack, so pushes need no check
+  if (!parser.hadError)
+    function->stackSize = getStackMap(function)->depth;
+}
+
+int instructionLength(Chunk *chunk, int offset) {
+  switch (chunk->opCode(offset)) {
+    case OP_CONSTANT:
+    case OP_GET_UPVALUE:
+    case OP_SET_UPVALUE:
+    case OP_GET_PROPERTY:
+    case OP_SET_PROPERTY:
+    case OP_GET_LOCAL:
+    case OP_SET_LOCAL:
+    case OP_SET_LOCAL_POP:
+    case OP_NEW:
+    case OP_CALL:
+    case OP_CALL_DIRECT:
+    case OP_R_PUSH:
+      return 2;
+
+    case OP_GET_LOCAL_DIR:
+    case OP_ADD_LOCAL:
+    case OP_MAX_LOCAL:
+    case OP_ADD_LOCAL_CONST:
+    case OP_SUBTRACT_LOCAL_CONST:
+    case OP_MULTIPLY_LOCAL_CONST:
+    case OP_INC_LOCAL:
+    case OP_JUMP:
+    case OP_JUMP_IF_FALSE:
+    case OP_POP_JUMP_IF_FALSE:
+    case OP_JUMP_IF_NOT_EQUAL_INT:
+    case OP_JUMP_IF_NOT_GREATER_INT:
+    case OP_JUMP_IF_NOT_LESS_INT:
+    case OP_R_MOVE:
+    case OP_R_LOADK:
+    case OP_CALL_NATIVE:
+    case OP_ARRAY:
+      return 3;
+
+    case OP_R_JUMP_IF_FALSE:
+      return 4;
+#define REGISTER_HELPER_OP_DEF REGISTER_OP_DEF
+#define REGISTER_OP_DEF( identifier, valueConst, convertMacro, primitiveType, op ) \
+    case OP_R_ ## identifier:                                                  \
+    case OP_R_ ## identifier ## _K:
+    REGISTER_OPS_DEF
+#undef REGISTER_OP_DEF
+#undef REGISTER_HELPER_OP_DEF
+      return 4;
+
+    case OP_JUMP_IF_NOT_LESS_LOCAL_CONST:
+      return 5;
+
+    case OP_CLOSURE:
+      return 2 + 2 * AS_FUNCTION(chunk->constants.values[chunk->code[offset + 1]])->upvalueCount;
+
+    default:
+      return 1;
+  }
+}
+
+// Position of the 16 bit offset inside a jump instruction, 0 if not a jump
+int jumpOperand(uint8_t instruction) {
+  switch (instruction) {
+    case OP_JUMP:
+    case OP_JUMP_IF_FALSE:
+    case OP_POP_JUMP_IF_FALSE:
+    case OP_JUMP_IF_NOT_EQUAL_INT:
+    case OP_JUMP_IF_NOT_GREATER_INT:
+    case OP_JUMP_IF_NOT_LESS_INT:
+      return 1;
+
+    case OP_R_JUMP_IF_FALSE:
+      return 2;
+
+    case OP_JUMP_IF_NOT_LESS_LOCAL_CONST:
+      return 3;
+
+    default:
+      return 0;
+  }
+}
+
+static OpCode fusedJump(uint8_t compare) {
+  switch (compare) {
+    case OP_EQUAL_INT: return OP_JUMP_IF_NOT_EQUAL_INT;
+    case OP_GREATER_INT: return OP_JUMP_IF_NOT_GREATER_INT;
+    case OP_LESS_INT: return OP_JUMP_IF_NOT_LESS_INT;
+    default: return OP_FALSE;
+  }
+}
+
+static OpCode fusedLocalConst(uint8_t arithmetic) {
+  switch (arithmetic) {
+    case OP_ADD_INT: return OP_ADD_LOCAL_CONST;
+    case OP_SUBTRACT_INT: return OP_SUBTRACT_LOCAL_CONST;
+    case OP_MULTIPLY_INT: return OP_MULTIPLY_LOCAL_CONST;
+    default: return OP_FALSE;
+  }
+}
+
+// Rewrites common instruction sequences of the finished chunk into fused
+// opcodes, in place since fused code is never longer than the original.
+// An instruction that is a jump target always starts a new sequence, and
+// all jumps are retargeted once the code has been compacted. Returns true
+// if anything was fused, so the caller can iterate to a fixed point.
+bool CodeGenerator::peephole() {
+  Chunk *chunk = currentChunk();
+  uint8_t *code = chunk->code;
+  std::vector<int> offsets;
+  std::vector<int> targets;
+  std::vector<bool> isTarget(chunk->count + 1, false);
+
+  for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+    int operand = jumpOperand(code[offset]);
+    int target = -1;
+
+    if (operand) {
+      int16_t jump = (int16_t) ((code[offset + operand] << 8) | code[offset + operand + 1]);
+
+      target = offset + instructionLength(chunk, offset) + jump;
+      isTarget[target] = true;
+    }
+
+    offsets.push_back(offset);
+    targets.push_back(target);
+  }
+
+  int count = offsets.size();
+  std::vector<int> newOffsets(chunk->count + 1, 0);
+  std::vector<int> jumps;
+  int newCount = 0;
+  bool changed = false;
+  auto opCode = [&](int index) -> int {
+    return index < count && !isTarget[offsets[index]] ? code[offsets[index]] : -1;
+  };
+  auto operand = [&](int index, int byte) -> uint8_t {
+    return code[offsets[index] + byte];
+  };
+
+  for (int index = 0; index < count;) {
+    int offset = offsets[index];
+    int line = chunk->lines[offset];
+    uint8_t fused[5];
+    int length = 0;
+    int jumpIndex = -1;
+    int size = 1;
+
+    switch (code[offset]) {
+      case OP_GET_LOCAL:
+        if (opCode(index + 1) == OP_CONSTANT && opCode(index + 2) == OP_LESS_INT &&
+            opCode(index + 3) == OP_POP_JUMP_IF_FALSE) {
+          fused[length++] = OP_JUMP_IF_NOT_LESS_LOCAL_CONST;
+          fused[length++] = operand(index, 1);
+          fused[length++] = operand(index + 1, 1);
+          length += 2;
+          jumpIndex = index + 3;
+          size = 4;
+        }
+        else if (opCode(index + 1) == OP_CONSTANT && opCode(index + 2) != -1 &&
+                 fusedLocalConst(opCode(index + 2)) != OP_FALSE) {
+          fused[length++] = fusedLocalConst(opCode(index + 2));
+          fused[length++] = operand(index, 1);
+          fused[length++] = operand(index + 1, 1);
+          size = 3;
+        }
+        else if (opCode(index + 1) == OP_GET_LOCAL &&
+                 (opCode(index + 2) == OP_ADD_INT || opCode(index + 2) == OP_MAX_INT)) {
+          fused[length++] = opCode(index + 2) == OP_ADD_INT ? OP_ADD_LOCAL : OP_MAX_LOCAL;
+          fused[length++] = operand(index, 1);
+          fused[length++] = operand(index + 1, 1);
+          size = 3;
+        }
+        else if (opCode(index + 1) == OP_INC_LOCAL && opCode(index + 2) == OP_POP) {
+          // the pushed local is dropped right away
+          fused[length++] = OP_INC_LOCAL;
+          fused[length++] = operand(index + 1, 1);
+          fused[length++] = operand(index + 1, 2);
+          size = 3;
+        }
+        break;
+
+      case OP_ADD_LOCAL_CONST:
+        if (opCode(index + 1) == OP_SET_LOCAL_POP && operand(index, 1) == operand(index + 1, 1)) {
+          fused[length++] = OP_INC_LOCAL;
+          fused[length++] = operand(index, 1);
+          fused[length++] = operand(index, 2);
+          size = 2;
+        }
+        break;
+
+      case OP_SET_LOCAL:
+        if (opCode(index + 1) == OP_POP) {
+          fused[length++] = OP_SET_LOCAL_POP;
+          fused[length++] = operand(index, 1);
+          size = 2;
+        }
+        break;
+
+      case OP_EQUAL_INT:
+      case OP_GREATER_INT:
+      case OP_LESS_INT:
+        if (opCode(index + 1) == OP_POP_JUMP_IF_FALSE) {
+          fused[length++] = fusedJump(code[offset]);
+          length += 2;
+          jumpIndex = index + 1;
+          size = 2;
+        }
+        break;
+    }
+
+    newOffsets[offset] = newCount;
+
+    if (length) {
+      changed = true;
+
+      for (int byte = 0; byte < length; byte++) {
+        code[newCount] = fused[byte];
+        chunk->lines[newCount++] = line;
+      }
+    }
+    else {
+      int end = offsets[index] + instructionLength(chunk, offset);
+
+      jumpIndex = targets[index] != -1 ? index : -1;
+
+      for (int byte = offset; byte < end; byte++) {
+        code[newCount] = code[byte];
+        chunk->lines[newCount++] = chunk->lines[byte];
+      }
+    }
+
+    if (jumpIndex != -1) {
+      jumps.push_back(newOffsets[offset]);
+      jumps.push_back(targets[jumpIndex]);
+    }
+
+    index += size;
+  }
+
+  newOffsets[chunk->count] = newCount;
+  chunk->count = newCount;
+
+  for (size_t index = 0; index < jumps.size(); index += 2) {
+    int offset = jumps[index];
+    int position = offset + jumpOperand(code[offset]);
+    int jump = newOffsets[jumps[index + 1]] - (offset + instructionLength(chunk, offset));
+
+    code[position] = (jump >> 8) & 0xff;
+    code[position + 1] = jump & 0xff;
+  }
+
+  return changed;
 }
 /*
 fun·fib(n)·{
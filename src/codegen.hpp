@@ -12,6 +12,8 @@
 class CodeGenerator : public ExprVisitor {
   Parser &parser;
   ObjFunction *function;
+
+  friend class RegisterGenerator;
 public:
   CodeGenerator(Parser &parser, ObjFunction *function);
 
@@ -49,10 +51,15 @@ public:
   void emitLoop(int loopStart);
   int emitJump(uint8_t instruction);
   void emitHalt();
-  uint8_t makeConstant(Value value);
-  void emitConstant(Value value);
+  uint8_t makeConstant(Value value, ValueType type);
+  uint8_t makeObjConstant(Obj *object);
+  void emitConstant(Value value, ValueType type);
   void patchJump(int offset);
   void endCompiler();
+  bool peephole();
 };
 
+int instructionLength(Chunk *chunk, int offset);
+int jumpOperand(uint8_t instruction);
+
 #endif
@@ -14,6 +14,13 @@
 #define DEBUG_PRINT_CODE
 //#define DEBUG_TRACE_EXECUTION
 //#define NO_CLOSURE
+//#define NO_COMPUTED_GOTO
+//#define NO_PEEPHOLE
+//#define NO_JIT
+//#define NO_SIMD
+//#define DEBUG_STRESS_GC
+//#define DEBUG_LOG_GC
+//#define NO_POOL_ALLOCATOR
 
 #define UINT8_COUNT (UINT8_MAX + 1)
 
@@ -14,6 +14,8 @@
 #include "codegen.hpp"
 #include "astprinter.hpp"
 #include "object.hpp"
+#include "memory.h"
+#include "arena.hpp"
 
 #ifdef DEBUG_PRINT_CODE
 #include "debug.hpp"
@@ -29,7 +31,7 @@ void popSignature() {
   signatures.pop();
 }
 
-static ObjCallable *getSignature() {
+ObjCallable *getSignature() {
   return signatures.empty() ? NULL : signatures.top();
 }
 
@@ -97,13 +99,14 @@ void Compiler::beginScope(ObjFunction *function) {
   fieldCount = 0;
   declarationStart = 0;
   declarationCount = 0;
+  clearIndex();
   this->function = function;
 
   if (enclosing) {
     ObjString *enclosingNameObj = enclosing->function->name;
     std::string enclosingName = enclosingNameObj ? std::string("_") + enclosingNameObj->chars : "";
 
-    prefix = enclosing->prefix + enclosingName;
+    prefix = astArena->copy((enclosing->prefix + enclosingName).c_str());
   }
   else
     prefix = "qni";
@@ -117,6 +120,7 @@ void Compiler::beginScope() {
   fieldCount = 0;
   declarationStart = enclosing->declarationStart + enclosing->declarationCount;
   declarationCount = 0;
+  clearIndex();
   function = enclosing->function;
   prefix = enclosing->prefix;
 }
@@ -130,22 +134,32 @@ Declaration *Compiler::addDeclaration(ValueType type) {
 }
 
 Declaration *Compiler::addDeclaration(Type type) {
-  if (declarationCount == UINT8_COUNT) {
-    parser->error("Too many declarations in function.");
-    return NULL;
+  if (declarationCount == declarationCapacity) {
+    int oldCapacity = declarationCapacity;
+
+    declarationCapacity = GROW_CAPACITY(oldCapacity);
+    declarations = ARENA_RESIZE(Declaration, declarations, oldCapacity, declarationCapacity);
+    shadowed = ARENA_RESIZE(int, shadowed, oldCapacity, declarationCapacity);
+
+    if (function->declarationCount == &declarationCount)
+      function->declarations = declarations;
   }
 
+  shadowed[declarationCount] = -2;
+
   Declaration *dec = &declarations[declarationCount++];
 
   dec->type = type;
   dec->name.start = "";
   dec->name.length = 0;
   dec->isField = function->isClass();
+  dec->isAssigned = false;
   return dec;
 }
 
 Type Compiler::removeDeclaration() {
-  return declarations[--declarationCount].type;
+  unindexDeclaration(--declarationCount);
+  return declarations[declarationCount].type;
 }
 
 Declaration *Compiler::peekDeclaration(int index) {
@@ -153,7 +167,11 @@ Declaration *Compiler::peekDeclaration(int index) {
 }
 
 void Compiler::setDeclarationName(Token *name) {
+  unindexDeclaration(declarationCount - 1);
   declarations[declarationCount - 1].name = *name;
+
+  if (name->length)
+    indexDeclaration(declarationCount - 1);
 }
 
 void Compiler::setDeclarationType(ObjFunction *function) {
@@ -172,7 +190,7 @@ int Compiler::resolveReference(Token *name) {
   char buffer[2048] = "";
   ObjCallable *signature = getSignature();
 
-  for (int i = declarationCount - 1; found < 0 && i >= 0; i--) {
+  for (int i = findDeclaration(name); found < 0 && i != -1; i = shadowed[i]) {
     Declaration *dec = &declarations[i];
 
     if (identifiersEqual(name, &dec->name)) {
@@ -252,6 +270,9 @@ int Compiler::resolveReference(Token *name) {
     }
   }
 
+  if (found >= UINT8_COUNT)
+    parser->error("Too many local variables in function.");
+
   if (found == -2) {
     char parms[512] = "";
 
@@ -310,6 +331,8 @@ int Compiler::addUpvalue(uint8_t index, Type type, bool isDeclaration) {
 void Compiler::resolveReferenceExpr(ReferenceExpr *expr) {
   Compiler *current = this;
 
+  expr->_compiler = NULL;
+
   while (true) {
     expr->index = current->resolveReference(&expr->name);
 
@@ -337,13 +360,14 @@ void Compiler::resolveReferenceExpr(ReferenceExpr *expr) {
     break;
 
   default:
+    expr->_compiler = current;
     addDeclaration(current->getDeclaration(expr->index).type);
     break;
   }
 }
 
 void Compiler::checkDeclaration(Token *name) {
-  for (int i = declarationCount - 1; i >= 0; i--) {
+  for (int i = findDeclaration(name); i != -1; i = shadowed[i]) {
     Declaration *dec = &declarations[i];
 
     if (identifiersEqual(name, &dec->name))
@@ -351,6 +375,98 @@ void Compiler::checkDeclaration(Token *name) {
   }
 }
 
+static uint32_t hashName(Token *name) {
+  return hashString(name->start, name->length);
+}
+
+// Named declarations are chained per bucket from the newest to the oldest,
+// shadowed[] linking each to the next older one (-2 when not indexed).
+// Declarations are named and removed in stack order, so the one being
+// unindexed is always at the head of its bucket.
+int Compiler::findDeclaration(Token *name) {
+  return bucketCount ? buckets[hashName(name) & (bucketCount - 1)] : -1;
+}
+
+void Compiler::indexDeclaration(int index) {
+  if (namedCount >= bucketCount) {
+    bucketCount = bucketCount ? bucketCount * 2 : 8;
+    buckets = ARENA_ARRAY(int, bucketCount);
+    namedCount = 0;
+
+    for (int bucket = 0; bucket < bucketCount; bucket++)
+      buckets[bucket] = -1;
+
+    for (int ndx = 0; ndx < index; ndx++)
+      if (shadowed[ndx] != -2) {
+        shadowed[ndx] = -2;
+        indexDeclaration(ndx);
+      }
+  }
+
+  int *bucket = &buckets[hashName(&declarations[index].name) & (bucketCount - 1)];
+
+  shadowed[index] = *bucket;
+  *bucket = index;
+  namedCount++;
+}
+
+void Compiler::unindexDeclaration(int index) {
+  if (shadowed[index] != -2) {
+    buckets[hashName(&declarations[index].name) & (bucketCount - 1)] = shadowed[index];
+    shadowed[index] = -2;
+    namedCount--;
+  }
+}
+
+void Compiler::clearIndex() {
+  for (int bucket = 0; bucket < bucketCount; bucket++)
+    buckets[bucket] = -1;
+
+  namedCount = 0;
+}
+
 bool Compiler::inBlock() {
   return enclosing && enclosing->function == function;
 }
+
+void markCompilerRoots() {
+  for (Compiler *compiler = getCurrent(); compiler != NULL; compiler = compiler->enclosing) {
+    markObject((Obj *) compiler->function);
+
+    for (int index = 0; index < compiler->declarationCount; index++)
+      markType(compiler->declarations[index].type);
+  }
+
+  markPrimitives();
+}
+
+// Compiled functions outlive the AST, so they get their own copy of the
+// declarations left in their compiler
+void detachDeclarations(ObjFunction *function) {
+  int count = *function->declarationCount;
+  Declaration *declarations = ALLOCATE(Declaration, count);
+
+  for (int index = 0; index < count; index++) {
+    declarations[index] = function->declarations[index];
+
+    if (astArena->owns(declarations[index].name.start))
+      declarations[index].name = buildToken(TOKEN_IDENTIFIER, NULL, 0, -1);
+  }
+
+  function->detachedCount = count;
+  function->declarationCount = &function->detachedCount;
+  function->declarations = declarations;
+}
+
+void detachFunctions(Arena &arena) {
+  for (Obj *object = objects; object != NULL; object = object->next)
+    if (object->type == OBJ_FUNCTION) {
+      ObjFunction *function = (ObjFunction *) object;
+
+      if (arena.owns(function->declarationCount))
+        detachDeclarations(function);
+
+      if (arena.owns(function->bodyExpr))
+        function->bodyExpr = NULL;
+    }
+}
@@ -10,18 +10,27 @@
 #include <iostream>
 #include "object.hpp"
 
+// GetExpr index of the length of an array
+#define ARRAY_LENGTH_INDEX -2
+
 class Parser;
 struct ReferenceExpr;
+struct Arena;
 
 struct Compiler {
   Parser *parser;
-  std::string prefix;
+  const char *prefix;
   Compiler *enclosing;
   ObjFunction *function = NULL;
   int fieldCount;
   int declarationStart;
   int declarationCount;
-  Declaration declarations[UINT8_COUNT];
+  int declarationCapacity = 0;
+  Declaration *declarations = NULL;
+  int *shadowed = NULL;
+  int *buckets = NULL;
+  int bucketCount = 0;
+  int namedCount = 0;
   ObjFunction *compile(Parser &parser);
 
   void beginScope(ObjFunction *function);
@@ -54,6 +63,11 @@ struct Compiler {
   }
 private:
   static Compiler *current;
+
+  int findDeclaration(Token *name);
+  void indexDeclaration(int index);
+  void unindexDeclaration(int index);
+  void clearIndex();
 };
 
 struct ObjCallable;
@@ -61,6 +75,11 @@ struct ObjCallable;
 bool identifiersEqual(Token *a, Token *b);
 void pushSignature(ObjCallable *signature);
 void popSignature();
+ObjCallable *getSignature();
+void markCompilerRoots();
+void detachDeclarations(ObjFunction *function);
+void detachFunctions(Arena &arena);
+void markPrimitives();
 
 
 static inline Compiler *getCurrent() {
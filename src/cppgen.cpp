@@ -0,0 +1,454 @@
+/*
+ * The QED Programming Language
+ * Copyright (C) 2022-2023  Hocus Codus Software inc.
+ *
+ * All rights reserved.
+ */
+#include <stdio.h>
+#include <cstdarg>
+#include <set>
+#include <string>
+#include <vector>
+#include "cppgen.hpp"
+#include "codegen.hpp"
+#include "jit.hpp"
+#include "qni.hpp"
+
+// Each instruction becomes a C++ statement on the interpreter's own stack,
+// exactly like the JIT templates, so that the C++ compiler can then keep
+// locals and temporaries in registers. QNI functions are called by name.
+// Anything else touching frames or threads returns its offset to the
+// interpreter, and the instruction after it becomes an entry point; calls
+// to QED functions, OP_NEW and OP_HALT thus keep their coroutine semantics.
+// The runtime still compiles the embedded source at start-up to rebuild
+// the functions, types and constants the translated code runs against.
+
+static std::string format(const char *pattern, ...) {
+  char buffer[1024];
+  va_list args;
+
+  va_start(args, pattern);
+  vsnprintf(buffer, sizeof(buffer), pattern, args);
+  va_end(args);
+  return buffer;
+}
+
+static const char *binaryOp(uint8_t instruction, const char **valueConst, const char **convertMacro) {
+  *valueConst = "INT_VAL";
+  *convertMacro = "AS_INT";
+
+  switch (instruction) {
+    case OP_ADD_INT: return "+";
+    case OP_SUBTRACT_INT: return "-";
+    case OP_MULTIPLY_INT: return "*";
+    case OP_DIVIDE_INT: return "/";
+    case OP_BITWISE_OR: return "|";
+    case OP_BITWISE_AND: return "&";
+    case OP_BITWISE_XOR: return "^";
+    case OP_SHIFT_LEFT: return "<<";
+    case OP_SHIFT_RIGHT: return ">>";
+  }
+
+  *valueConst = "BOOL_VAL";
+
+  switch (instruction) {
+    case OP_EQUAL_INT: return "==";
+    case OP_GREATER_INT: return ">";
+    case OP_LESS_INT: return "<";
+  }
+
+  *convertMacro = "AS_FLOAT";
+
+  switch (instruction) {
+    case OP_EQUAL_FLOAT: return "==";
+    case OP_GREATER_FLOAT: return ">";
+    case OP_LESS_FLOAT: return "<";
+  }
+
+  *valueConst = "FLOAT_VAL";
+
+  switch (instruction) {
+    case OP_ADD_FLOAT: return "+";
+    case OP_SUBTRACT_FLOAT: return "-";
+    case OP_MULTIPLY_FLOAT: return "*";
+    case OP_DIVIDE_FLOAT: return "/";
+  }
+
+  *valueConst = "BOOL_VAL";
+  *convertMacro = "AS_BOOL";
+
+  switch (instruction) {
+    case OP_LOGICAL_OR: return "||";
+    case OP_LOGICAL_AND: return "&&";
+  }
+
+  return NULL;
+}
+
+// The C++ name of the QNI function an OP_CALL_NATIVE calls
+static const char *nativeName(Chunk *chunk, uint8_t *code) {
+  ObjFunction *function = AS_FUNCTION(chunk->constants.values[code[1]]);
+
+  return nativeFnName(((ObjNative *) function->native)->function);
+}
+
+// Returns false, and a statement handing the offset back, if unsupported
+static bool translateInstruction(Chunk *chunk, int offset, std::string &out, std::vector<bool> &labels) {
+  uint8_t *code = &chunk->code[offset];
+  uint8_t instruction = chunk->opCode(offset);
+  int next = offset + instructionLength(chunk, offset);
+#define SLOT (code[1])
+#define CONSTANT(index) AS_INT(chunk->constants.values[code[index]])
+#define TARGET(index) (next + (int16_t) ((code[index] << 8) | code[index + 1]))
+#define BRANCH(index) (labels[TARGET(index)] = true, TARGET(index))
+
+  switch (instruction) {
+    case OP_CONSTANT:
+      out = format("*top++ = constants[%d];", code[1]);
+      return true;
+
+    case OP_TRUE:
+    case OP_FALSE:
+      out = format("*top++ = BOOL_VAL(%s);", instruction == OP_TRUE ? "true" : "false");
+      return true;
+
+    case OP_POP:
+      out = "top--;";
+      return true;
+
+    case OP_GET_LOCAL:
+      out = format("*top++ = slots[%d];", SLOT);
+      return true;
+
+    case OP_SET_LOCAL:
+      out = format("slots[%d] = top[-1];", SLOT);
+      return true;
+
+    case OP_SET_LOCAL_POP:
+      out = format("slots[%d] = *--top;", SLOT);
+      return true;
+
+    case OP_GET_LOCAL_DIR:
+      out = format("*top++ = INT_VAL(AS_INT(slots[%d]));", code[2]);
+      return true;
+
+    case OP_ADD_LOCAL:
+    case OP_MAX_LOCAL: {
+      const char *pattern = instruction == OP_ADD_LOCAL ? "*top++ = INT_VAL(AS_INT(slots[%d]) + AS_INT(slots[%d]));" :
+                                                      "*top++ = INT_VAL(std::max(AS_INT(slots[%d]), AS_INT(slots[%d])));";
+
+      out = format(pattern, SLOT, code[2]);
+      return true;
+    }
+
+    case OP_ADD_LOCAL_CONST:
+    case OP_SUBTRACT_LOCAL_CONST:
+    case OP_MULTIPLY_LOCAL_CONST:
+      out = format("*top++ = INT_VAL(AS_INT(slots[%d]) %s %ldL);", SLOT,
+                   instruction == OP_ADD_LOCAL_CONST ? "+" : instruction == OP_SUBTRACT_LOCAL_CONST ? "-" : "*", CONSTANT(2));
+      return true;
+
+    case OP_INC_LOCAL:
+      out = format("slots[%d] = INT_VAL(AS_INT(slots[%d]) + %ldL);", SLOT, SLOT, CONSTANT(2));
+      return true;
+
+    case OP_GET_UPVALUE:
+      out = format("*top++ = *upvalues[%d]->location;", code[1]);
+      return true;
+
+    case OP_SET_UPVALUE:
+      out = format("*upvalues[%d]->location = top[-1]; WRITE_BARRIER(&upvalues[%d]->obj);", code[1], code[1]);
+      return true;
+
+    case OP_GET_PROPERTY:
+      out = format("top[-1] = AS_THREAD(top[-1])->fields[%d];", code[1]);
+      return true;
+
+    case OP_SET_PROPERTY:
+      out = format("AS_THREAD(top[-2])->fields[%d] = top[-1]; WRITE_BARRIER(AS_OBJ(top[-2])); top[-2] = top[-1]; top--;", code[1]);
+      return true;
+
+    case OP_ARRAY_GET_UNCHECKED:
+      out = "top[-2] = getArrayElement(AS_ARRAY(top[-2]), AS_INT(top[-1])); top--;";
+      return true;
+
+    case OP_ARRAY_SET_UNCHECKED:
+      out = "setArrayElement(AS_ARRAY(top[-3]), AS_INT(top[-2]), top[-1]); WRITE_BARRIER(AS_OBJ(top[-3])); top[-3] = top[-1]; top -= 2;";
+      return true;
+
+    case OP_ARRAY_LEN:
+      out = "top[-1] = INT_VAL(AS_ARRAY(top[-1])->count);";
+      return true;
+
+    case OP_INT_TO_FLOAT:
+      out = "top[-1] = FLOAT_VAL((double) AS_INT(top[-1]));";
+      return true;
+
+    case OP_FLOAT_TO_INT:
+      out = "top[-1] = INT_VAL((long) AS_FLOAT(top[-1]));";
+      return true;
+
+    case OP_EQUAL_STRING:
+      out = "top[-2] = BOOL_VAL(stringsEqual(AS_OBJ(top[-2]), AS_OBJ(top[-1]))); top--;";
+      return true;
+
+    case OP_GREATER_STRING:
+    case OP_LESS_STRING:
+      out = format("top[-2] = BOOL_VAL(valuesCompare(top[-2], top[-1]) %s 0); top--;",
+                   instruction == OP_GREATER_STRING ? ">" : "<");
+      return true;
+
+    case OP_MAX_INT:
+      out = "top[-2] = INT_VAL(std::max(AS_INT(top[-2]), AS_INT(top[-1]))); top--;";
+      return true;
+
+    case OP_PACK_POINT:
+      out = "top[-2] = INT_VAL((AS_INT(top[-2]) << 16) | AS_INT(top[-1])); top--;";
+      return true;
+
+    case OP_POINT_X:
+      out = "top[-1] = INT_VAL(AS_INT(top[-1]) >> 16);";
+      return true;
+
+    case OP_POINT_Y:
+      out = "top[-1] = INT_VAL(AS_INT(top[-1]) & 0xFFFF);";
+      return true;
+
+    case OP_SHIFT_URIGHT:
+      out = "top[-2] = INT_VAL((long) ((unsigned long) AS_INT(top[-2]) >> AS_INT(top[-1]))); top--;";
+      return true;
+
+    case OP_NOT:
+      out = "top[-1] = BOOL_VAL(!AS_BOOL(top[-1]));";
+      return true;
+
+    case OP_NEGATE_INT:
+      out = "top[-1] = INT_VAL(-AS_INT(top[-1]));";
+      return true;
+
+    case OP_NEGATE_FLOAT:
+      out = "top[-1] = FLOAT_VAL(-AS_FLOAT(top[-1]));";
+      return true;
+
+    case OP_JUMP:
+      out = format("goto L%d;", BRANCH(1));
+      return true;
+
+    case OP_JUMP_IF_FALSE:
+      out = format("if (!AS_BOOL(top[-1])) goto L%d;", BRANCH(1));
+      return true;
+
+    case OP_POP_JUMP_IF_FALSE:
+      out = format("if (!AS_BOOL(*--top)) goto L%d;", BRANCH(1));
+      return true;
+
+    case OP_JUMP_IF_NOT_EQUAL_INT:
+    case OP_JUMP_IF_NOT_GREATER_INT:
+    case OP_JUMP_IF_NOT_LESS_INT:
+      out = format("top -= 2; if (!(AS_INT(top[0]) %s AS_INT(top[1]))) goto L%d;",
+                   instruction == OP_JUMP_IF_NOT_EQUAL_INT ? "==" : instruction == OP_JUMP_IF_NOT_GREATER_INT ? ">" : "<",
+                   BRANCH(1));
+      return true;
+
+    case OP_JUMP_IF_NOT_LESS_LOCAL_CONST:
+      out = format("if (!(AS_INT(slots[%d]) < %ldL)) goto L%d;", SLOT, CONSTANT(2), BRANCH(3));
+      return true;
+
+    case OP_CALL_NATIVE: {
+      const char *name = nativeName(chunk, code);
+      bool isVoid = AS_FUNCTION(chunk->constants.values[code[1]])->type.valueType == VAL_VOID;
+      int argCount = code[2];
+
+      if (!name)
+        break;
+
+      // like OP_CALL_NATIVE, rebase on the thread's top as natives may run
+      // other threads, and reach a safe point with the interpreter's top
+      // set and the frame at the offset its stack map is kept for
+      out = format("{ long depth = top - slots; CallFrame *frame = &state->thread->frames[state->thread->frameCount - 1]; "
+                   "frame->ip = frame->closure->function->chunk.code + %d; stackTop = state->thread->savedStackTop = top; "
+                   "Value result = %s(%d, top - %d); frame->ip += 2; top = state->thread->savedStackTop - %d; "
+                   "slots = top + %d - depth; %s"
+                   "stackTop = top; gcSafePoint(&state->thread->obj); }",
+                   offset + 1, name, argCount, argCount, argCount, argCount, isVoid ? "(void) result; " : "*top++ = result; ");
+      return true;
+    }
+
+    default: {
+      const char *valueConst;
+      const char *convertMacro;
+      const char *op = binaryOp(instruction, &valueConst, &convertMacro);
+
+      if (op) {
+        out = format("top[-2] = %s(%s(top[-2]) %s %s(top[-1])); top--;",
+                     valueConst, convertMacro, op, convertMacro);
+        return true;
+      }
+      break;
+    }
+  }
+
+  out = format("state->stackTop = top; return %d;", offset);
+  return false;
+#undef BRANCH
+#undef TARGET
+#undef CONSTANT
+#undef SLOT
+}
+
+static void emitFunction(FILE *file, int index, ObjFunction *function, std::vector<int> &entries) {
+  Chunk *chunk = &function->chunk;
+  std::vector<std::string> statements(chunk->count);
+  std::vector<bool> labels(chunk->count + 1, false);
+  std::vector<bool> supported(chunk->count, false);
+  bool entry = true;
+
+  for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+    supported[offset] = translateInstruction(chunk, offset, statements[offset], labels);
+
+    if (entry && supported[offset]) {
+      entries.push_back(offset);
+
+      if (offset)
+        labels[offset] = true;
+    }
+
+    entry = !supported[offset];
+  }
+
+  if (entries.empty())
+    return;
+
+  fprintf(file, "// %s\n", function->name ? function->name->chars : "<script>");
+  fprintf(file, "static int function%d(JitState *state, int entry) {\n", index);
+  fprintf(file, "  Value *slots = state->slots;\n");
+  fprintf(file, "  Value *top = state->stackTop;\n");
+  fprintf(file, "  ObjUpvalue **upvalues = state->upvalues;\n");
+  fprintf(file, "  Value *constants = state->constants;\n\n");
+  fprintf(file, "  (void) slots; (void) upvalues; (void) constants;\n\n");
+  fprintf(file, "  switch (entry) {\n");
+
+  for (size_t ndx = 0; ndx < entries.size(); ndx++)
+    if (entries[ndx])
+      fprintf(file, "    case %d: goto L%d;\n", entries[ndx], entries[ndx]);
+
+  fprintf(file, "  }\n\n");
+
+  // Instructions after an exit are only reached through their label
+  bool reachable = false;
+
+  for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+    if (labels[offset])
+      fprintf(file, "L%d:\n", offset);
+
+    if (labels[offset] || reachable || offset == entries[0])
+      fprintf(file, "  %s\n", statements[offset].c_str());
+
+    reachable = supported[offset];
+  }
+
+  if (labels[chunk->count])
+    fprintf(file, "L%d:\n", chunk->count);
+
+  fprintf(file, "  state->stackTop = top;\n");
+  fprintf(file, "  return %d;\n", chunk->count);
+  fprintf(file, "}\n\n");
+}
+
+static void emitNatives(FILE *file, std::vector<ObjFunction *> &functions) {
+  std::set<std::string> names;
+
+  for (size_t index = 0; index < functions.size(); index++) {
+    Chunk *chunk = &functions[index]->chunk;
+
+    for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset))
+      if (chunk->opCode(offset) == OP_CALL_NATIVE) {
+        const char *name = nativeName(chunk, &chunk->code[offset]);
+
+        if (name)
+          names.insert(name);
+      }
+  }
+
+  if (names.empty())
+    return;
+
+  fprintf(file, "extern Value *stackTop;\n");
+
+  for (std::set<std::string>::iterator name = names.begin(); name != names.end(); name++)
+    fprintf(file, "Value %s(int argCount, Value *args);\n", name->c_str());
+
+  fprintf(file, "\n");
+}
+
+static void emitSource(FILE *file, const char *source) {
+  fprintf(file, "static const char source[] =\n\"");
+
+  for (const char *ch = source; *ch; ch++)
+    switch (*ch) {
+      case '\n':
+        fprintf(file, ch[1] ? "\\n\"\n\"" : "\\n");
+        break;
+      case '"':
+      case '\\':
+        fprintf(file, "\\%c", *ch);
+        break;
+      default:
+        if ((unsigned char) *ch < ' ')
+          fprintf(file, "\\%03o", (unsigned char) *ch);
+        else
+          fputc(*ch, file);
+        break;
+    }
+
+  fprintf(file, "\";\n\n");
+}
+
+bool emitCpp(const char *path, const char *source, ObjFunction *function) {
+  FILE *file = fopen(path, "w");
+
+  if (file == NULL) {
+    fprintf(stderr, "Could not open file \"%s\".\n", path);
+    return false;
+  }
+
+  std::vector<ObjFunction *> functions;
+
+  collectFunctions(function, functions);
+  fprintf(file, "// Generated by qed --emit-cpp, link with the QED runtime\n");
+  fprintf(file, "#include <algorithm>\n");
+  fprintf(file, "#include \"jit.hpp\"\n");
+  fprintf(file, "#include \"memory.h\"\n\n");
+  emitNatives(file, functions);
+  emitSource(file, source);
+
+  std::vector<std::vector<int> > entries(functions.size());
+
+  for (size_t index = 0; index < functions.size(); index++)
+    if (functions[index]->chunk.count)
+      emitFunction(file, index, functions[index], entries[index]);
+
+  for (size_t index = 0; index < functions.size(); index++)
+    if (!entries[index].empty()) {
+      fprintf(file, "static const int entries%d[] = {", (int) index);
+
+      for (size_t ndx = 0; ndx < entries[index].size(); ndx++)
+        fprintf(file, ndx ? ", %d" : "%d", entries[index][ndx]);
+
+      fprintf(file, "};\n");
+    }
+
+  fprintf(file, "\nstatic AotFunction functions[] = {\n");
+
+  for (size_t index = 0; index < functions.size(); index++)
+    if (entries[index].empty())
+      fprintf(file, "  {0, NULL, 0, NULL},\n");
+    else
+      fprintf(file, "  {%luUL, function%d, %d, entries%d},\n", chunkChecksum(&functions[index]->chunk),
+              (int) index, (int) entries[index].size(), (int) index);
+
+  fprintf(file, "};\n\n");
+  fprintf(file, "static bool aotVar = addAotProgram(source, functions, %d);\n", (int) functions.size());
+  fclose(file);
+  return true;
+}
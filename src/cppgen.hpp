@@ -0,0 +1,17 @@
+/*
+ * The QED Programming Language
+ * Copyright (C) 2022-2023  Hocus Codus Software inc.
+ *
+ * All rights reserved.
+ */
+#ifndef qed_cppgen_h
+#define qed_cppgen_h
+
+#include "object.hpp"
+
+// Writes a C++ translation unit embedding source and a native translation
+// of every chunk of the compiled program; linked with the runtime, it runs
+// the program with its functions bound ahead of time
+bool emitCpp(const char *path, const char *source, ObjFunction *function);
+
+#endif
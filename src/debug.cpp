@@ -31,18 +31,73 @@ static int simpleInstruction(const char *name, int offset) {
 }
 
 static int byteInstruction(const char *name, Chunk *chunk, int offset) {
-  int8_t slot = chunk->code[offset + 1];
+  uint8_t slot = chunk->code[offset + 1];
   printf("%-16s %4d\n", name, slot);
   return offset + 2; 
 }
 
 static int byte2Instruction(const char *name, Chunk *chunk, int offset) {
-  int8_t a = chunk->code[offset + 1];
-  int8_t b = chunk->code[offset + 2];
+  uint8_t a = chunk->code[offset + 1];
+  uint8_t b = chunk->code[offset + 2];
   printf("%-16s %4d %4d\n", name, a, b);
   return offset + 3; 
 }
 
+static int objectByteInstruction(const char *name, Chunk *chunk, int offset) {
+  uint8_t index = chunk->code[offset + 1];
+  uint8_t b = chunk->code[offset + 2];
+  printf("%-16s %4d %4d ", name, index, b);
+  printObject(chunk->constants.values[index]);
+  printf("\n");
+  return offset + 3;
+}
+
+static int localConstantInstruction(const char *name, Chunk *chunk, int offset) {
+  uint8_t slot = chunk->code[offset + 1];
+  uint8_t index = chunk->code[offset + 2];
+  printf("%-16s %4d %4d '", name, slot, index);
+  printValue(chunk->constants.values[index]);
+  printf("'\n");
+  return offset + 3;
+}
+
+static int localConstantJumpInstruction(const char *name, Chunk *chunk, int offset) {
+  uint8_t slot = chunk->code[offset + 1];
+  uint8_t index = chunk->code[offset + 2];
+  uint16_t jump = (uint16_t)(chunk->code[offset + 3] << 8);
+  jump |= chunk->code[offset + 4];
+  printf("%-16s %4d %4d %4d -> %d\n", name, slot, index, offset,
+         offset + 5 + (int16_t) jump);
+  return offset + 5;
+}
+
+static void printRegister(uint8_t operand) {
+  char name[8];
+
+  snprintf(name, sizeof(name), operand & REGISTER_TEMP ? "t%d" : "%d", operand & ~REGISTER_TEMP);
+  printf(" %4s", name);
+}
+
+static int registerInstruction(const char *name, int operandCount, Chunk *chunk, int offset) {
+  printf("%-16s", name);
+  for (int index = 1; index <= operandCount; index++)
+    printRegister(chunk->code[offset + index]);
+  printf("\n");
+  return offset + 1 + operandCount;
+}
+
+static int registerConstantInstruction(const char *name, int operandCount, Chunk *chunk, int offset) {
+  uint8_t index = chunk->code[offset + operandCount + 1];
+
+  printf("%-16s", name);
+  for (int operand = 1; operand <= operandCount; operand++)
+    printRegister(chunk->code[offset + operand]);
+  printf(" %4d '", index);
+  printValue(chunk->constants.values[index]);
+  printf("'\n");
+  return offset + 2 + operandCount;
+}
+
 static int jumpInstruction(const char *name, int sign, Chunk *chunk, int offset) {
   uint16_t jump = (uint16_t)(chunk->code[offset + 1] << 8);
   jump |= chunk->code[offset + 2];
@@ -52,7 +107,7 @@ static int jumpInstruction(const char *name, int sign, Chunk *chunk, int offset)
 }
 
 int disassembleInstruction(Chunk *chunk, int offset) {
-  uint8_t instruction = chunk->code[offset];
+  uint8_t instruction = chunk->opCode(offset);
 
   printf("%04d ", offset);
 
@@ -102,6 +157,21 @@ int disassembleInstruction(Chunk *chunk, int offset) {
     case OP_SET_LOCAL:
       return byteInstruction("OP_SET_LOCAL", chunk, offset);
 
+    case OP_SET_LOCAL_POP:
+      return byteInstruction("OP_SET_LOCAL_POP", chunk, offset);
+
+    case OP_ADD_LOCAL_CONST:
+      return localConstantInstruction("OP_ADD_LOCAL_CONST", chunk, offset);
+
+    case OP_SUBTRACT_LOCAL_CONST:
+      return localConstantInstruction("OP_SUBTRACT_LOCAL_CONST", chunk, offset);
+
+    case OP_MULTIPLY_LOCAL_CONST:
+      return localConstantInstruction("OP_MULTIPLY_LOCAL_CONST", chunk, offset);
+
+    case OP_INC_LOCAL:
+      return localConstantInstruction("OP_INC_LOCAL", chunk, offset);
+
     case OP_INT_TO_FLOAT:
       return simpleInstruction("OP_INT_TO_FLOAT", offset);
 
@@ -198,6 +268,21 @@ int disassembleInstruction(Chunk *chunk, int offset) {
     case OP_SHIFT_LEFT:
       return simpleInstruction("OP_SHIFT_LEFT", offset);
 
+    case OP_MAX_INT:
+      return simpleInstruction("OP_MAX_INT", offset);
+
+    case OP_PACK_POINT:
+      return simpleInstruction("OP_PACK_POINT", offset);
+
+    case OP_POINT_X:
+      return simpleInstruction("OP_POINT_X", offset);
+
+    case OP_POINT_Y:
+      return simpleInstruction("OP_POINT_Y", offset);
+
+    case OP_CLOCK:
+      return simpleInstruction("OP_CLOCK", offset);
+
     case OP_SHIFT_RIGHT:
       return simpleInstruction("OP_SHIFT_RIGHT", offset);
 
@@ -216,14 +301,47 @@ int disassembleInstruction(Chunk *chunk, int offset) {
     case OP_POP_JUMP_IF_FALSE:
       return jumpInstruction("OP_POP_JUMP_IF_FALSE", 1, chunk, offset);
 
+    case OP_JUMP_IF_NOT_EQUAL_INT:
+      return jumpInstruction("OP_JUMP_IF_NOT_EQUAL_INT", 1, chunk, offset);
+
+    case OP_JUMP_IF_NOT_GREATER_INT:
+      return jumpInstruction("OP_JUMP_IF_NOT_GREATER_INT", 1, chunk, offset);
+
+    case OP_JUMP_IF_NOT_LESS_INT:
+      return jumpInstruction("OP_JUMP_IF_NOT_LESS_INT", 1, chunk, offset);
+
+    case OP_JUMP_IF_NOT_LESS_LOCAL_CONST:
+      return localConstantJumpInstruction("OP_JUMP_IF_NOT_LESS_LOCAL_CONST", chunk, offset);
+
     case OP_NEW:
       return byteInstruction("OP_NEW", chunk, offset);
 
     case OP_CALL:
       return byteInstruction("OP_CALL", chunk, offset);
 
-    case OP_ARRAY_INDEX:
-      return byteInstruction("OP_ARRAY_INDEX", chunk, offset);
+    case OP_CALL_DIRECT:
+      return byteInstruction("OP_CALL_DIRECT", chunk, offset);
+
+    case OP_CALL_NATIVE:
+      return objectByteInstruction("OP_CALL_NATIVE", chunk, offset);
+
+    case OP_ARRAY:
+      return objectByteInstruction("OP_ARRAY", chunk, offset);
+
+    case OP_ARRAY_GET:
+      return simpleInstruction("OP_ARRAY_GET", offset);
+
+    case OP_ARRAY_GET_UNCHECKED:
+      return simpleInstruction("OP_ARRAY_GET_UNCHECKED", offset);
+
+    case OP_ARRAY_SET:
+      return simpleInstruction("OP_ARRAY_SET", offset);
+
+    case OP_ARRAY_SET_UNCHECKED:
+      return simpleInstruction("OP_ARRAY_SET_UNCHECKED", offset);
+
+    case OP_ARRAY_LEN:
+      return simpleInstruction("OP_ARRAY_LEN", offset);
 
     case OP_CLOSURE: {
       offset++;
@@ -256,6 +374,38 @@ int disassembleInstruction(Chunk *chunk, int offset) {
     case OP_HALT:
       return simpleInstruction("OP_HALT", offset);
 
+    case OP_JIT:
+      return simpleInstruction("OP_JIT", offset);
+
+    case OP_R_MOVE:
+      return registerInstruction("OP_R_MOVE", 2, chunk, offset);
+
+    case OP_R_LOADK:
+      return registerConstantInstruction("OP_R_LOADK", 1, chunk, offset);
+
+    case OP_R_PUSH:
+      return registerInstruction("OP_R_PUSH", 1, chunk, offset);
+
+    case OP_R_JUMP_IF_FALSE: {
+      uint16_t jump = (uint16_t)(chunk->code[offset + 2] << 8);
+
+      jump |= chunk->code[offset + 3];
+      printf("%-16s", "OP_R_JUMP_IF_FALSE");
+      printRegister(chunk->code[offset + 1]);
+      printf(" %4d -> %d\n", offset, offset + 4 + (int16_t) jump);
+      return offset + 4;
+    }
+#define REGISTER_HELPER_OP_DEF REGISTER_OP_DEF
+#define REGISTER_OP_DEF( identifier, valueConst, convertMacro, primitiveType, op ) \
+    case OP_R_ ## identifier:                                                  \
+      return registerInstruction("OP_R_" #identifier, 3, chunk, offset);       \
+                                                                               \
+    case OP_R_ ## identifier ## _K:                                            \
+      return registerConstantInstruction("OP_R_" #identifier "_K", 2, chunk, offset);
+    REGISTER_OPS_DEF
+#undef REGISTER_OP_DEF
+#undef REGISTER_HELPER_OP_DEF
+
     default:
       printf("Unknown opcode %d\n", instruction);
       return offset + 1;
@@ -3,12 +3,22 @@
  * Copyright (C) 2022-2023  Hocus Codus Software inc.
  */
 #include "expr.hpp"
+#include "arena.hpp"
 
 Expr::Expr(ExprType type) {
   this->type = type;
 }
 
-ReferenceExpr::ReferenceExpr(Token name, int8_t index, bool upvalueFlag) : Expr(EXPR_REFERENCE) {
+void *Expr::operator new(size_t size) {
+  return astArena ? astArena->allocate(size) : ::operator new(size);
+}
+
+void Expr::operator delete(void *pointer) {
+  if (!astArena || !astArena->owns(pointer))
+    ::operator delete(pointer);
+}
+
+ReferenceExpr::ReferenceExpr(Token name, int index, bool upvalueFlag) : Expr(EXPR_REFERENCE) {
   this->name = name;
   this->index = index;
   this->upvalueFlag = upvalueFlag;
@@ -77,10 +87,9 @@ void GroupingExpr::accept(ExprVisitor *visitor) {
   return visitor->visitGroupingExpr(this);
 }
 
-ArrayExpr::ArrayExpr(int count, Expr** expressions, ObjFunction* function) : Expr(EXPR_ARRAY) {
+ArrayExpr::ArrayExpr(int count, Expr** expressions) : Expr(EXPR_ARRAY) {
   this->count = count;
   this->expressions = expressions;
-  this->function = function;
 }
 
 void ArrayExpr::accept(ExprVisitor *visitor) {
@@ -45,6 +45,9 @@ struct Expr {
 
   Expr(ExprType type);
 
+  void *operator new(size_t size);
+  void operator delete(void *pointer);
+
   virtual void accept(ExprVisitor *visitor) = 0;
 };
 
@@ -119,10 +122,11 @@ struct ExprVisitor {
 
 struct ReferenceExpr : public Expr {
   Token name;
-  int8_t index;
+  int index;
   bool upvalueFlag;
+  Compiler* _compiler;
 
-  ReferenceExpr(Token name, int8_t index, bool upvalueFlag);
+  ReferenceExpr(Token name, int index, bool upvalueFlag);
   void accept(ExprVisitor *visitor);
 };
 
@@ -188,9 +192,9 @@ struct GroupingExpr : public Expr {
 struct ArrayExpr : public Expr {
   int count;
   Expr** expressions;
-  ObjFunction* function;
+  Type _elementType;
 
-  ArrayExpr(int count, Expr** expressions, ObjFunction* function);
+  ArrayExpr(int count, Expr** expressions);
   void accept(ExprVisitor *visitor);
 };
 
@@ -201,6 +205,7 @@ struct CallExpr : public Expr {
   Expr** arguments;
   bool newFlag;
   Expr* handler;
+  ObjFunction* _function;
 
   CallExpr(Expr* callee, Token paren, int count, Expr** arguments, bool newFlag, Expr* handler);
   void accept(ExprVisitor *visitor);
@@ -211,6 +216,7 @@ struct ArrayElementExpr : public Expr {
   Token bracket;
   int count;
   Expr** indexes;
+  bool _uncheckedFlag;
 
   ArrayElementExpr(Expr* callee, Token bracket, int count, Expr** indexes);
   void accept(ExprVisitor *visitor);
@@ -250,7 +256,8 @@ struct ListExpr : public Expr {
   int count;
   Expr** expressions;
   ExprType listType;
-  Declaration* _declaration;
+  Compiler* _compiler;
+  int _index;
 
   ListExpr(int count, Expr** expressions, ExprType listType);
   void accept(ExprVisitor *visitor);
@@ -199,7 +199,7 @@ QNI_FN(oval) {
 
 QNI_FN(getTextSize) {
   int fontSize = AS_INT(attStack.get(ATTRIBUTE_FONTSIZE));
-  const char *text = ((ObjString *) AS_OBJ(args[0]))->chars;
+  const char *text = AS_CSTRING(args[0]);
   const auto canvas = document.call<emscripten::val, std::string>("querySelector", "canvas");
   auto ctx = canvas.call<emscripten::val, std::string>("getContext", "2d");
   char fontBuffer[64];
@@ -214,7 +214,7 @@ QNI_FN(getTextSize) {
 }
 
 QNI_FN(displayText) {
-  const char *text = ((ObjString *) AS_OBJ(args[0]))->chars;
+  const char *text = AS_CSTRING(args[0]);
   long posP = AS_INT(args[1]);
   long sizeP = AS_INT(args[2]);
   Point pos = {(int) (posP >> 16), (int) (posP & 0xFFFF)};
@@ -255,6 +255,7 @@ QNI_FN(displayText) {
 #else
 #include <SDL_timer.h>
 #endif
+#include "memory.h"
 
 #define SCREEN_SIZE_X 512
 #define SCREEN_SIZE_Y 512
@@ -382,6 +383,7 @@ QNI_FN(post) {
   userevent.type = SDL_USEREVENT + 0; // should be a more official Timer type
   userevent.code = 0;
   userevent.data1 = AS_CLOSURE(obj);
+  pinObject(AS_OBJ(obj));
 
   event.type = SDL_USEREVENT;
   event.user = userevent;
@@ -443,7 +445,7 @@ QNI_FN(getTextSize) {
   int width;
   int height;
   int fontSize = AS_INT(attStack.get(ATTRIBUTE_FONTSIZE));
-  const char *text = ((ObjString *) AS_OBJ(args[0]))->chars;
+  const char *text = AS_CSTRING(args[0]);
   TTF_Font *font = fontSize != -1 ? getNewFont(fontSize) : getFont();
 
   TTF_SizeUTF8(font, text, &width, &height);
@@ -456,7 +458,7 @@ QNI_FN(getTextSize) {
 
 QNI_FN(displayText) {
   SDL_Rect rectangle;
-  const char *text = ((ObjString *) AS_OBJ(args[0]))->chars;
+  const char *text = AS_CSTRING(args[0]);
   long posP = AS_INT(args[1]);
   long sizeP = AS_INT(args[2]);
   Point pos = {(int) (posP >> 16), (int) (posP & 0xFFFF)};
@@ -504,19 +506,38 @@ void onEvent(CoThread *coThread, Event event, Point pos) {
   }
 }
 
+// Scripted UI session for --gc-bench: alternates presses and releases
+// across the UI once the queued events are handled
+static bool nextBenchEvent(SDL_Event *event, int frame) {
+  if (frame >= 2 * benchFrames)
+    return false;
+
+  event->type = frame & 1 ? SDL_MOUSEBUTTONUP : SDL_MOUSEBUTTONDOWN;
+  event->button.x = totalSize[0] > 0 ? frame / 2 * 7 % totalSize[0] : 0;
+  event->button.y = totalSize[1] / 2;
+  return true;
+}
+
 void suspend(CoThread *coThread) {
   repaint2(coThread);
 
   SDL_RenderPresent(rend2);
 
   SDL_Event event;
+  int benchFrame = 0;
 
   // Events management
   while (true) {
 #ifdef __EMSCRIPTEN__
     emscripten_sleep(0);
 #endif
-    if (!SDL_WaitEvent(&event)) {
+    if (benchFrames) {
+      if (!SDL_PollEvent(&event) && !nextBenchEvent(&event, benchFrame++)) {
+        printGCStats();
+        exit(0);
+      }
+    }
+    else if (!SDL_WaitEvent(&event)) {
       printf("%s\n", SDL_GetError());
       exit(0);
     }
@@ -524,6 +545,7 @@ void suspend(CoThread *coThread) {
     switch (event.type) {
     case SDL_USEREVENT:
       coThread->runHandler((ObjClosure *) event.user.data1);
+      unpinObject((Obj *) event.user.data1);
       repaint2(coThread);
       SDL_RenderPresent(rend2);
       break;
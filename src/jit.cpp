@@ -0,0 +1,619 @@
+/*
+ * The QED Programming Language
+ * Copyright (C) 2022-2023  Hocus Codus Software inc.
+ *
+ * All rights reserved.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <vector>
+#include "jit.hpp"
+#include "codegen.hpp"
+#include "memory.h"
+
+#ifdef JIT
+#include <sys/mman.h>
+
+// Baseline template compiler: every bytecode instruction becomes a fixed
+// x86-64 sequence working on the interpreter's own stack, so frames look
+// exactly the same to the interpreter and to OP_HALT suspension. An
+// unsupported instruction compiles to an exit handing its offset back to
+// the interpreter, and the instruction after it becomes a new entry point.
+
+enum {
+  RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+  R12 = 12, R13 = 13, R14 = 14, R15 = 15
+};
+
+// Pinned registers while in native code
+#define SLOTS      RBX
+#define STACK_TOP  R12
+#define UPVALUES   R13
+#define CONSTANTS  R14
+#define STATE      R15
+
+// Condition codes, as in setcc 0x90 + cc and jcc 0x80 + cc
+enum {
+  CC_B = 0x2, CC_E = 0x4, CC_NE = 0x5, CC_A = 0x7, CC_NP = 0xB,
+  CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF
+};
+
+struct Assembler {
+  std::vector<uint8_t> code;
+  std::vector<std::pair<int, int>> jumps; // rel32 position, bytecode target
+  int exitLabel;
+
+  void byte(uint8_t value) {
+    code.push_back(value);
+  }
+
+  void int32(int32_t value) {
+    for (int index = 0; index < 4; index++)
+      byte((value >> (8 * index)) & 0xff);
+  }
+
+  // [prefix] [REX] opcode [0x0F op2] modrm(reg, [base + disp32])
+  void memory(int prefix, bool wide, int op1, int op2, int reg, int base, int32_t disp) {
+    uint8_t rex = 0x40 | (wide ? 8 : 0) | (reg & 8 ? 4 : 0) | (base & 8 ? 1 : 0);
+
+    if (prefix)
+      byte(prefix);
+
+    if (rex != 0x40)
+      byte(rex);
+
+    byte(op1);
+
+    if (op2 >= 0)
+      byte(op2);
+
+    byte(0x80 | (reg & 7) << 3 | (base & 7));
+
+    if ((base & 7) == RSP)
+      byte(0x24);
+
+    int32(disp);
+  }
+
+  void load(int reg, int base, int32_t disp) {memory(0, true, 0x8B, -1, reg, base, disp);}
+  void store(int base, int32_t disp, int reg) {memory(0, true, 0x89, -1, reg, base, disp);}
+  // add/or/and/sub/xor/cmp reg, [mem] share the 0x03 + 8 * n pattern
+  void arithmetic(int op, int reg, int base, int32_t disp) {memory(0, true, op, -1, reg, base, disp);}
+  void sse(int prefix, int op, int reg, int base, int32_t disp) {memory(prefix, false, 0x0F, op, reg, base, disp);}
+
+  void stackAdjust(int8_t delta) {
+    // add r12, imm8 / sub r12, imm8
+    byte(0x49);
+    byte(0x83);
+    byte(delta > 0 ? 0xC4 : 0xEC);
+    byte(delta > 0 ? delta : -delta);
+  }
+
+  void push(int reg) {
+    store(STACK_TOP, 0, reg);
+    stackAdjust(8);
+  }
+
+  void pop(int reg) {
+    stackAdjust(-8);
+    load(reg, STACK_TOP, 0);
+  }
+
+  // Turns flags into a 0/1 value replacing the two operands on the stack
+  void setBool(int cc) {
+    byte(0x0F);
+    byte(0x90 + cc);
+    byte(0xC0);
+    byte(0x0F);
+    byte(0xB6);
+    byte(0xC0);
+  }
+
+  void testFalsey(int32_t disp) {
+    // cmp byte [r12 + disp], 0
+    memory(0, false, 0x80, -1, 7, STACK_TOP, disp);
+    byte(0);
+  }
+
+  void jump(int target) {
+    byte(0xE9);
+    jumps.push_back(std::make_pair((int) code.size(), target));
+    int32(0);
+  }
+
+  void jumpIf(int cc, int target) {
+    byte(0x0F);
+    byte(0x80 + cc);
+    jumps.push_back(std::make_pair((int) code.size(), target));
+    int32(0);
+  }
+
+  void exit(int offset) {
+    byte(0xB8);
+    int32(offset);
+    byte(0xE9);
+    int32(exitLabel - (int) code.size() - 4);
+  }
+};
+
+static bool compileInstruction(Assembler &as, Chunk *chunk, int offset) {
+  uint8_t *code = &chunk->code[offset];
+  uint8_t instruction = chunk->opCode(offset);
+  int next = offset + instructionLength(chunk, offset);
+#define SLOT (code[1] * (int32_t) sizeof(Value))
+#define CONSTANT(index) (code[index] * (int32_t) sizeof(Value))
+
+  switch (instruction) {
+    case OP_CONSTANT:
+      as.load(RAX, CONSTANTS, CONSTANT(1));
+      as.push(RAX);
+      return true;
+
+    case OP_TRUE:
+    case OP_FALSE:
+      // mov qword [r12], imm32
+      as.memory(0, true, 0xC7, -1, 0, STACK_TOP, 0);
+      as.int32(instruction == OP_TRUE);
+      as.stackAdjust(8);
+      return true;
+
+    case OP_POP:
+      as.stackAdjust(-8);
+      return true;
+
+    case OP_GET_LOCAL:
+      as.load(RAX, SLOTS, SLOT);
+      as.push(RAX);
+      return true;
+
+    case OP_SET_LOCAL:
+      as.load(RAX, STACK_TOP, -8);
+      as.store(SLOTS, SLOT, RAX);
+      return true;
+
+    case OP_SET_LOCAL_POP:
+      as.pop(RAX);
+      as.store(SLOTS, SLOT, RAX);
+      return true;
+
+    case OP_GET_UPVALUE:
+      as.load(RAX, UPVALUES, code[1] * (int32_t) sizeof(ObjUpvalue *));
+      as.load(RAX, RAX, (int32_t) offsetof(ObjUpvalue, location));
+      as.load(RAX, RAX, 0);
+      as.push(RAX);
+      return true;
+
+    case OP_SET_UPVALUE:
+      // closed upvalues need the write barrier
+      if (gcGenerational) {
+        as.exit(offset);
+        return false;
+      }
+
+      as.load(RCX, UPVALUES, code[1] * (int32_t) sizeof(ObjUpvalue *));
+      as.load(RCX, RCX, (int32_t) offsetof(ObjUpvalue, location));
+      as.load(RAX, STACK_TOP, -8);
+      as.store(RCX, 0, RAX);
+      return true;
+
+    case OP_ADD_INT:
+    case OP_SUBTRACT_INT:
+    case OP_BITWISE_OR:
+    case OP_BITWISE_AND:
+    case OP_BITWISE_XOR:
+    case OP_MULTIPLY_INT:
+      as.load(RAX, STACK_TOP, -16);
+
+      switch (instruction) {
+        case OP_ADD_INT: as.arithmetic(0x03, RAX, STACK_TOP, -8); break;
+        case OP_SUBTRACT_INT: as.arithmetic(0x2B, RAX, STACK_TOP, -8); break;
+        case OP_BITWISE_OR: as.arithmetic(0x0B, RAX, STACK_TOP, -8); break;
+        case OP_BITWISE_AND: as.arithmetic(0x23, RAX, STACK_TOP, -8); break;
+        case OP_BITWISE_XOR: as.arithmetic(0x33, RAX, STACK_TOP, -8); break;
+        case OP_MULTIPLY_INT: as.memory(0, true, 0x0F, 0xAF, RAX, STACK_TOP, -8); break;
+      }
+
+      as.store(STACK_TOP, -16, RAX);
+      as.stackAdjust(-8);
+      return true;
+
+    case OP_DIVIDE_INT:
+      as.load(RAX, STACK_TOP, -16);
+      as.byte(0x48); // cqo
+      as.byte(0x99);
+      as.memory(0, true, 0xF7, -1, 7, STACK_TOP, -8);
+      as.store(STACK_TOP, -16, RAX);
+      as.stackAdjust(-8);
+      return true;
+
+    case OP_SHIFT_LEFT:
+    case OP_SHIFT_RIGHT:
+    case OP_SHIFT_URIGHT:
+      as.load(RCX, STACK_TOP, -8);
+      as.load(RAX, STACK_TOP, -16);
+      as.byte(0x48);
+      as.byte(0xD3);
+      as.byte(instruction == OP_SHIFT_LEFT ? 0xE0 : instruction == OP_SHIFT_RIGHT ? 0xF8 : 0xE8);
+      as.store(STACK_TOP, -16, RAX);
+      as.stackAdjust(-8);
+      return true;
+
+    case OP_NEGATE_INT:
+      as.memory(0, true, 0xF7, -1, 3, STACK_TOP, -8);
+      return true;
+
+    case OP_EQUAL_INT:
+    case OP_GREATER_INT:
+    case OP_LESS_INT:
+      as.load(RAX, STACK_TOP, -16);
+      as.arithmetic(0x3B, RAX, STACK_TOP, -8);
+      as.setBool(instruction == OP_EQUAL_INT ? CC_E : instruction == OP_GREATER_INT ? CC_G : CC_L);
+      as.store(STACK_TOP, -16, RAX);
+      as.stackAdjust(-8);
+      return true;
+
+    case OP_NOT:
+      as.testFalsey(-8);
+      as.setBool(CC_E);
+      as.store(STACK_TOP, -8, RAX);
+      return true;
+
+    case OP_ADD_FLOAT:
+    case OP_SUBTRACT_FLOAT:
+    case OP_MULTIPLY_FLOAT:
+    case OP_DIVIDE_FLOAT:
+      as.sse(0xF2, 0x10, 0, STACK_TOP, -16);
+      as.sse(0xF2, instruction == OP_ADD_FLOAT ? 0x58 : instruction == OP_SUBTRACT_FLOAT ? 0x5C :
+                   instruction == OP_MULTIPLY_FLOAT ? 0x59 : 0x5E, 0, STACK_TOP, -8);
+      as.sse(0xF2, 0x11, 0, STACK_TOP, -16);
+      as.stackAdjust(-8);
+      return true;
+
+    case OP_EQUAL_FLOAT:
+      // equal and ordered
+      as.sse(0xF2, 0x10, 0, STACK_TOP, -16);
+      as.sse(0x66, 0x2E, 0, STACK_TOP, -8);
+      as.setBool(CC_NP);
+      as.byte(0x89); // mov ecx, eax
+      as.byte(0xC1);
+      as.setBool(CC_E);
+      as.byte(0x21); // and eax, ecx
+      as.byte(0xC8);
+      as.store(STACK_TOP, -16, RAX);
+      as.stackAdjust(-8);
+      return true;
+
+    case OP_GREATER_FLOAT:
+    case OP_LESS_FLOAT:
+      // a > b, or b > a for less, is false when unordered
+      as.sse(0xF2, 0x10, 0, STACK_TOP, instruction == OP_GREATER_FLOAT ? -16 : -8);
+      as.sse(0x66, 0x2E, 0, STACK_TOP, instruction == OP_GREATER_FLOAT ? -8 : -16);
+      as.setBool(CC_A);
+      as.store(STACK_TOP, -16, RAX);
+      as.stackAdjust(-8);
+      return true;
+
+    case OP_NEGATE_FLOAT:
+      // xor byte [r12 - 1], 0x80
+      as.memory(0, false, 0x80, -1, 6, STACK_TOP, -1);
+      as.byte(0x80);
+      return true;
+
+    case OP_INT_TO_FLOAT:
+      as.memory(0xF2, true, 0x0F, 0x2A, 0, STACK_TOP, -8);
+      as.sse(0xF2, 0x11, 0, STACK_TOP, -8);
+      return true;
+
+    case OP_FLOAT_TO_INT:
+      as.memory(0xF2, true, 0x0F, 0x2C, RAX, STACK_TOP, -8);
+      as.store(STACK_TOP, -8, RAX);
+      return true;
+
+    case OP_ADD_LOCAL_CONST:
+    case OP_SUBTRACT_LOCAL_CONST:
+    case OP_MULTIPLY_LOCAL_CONST:
+      as.load(RAX, SLOTS, SLOT);
+
+      if (instruction == OP_MULTIPLY_LOCAL_CONST)
+        as.memory(0, true, 0x0F, 0xAF, RAX, CONSTANTS, CONSTANT(2));
+      else
+        as.arithmetic(instruction == OP_ADD_LOCAL_CONST ? 0x03 : 0x2B, RAX, CONSTANTS, CONSTANT(2));
+
+      as.push(RAX);
+      return true;
+
+    case OP_INC_LOCAL:
+      as.load(RAX, CONSTANTS, CONSTANT(2));
+      // add [rbx + disp], rax
+      as.memory(0, true, 0x01, -1, RAX, SLOTS, SLOT);
+      return true;
+
+    case OP_JUMP: {
+      int16_t jump = (int16_t) ((code[1] << 8) | code[2]);
+
+      as.jump(next + jump);
+      return true;
+    }
+
+    case OP_JUMP_IF_FALSE:
+    case OP_POP_JUMP_IF_FALSE: {
+      int16_t jump = (int16_t) ((code[1] << 8) | code[2]);
+
+      if (instruction == OP_POP_JUMP_IF_FALSE)
+        as.stackAdjust(-8);
+
+      as.testFalsey(instruction == OP_POP_JUMP_IF_FALSE ? 0 : -8);
+      as.jumpIf(CC_E, next + jump);
+      return true;
+    }
+
+    case OP_JUMP_IF_NOT_EQUAL_INT:
+    case OP_JUMP_IF_NOT_GREATER_INT:
+    case OP_JUMP_IF_NOT_LESS_INT: {
+      int16_t jump = (int16_t) ((code[1] << 8) | code[2]);
+
+      as.load(RAX, STACK_TOP, -16);
+      as.arithmetic(0x3B, RAX, STACK_TOP, -8);
+      // lea r12, [r12 - 16] keeps the flags
+      as.memory(0, true, 0x8D, -1, STACK_TOP, STACK_TOP, -16);
+      as.jumpIf(instruction == OP_JUMP_IF_NOT_EQUAL_INT ? CC_NE : instruction == OP_JUMP_IF_NOT_GREATER_INT ? CC_LE : CC_GE,
+                next + jump);
+      return true;
+    }
+
+    case OP_JUMP_IF_NOT_LESS_LOCAL_CONST: {
+      int16_t jump = (int16_t) ((code[3] << 8) | code[4]);
+
+      as.load(RAX, SLOTS, SLOT);
+      as.arithmetic(0x3B, RAX, CONSTANTS, CONSTANT(2));
+      as.jumpIf(CC_GE, next + jump);
+      return true;
+    }
+
+    default:
+      as.exit(offset);
+      return false;
+  }
+#undef CONSTANT
+#undef SLOT
+}
+
+static bool jitDisabled() {
+  static int disabled = -1;
+
+  if (disabled == -1)
+    disabled = getenv("QED_NO_JIT") != NULL;
+
+  return disabled;
+}
+
+void jitFunction(ObjFunction *function) {
+  Chunk *chunk = &function->chunk;
+
+  if (jitDisabled() || function->jitCode || !chunk->count)
+    return;
+
+  Assembler as;
+  std::vector<int> nativeOffsets(chunk->count + 1, 0);
+  std::vector<bool> isEntry(chunk->count, false);
+  bool entry = true;
+  int entryCount = 0;
+
+  // prologue: save the pinned registers, load them from the state and jump to the entry
+  as.byte(0x53);
+  for (int reg = R12; reg <= R15; reg++) {
+    as.byte(0x41);
+    as.byte(0x50 + (reg & 7));
+  }
+  as.byte(0x49); // mov r15, rdi
+  as.byte(0x89);
+  as.byte(0xFF);
+  as.load(SLOTS, STATE, offsetof(JitState, slots));
+  as.load(STACK_TOP, STATE, offsetof(JitState, stackTop));
+  as.load(UPVALUES, STATE, offsetof(JitState, upvalues));
+  as.load(CONSTANTS, STATE, offsetof(JitState, constants));
+  as.byte(0x89); // mov esi, esi
+  as.byte(0xF6);
+  as.byte(0x48); // lea rax, [rip - code size]
+  as.byte(0x8D);
+  as.byte(0x05);
+  as.int32(-(int32_t) as.code.size() - 4);
+  as.byte(0x48); // add rax, rsi
+  as.byte(0x01);
+  as.byte(0xF0);
+  as.byte(0xFF); // jmp rax
+  as.byte(0xE0);
+
+  // epilogue: write back the stack top, eax holds the resume offset
+  as.exitLabel = as.code.size();
+  as.store(STATE, offsetof(JitState, stackTop), STACK_TOP);
+  for (int reg = R15; reg >= R12; reg--) {
+    as.byte(0x41);
+    as.byte(0x58 + (reg & 7));
+  }
+  as.byte(0x5B);
+  as.byte(0xC3);
+
+  for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+    nativeOffsets[offset] = as.code.size();
+
+    bool supported = compileInstruction(as, chunk, offset);
+
+    if (entry && supported) {
+      isEntry[offset] = true;
+      entryCount++;
+    }
+
+    entry = !supported;
+  }
+
+  nativeOffsets[chunk->count] = as.code.size();
+  as.exit(chunk->count);
+
+  if (!entryCount)
+    return;
+
+  for (size_t index = 0; index < as.jumps.size(); index++) {
+    int position = as.jumps[index].first;
+    int32_t rel = nativeOffsets[as.jumps[index].second] - (position + 4);
+
+    memcpy(&as.code[position], &rel, sizeof(rel));
+  }
+
+  void *memory = mmap(NULL, as.code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (memory == MAP_FAILED)
+    return;
+
+  memcpy(memory, as.code.data(), as.code.size());
+
+  if (mprotect(memory, as.code.size(), PROT_READ | PROT_EXEC)) {
+    munmap(memory, as.code.size());
+    return;
+  }
+
+  JitCode *jitCode = ALLOCATE(JitCode, 1);
+
+  jitCode->code = (uint8_t *) memory;
+  jitCode->size = as.code.size();
+  jitCode->function = (JitFn) memory;
+  jitCode->entries = ALLOCATE(int, chunk->count);
+  chunk->opCodes = ALLOCATE(uint8_t, chunk->count);
+
+  for (int offset = 0; offset < chunk->count; offset++)
+    if (isEntry[offset]) {
+      jitCode->entries[offset] = nativeOffsets[offset];
+      chunk->opCodes[offset] = chunk->code[offset];
+      chunk->code[offset] = OP_JIT;
+    }
+    else
+      jitCode->entries[offset] = -1;
+
+  function->jitCode = jitCode;
+}
+
+#else
+void jitFunction(ObjFunction *function) {
+}
+#endif
+
+void freeJit(ObjFunction *function) {
+  JitCode *jitCode = function->jitCode;
+
+  if (jitCode) {
+    Chunk *chunk = &function->chunk;
+
+    for (int offset = 0; offset < chunk->count; offset++)
+      if (jitCode->entries[offset] != -1)
+        chunk->code[offset] = chunk->opCodes[offset];
+
+#ifdef JIT
+    if (jitCode->code)
+      munmap(jitCode->code, jitCode->size);
+#endif
+
+    FREE_ARRAY(int, jitCode->entries, chunk->count);
+    FREE_ARRAY(uint8_t, chunk->opCodes, chunk->count);
+    chunk->opCodes = NULL;
+    FREE(JitCode, jitCode);
+    function->jitCode = NULL;
+  }
+
+  function->invocationCount = 0;
+}
+
+// Hashes the bytecode along with the integer constants the fused
+// instructions carry, which translated code inlines
+unsigned long chunkChecksum(Chunk *chunk) {
+  unsigned long hash = 14695981039346656037UL;
+
+  for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+    int length = instructionLength(chunk, offset);
+
+    hash = (hash ^ chunk->opCode(offset)) * 1099511628211UL;
+
+    for (int index = 1; index < length; index++)
+      hash = (hash ^ chunk->code[offset + index]) * 1099511628211UL;
+
+    switch (chunk->opCode(offset)) {
+      case OP_ADD_LOCAL_CONST:
+      case OP_SUBTRACT_LOCAL_CONST:
+      case OP_MULTIPLY_LOCAL_CONST:
+      case OP_INC_LOCAL:
+      case OP_JUMP_IF_NOT_LESS_LOCAL_CONST:
+        hash = (hash ^ AS_INT(chunk->constants.values[chunk->code[offset + 2]])) * 1099511628211UL;
+        break;
+    }
+  }
+
+  return hash;
+}
+
+// Depth first, in the order closures appear in the bytecode
+void collectFunctions(ObjFunction *function, std::vector<ObjFunction *> &functions) {
+  Chunk *chunk = &function->chunk;
+
+  functions.push_back(function);
+
+  for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset))
+    if (chunk->opCode(offset) == OP_CLOSURE)
+      collectFunctions(AS_FUNCTION(chunk->constants.values[chunk->code[offset + 1]]), functions);
+
+  if (function->uiFunction)
+    collectFunctions(function->uiFunction, functions);
+}
+
+static const char *aotSource = NULL;
+static AotFunction *aotFunctions = NULL;
+static int aotCount = 0;
+
+bool addAotProgram(const char *source, AotFunction *functions, int count) {
+  aotSource = source;
+  aotFunctions = functions;
+  aotCount = count;
+  return true;
+}
+
+const char *getAotSource() {
+  return aotSource;
+}
+
+void bindAot(ObjFunction *function) {
+  std::vector<ObjFunction *> functions;
+
+  if (!aotCount)
+    return;
+
+  collectFunctions(function, functions);
+
+  for (size_t index = 0; index < functions.size() && (int) index < aotCount; index++) {
+    ObjFunction *target = functions[index];
+    Chunk *chunk = &target->chunk;
+    AotFunction *aot = &aotFunctions[index];
+
+    if (!aot->function || target->jitCode || !chunk->count || chunkChecksum(chunk) != aot->checksum)
+      continue;
+
+    JitCode *jitCode = ALLOCATE(JitCode, 1);
+
+    jitCode->code = NULL;
+    jitCode->size = 0;
+    jitCode->function = aot->function;
+    jitCode->entries = ALLOCATE(int, chunk->count);
+    chunk->opCodes = ALLOCATE(uint8_t, chunk->count);
+
+    for (int offset = 0; offset < chunk->count; offset++)
+      jitCode->entries[offset] = -1;
+
+    for (int entry = 0; entry < aot->entryCount; entry++) {
+      int offset = aot->entries[entry];
+
+      jitCode->entries[offset] = offset;
+      chunk->opCodes[offset] = chunk->code[offset];
+      chunk->code[offset] = OP_JIT;
+    }
+
+    target->jitCode = jitCode;
+  }
+}
@@ -0,0 +1,61 @@
+/*
+ * The QED Programming Language
+ * Copyright (C) 2022-2023  Hocus Codus Software inc.
+ *
+ * All rights reserved.
+ */
+#ifndef qed_jit_h
+#define qed_jit_h
+
+#include <vector>
+#include "object.hpp"
+
+#if defined(__x86_64__) && !defined(_WIN32) && !defined(__EMSCRIPTEN__) && \
+    !defined(DEBUG_TRACE_EXECUTION) && !defined(NO_JIT)
+#define JIT
+#endif
+
+// Invocations of a function before its chunk gets compiled to machine code
+#define JIT_THRESHOLD 100
+
+// Interpreter state handed to the native code and updated on its way out
+struct JitState {
+  Value *slots;
+  Value *stackTop;
+  ObjUpvalue **upvalues;
+  Value *constants;
+  CoThread *thread;
+};
+
+// Returns the bytecode offset at which the interpreter must resume
+typedef int (*JitFn)(JitState *state, int entry);
+
+// Bytecode entry points are patched to OP_JIT, the chunk keeps the opcodes
+// they replaced; entries maps their offsets to the entry handed to the
+// native function. Code compiled ahead of time has no code block to unmap.
+struct JitCode {
+  JitFn function;
+  uint8_t *code;
+  size_t size;
+  int *entries;
+};
+
+// A function translated by qed --emit-cpp, only bound to a chunk with the
+// same checksum
+struct AotFunction {
+  unsigned long checksum;
+  JitFn function;
+  int entryCount;
+  const int *entries;
+};
+
+void jitFunction(ObjFunction *function);
+void freeJit(ObjFunction *function);
+
+unsigned long chunkChecksum(Chunk *chunk);
+void collectFunctions(ObjFunction *function, std::vector<ObjFunction *> &functions);
+bool addAotProgram(const char *source, AotFunction *functions, int count);
+const char *getAotSource();
+void bindAot(ObjFunction *function);
+
+#endif
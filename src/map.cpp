@@ -0,0 +1,136 @@
+/*
+ * The QED Programming Language
+ * Copyright (C) 2022-2023  Hocus Codus Software inc.
+ *
+ * All rights reserved.
+ */
+#include "map.hpp"
+#include "memory.h"
+
+static uint32_t hashKey(ValueType keyType, As key) {
+  if (keyType == VAL_OBJ)
+    return ((ObjString *) key.obj)->hash;
+
+  return (uint32_t) (((uint64_t) key.integer * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+static bool keysEqual(MapEntry *entry, ValueType keyType, As key, uint32_t hash) {
+  if (entry->keyType != keyType || entry->hash != hash)
+    return false;
+
+  return keyType == VAL_OBJ ? entry->key.obj == key.obj : entry->key.integer == key.integer;
+}
+
+static MapEntry *findEntry(MapEntry *entries, int capacity, ValueType keyType, As key, uint32_t hash) {
+  for (uint32_t index = hash & (capacity - 1);; index = (index + 1) & (capacity - 1)) {
+    MapEntry *entry = &entries[index];
+
+    if (entry->keyType == VAL_VOID || keysEqual(entry, keyType, key, hash))
+      return entry;
+  }
+}
+
+HashMap::HashMap(ObjInternal *internal) {
+  owner = internal;
+  count = 0;
+  capacity = 0;
+  entries = NULL;
+}
+
+HashMap::~HashMap() {
+  FREE_ARRAY(MapEntry, entries, capacity);
+}
+
+MapEntry *HashMap::find(ValueType keyType, As key) {
+  if (count == 0)
+    return NULL;
+
+  MapEntry *entry = findEntry(entries, capacity, keyType, key, hashKey(keyType, key));
+
+  return entry->keyType != VAL_VOID ? entry : NULL;
+}
+
+void HashMap::put(ValueType keyType, As key, ValueType valueType, As value) {
+  if (count + 1 > capacity * MAP_MAX_LOAD) {
+    int newCapacity = GROW_CAPACITY(capacity);
+    MapEntry *newEntries = ALLOCATE(MapEntry, newCapacity);
+
+    for (int index = 0; index < newCapacity; index++)
+      newEntries[index].keyType = VAL_VOID;
+
+    for (int index = 0; index < capacity; index++)
+      if (entries[index].keyType != VAL_VOID)
+        *findEntry(newEntries, newCapacity, (ValueType) entries[index].keyType, entries[index].key, entries[index].hash) = entries[index];
+
+    FREE_ARRAY(MapEntry, entries, capacity);
+    entries = newEntries;
+    capacity = newCapacity;
+  }
+
+  uint32_t hash = hashKey(keyType, key);
+  MapEntry *entry = findEntry(entries, capacity, keyType, key, hash);
+
+  if (entry->keyType == VAL_VOID)
+    count++;
+
+  entry->key = key;
+  entry->value = value;
+  entry->hash = hash;
+  entry->keyType = keyType;
+  entry->valueType = valueType;
+
+  if (keyType == VAL_OBJ || valueType == VAL_OBJ)
+    WRITE_BARRIER(&owner->obj);
+}
+
+bool HashMap::remove(ValueType keyType, As key) {
+  MapEntry *entry = find(keyType, key);
+
+  if (!entry)
+    return false;
+
+  int mask = capacity - 1;
+  int hole = entry - entries;
+
+  // pull back every entry of the chain that may sit in the hole
+  for (int index = (hole + 1) & mask; entries[index].keyType != VAL_VOID; index = (index + 1) & mask) {
+    int home = entries[index].hash & mask;
+
+    if (((index - home) & mask) >= ((index - hole) & mask)) {
+      entries[hole] = entries[index];
+      hole = index;
+    }
+  }
+
+  entries[hole].keyType = VAL_VOID;
+  count--;
+  return true;
+}
+
+void HashMap::clear() {
+  FREE_ARRAY(MapEntry, entries, capacity);
+  count = 0;
+  capacity = 0;
+  entries = NULL;
+}
+
+// Returns the first occupied slot after slot, or -1 past the last one
+int HashMap::next(int slot) {
+  for (int index = slot < 0 ? 0 : slot + 1; index < capacity; index++)
+    if (entries[index].keyType != VAL_VOID)
+      return index;
+
+  return -1;
+}
+
+void HashMap::mark() {
+  for (int index = 0; index < capacity; index++) {
+    MapEntry *entry = &entries[index];
+
+    if (entry->keyType == VAL_OBJ)
+      markObject(entry->key.obj);
+
+    if (entry->keyType != VAL_VOID && entry->valueType == VAL_OBJ)
+      markObject(entry->value.obj);
+  }
+}
@@ -0,0 +1,45 @@
+/*
+ * The QED Programming Language
+ * Copyright (C) 2022-2023  Hocus Codus Software inc.
+ *
+ * All rights reserved.
+ */
+#ifndef qed_map_h
+#define qed_map_h
+
+#include "object.hpp"
+
+#define MAP_MAX_LOAD 0.75
+
+// One slot of the table, keys and values stored unboxed with their type;
+// a VAL_VOID key marks an empty slot
+struct MapEntry {
+  As key;
+  As value;
+  uint32_t hash;
+  uint8_t keyType;
+  uint8_t valueType;
+};
+
+// Open addressing map behind the Map class: linear probing over a power of
+// two table of inline entries, deleting by shifting the rest of the probe
+// chain back so no tombstone ever piles up. String keys are interned, so
+// they compare by pointer
+struct HashMap : Internal {
+  ObjInternal *owner;
+  int count;
+  int capacity;
+  MapEntry *entries;
+
+  HashMap(ObjInternal *internal);
+  ~HashMap();
+
+  MapEntry *find(ValueType keyType, As key);
+  void put(ValueType keyType, As key, ValueType valueType, As value);
+  bool remove(ValueType keyType, As key);
+  void clear();
+  int next(int slot);
+  void mark();
+};
+
+#endif
@@ -4,11 +4,121 @@
  *
  * All rights reserved.
  */
+#include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
+#include <algorithm>
+#include <vector>
 #include "memory.h"
 #include "object.hpp"
+#include "compiler.hpp"
+#include "jit.hpp"
+#include "stackmap.hpp"
+
+bool gcGenerational = false;
+double gcMaxPause = GC_MAX_PAUSE_MS;
+
+static size_t bytesAllocated = 0;
+static size_t nextGC = GC_INITIAL_THRESHOLD;
+
+// objects are prepended, so the ones allocated since the last collection
+// (the nursery) sit in front of firstOld
+static Obj *firstOld = NULL;
+static size_t oldBytes = 0;
+static size_t nurserySize = GC_NURSERY_SIZE;
+
+static struct {
+  int collections;
+  int minorCollections;
+  size_t bytesFreed;
+  double totalPause;
+  std::vector<double> pauses;
+} gcStats;
+
+// Values are untagged, so they are traced by their static type: frames
+// by their stack maps, fields and upvalues by their declarations, arrays
+// by their element type and constants by the type they were added with
+static bool minorCollection = false;
+static std::vector<Obj *> grayStack;
+static std::vector<Obj *> pinnedObjects;
+static std::vector<Obj *> rememberedSet;
+
+extern Value *stackTop;
+
+#ifndef NO_POOL_ALLOCATOR
+// Objects are carved out of slabs and recycled through the free list of
+// their size class: 16 byte steps up to POOL_SMALL_MAX, then 256 byte
+// steps up to POOL_MAX. Slabs are never returned to the system
+struct FreeSlot {
+  FreeSlot *next;
+};
+
+static FreeSlot *freeLists[POOL_CLASSES];
+static char *slab = NULL;
+static char *slabEnd = NULL;
+
+static int poolClass(size_t size) {
+  return size <= POOL_SMALL_MAX ? (size - 1) / POOL_GRANULARITY
+                                : POOL_SMALL_MAX / POOL_GRANULARITY + (size - POOL_SMALL_MAX - 1) / POOL_LARGE_GRANULARITY;
+}
+
+static size_t classSize(int poolClass) {
+  return poolClass < POOL_SMALL_MAX / POOL_GRANULARITY ? (poolClass + 1) * POOL_GRANULARITY
+                                                       : POOL_SMALL_MAX + (poolClass - POOL_SMALL_MAX / POOL_GRANULARITY + 1) * POOL_LARGE_GRANULARITY;
+}
+
+void *allocatePooled(size_t size) {
+  if (size > POOL_MAX)
+    return reallocate(NULL, 0, size);
+
+  int index = poolClass(size);
+  size_t slotSize = classSize(index);
+  FreeSlot *slot = freeLists[index];
+
+  bytesAllocated += slotSize;
+
+  if (slot != NULL) {
+    freeLists[index] = slot->next;
+    return slot;
+  }
+
+  if (slab + slotSize > slabEnd) {
+    slab = (char *) malloc(SLAB_SIZE);
+    if (slab == NULL) exit(1);
+    slabEnd = slab + SLAB_SIZE;
+  }
+
+  slot = (FreeSlot *) slab;
+  slab += slotSize;
+  return slot;
+}
+
+void freePooled(void *pointer, size_t size) {
+  if (size > POOL_MAX) {
+    reallocate(pointer, size, 0);
+    return;
+  }
+
+  int index = poolClass(size);
+  FreeSlot *slot = (FreeSlot *) pointer;
+
+  bytesAllocated -= classSize(index);
+  slot->next = freeLists[index];
+  freeLists[index] = slot;
+}
+#else
+void *allocatePooled(size_t size) {
+  return reallocate(NULL, 0, size);
+}
+
+void freePooled(void *pointer, size_t size) {
+  reallocate(pointer, size, 0);
+}
+#endif
 
 void *reallocate(void *pointer, size_t oldSize, size_t newSize) {
+  bytesAllocated += newSize - oldSize;
+
   if (newSize == 0) {
     free(pointer);
     return NULL;
@@ -19,6 +129,202 @@ void *reallocate(void *pointer, size_t oldSize, size_t newSize) {
   return result;
 }
 
+void markObject(Obj *object) {
+  // a minor collection presumes old objects live
+  if (object == NULL || object->isMarked || (minorCollection && object->isOld))
+    return;
+
+#ifdef DEBUG_LOG_GC
+  printf("%p mark ", (void *) object);
+  printObject(OBJ_VAL(object));
+  printf("\n");
+#endif
+  object->isMarked = true;
+  grayStack.push_back(object);
+}
+
+void markValue(Value value, ValueType type) {
+  if (type == VAL_OBJ)
+    markObject(AS_OBJ(value));
+}
+
+void markType(Type &type) {
+  markObject(type.objType);
+}
+
+// Keeps an object only referenced from outside the heap, like a posted
+// handler, alive
+void pinObject(Obj *object) {
+  pinnedObjects.push_back(object);
+}
+
+void unpinObject(Obj *object) {
+  for (size_t index = 0; index < pinnedObjects.size(); index++)
+    if (pinnedObjects[index] == object) {
+      pinnedObjects.erase(pinnedObjects.begin() + index);
+      break;
+    }
+}
+
+// Old objects written to since the last collection are traced as roots of
+// the next minor one
+void rememberObject(Obj *object) {
+  object->isRemembered = true;
+  rememberedSet.push_back(object);
+}
+
+static void forgetRemembered() {
+  for (size_t index = 0; index < rememberedSet.size(); index++)
+    rememberedSet[index]->isRemembered = false;
+
+  rememberedSet.clear();
+}
+
+static void markCallable(ObjCallable *callable) {
+  markObject((Obj *) callable->name);
+  markType(callable->type);
+
+  if (callable->declarationCount)
+    for (int index = 0; index < *callable->declarationCount; index++)
+      markType(callable->declarations[index].type);
+}
+
+// The slots of a frame up to end, by the stack map entry of the offset
+// it is stopped at
+static void markFrame(CallFrame *frame, Value *end) {
+  ObjFunction *function = frame->closure->function;
+  StackMap *stackMap = getStackMap(function);
+  int *slots = &stackMap->slots[stackMap->stops[frame->ip - function->chunk.code]];
+  int count = std::min(slots[0], (int) (end - frame->slots));
+
+  for (int index = 0; index < count; index++)
+    if (slots[1 + index])
+      markObject(AS_OBJ(frame->slots[index]));
+}
+
+static void markThread(CoThread *thread) {
+  Value *top = thread->savedStackTop;
+
+  // the running thread's top is only in stackTop
+  if (stackTop > top && stackTop <= thread->fields + thread->fieldCapacity)
+    top = stackTop;
+
+  for (int index = 0; index < thread->frameCount; index++) {
+    CallFrame *frame = &thread->frames[index];
+
+    markFrame(frame, index + 1 < thread->frameCount ? thread->frames[index + 1].slots : top);
+
+    markObject((Obj *) frame->closure);
+    markObject((Obj *) frame->uiClosure);
+    markObject((Obj *) frame->uiValuesInstance);
+    markObject((Obj *) frame->uiLayoutInstance);
+  }
+
+  for (ObjUpvalue *upvalue = thread->openUpvalues; upvalue != NULL; upvalue = upvalue->next)
+    markObject((Obj *) upvalue);
+
+  markObject((Obj *) thread->caller);
+}
+
+static void blackenObject(Obj *object) {
+  switch (object->type) {
+    case OBJ_THREAD:
+      markThread((CoThread *) object);
+      break;
+
+    case OBJ_INSTANCE:
+      markObject((Obj *) ((ObjInstance *) object)->callable);
+      break;
+
+    case OBJ_CLOSURE: {
+      ObjClosure *closure = (ObjClosure *) object;
+
+      markObject((Obj *) closure->function);
+      markObject((Obj *) closure->parent);
+
+      for (int index = 0; index < closure->upvalueCount; index++)
+        markObject((Obj *) closure->upvalues[index]);
+      break;
+    }
+
+    case OBJ_FUNCTION: {
+      ObjFunction *function = (ObjFunction *) object;
+
+      markCallable(function);
+      markObject(function->native);
+      markObject((Obj *) function->uiFunction);
+      markObject((Obj *) function->closure);
+
+      for (int index = 0; index < function->upvalueCount; index++)
+        markType(function->upvalues[index].type);
+
+      for (int index = 0; index < function->chunk.constants.count; index++)
+        markValue(function->chunk.constants.values[index], function->chunk.constantTypes[index]);
+      break;
+    }
+
+    case OBJ_NATIVE_CLASS:
+      markObject((Obj *) ((ObjNativeClass *) object)->arg);
+      break;
+
+    case OBJ_PRIMITIVE:
+      markObject((Obj *) ((ObjPrimitive *) object)->name);
+      markType(((ObjPrimitive *) object)->type);
+      break;
+
+    case OBJ_UPVALUE: {
+      ObjUpvalue *upvalue = (ObjUpvalue *) object;
+
+      // an open upvalue is marked in the stack of its thread
+      if (upvalue->location == &upvalue->closed)
+        markValue(upvalue->closed, upvalue->type);
+      break;
+    }
+
+    case OBJ_ARRAY: {
+      ObjArray *array = (ObjArray *) object;
+
+      markType(array->elementType);
+
+      if (array->elementType.valueType == VAL_OBJ)
+        for (int index = 0; index < array->count; index++)
+          markObject(array->objects[index]);
+      break;
+    }
+
+    case OBJ_FUNCTION_PTR: {
+      ObjFunctionPtr *functionPtr = (ObjFunctionPtr *) object;
+
+      markType(functionPtr->type);
+
+      for (int index = 0; index < functionPtr->arity; index++)
+        markType(functionPtr->parms[index]);
+      break;
+    }
+
+    case OBJ_ROPE:
+      markObject(((ObjRope *) object)->left);
+      markObject(((ObjRope *) object)->right);
+      break;
+
+    case OBJ_SLICE:
+      markObject((Obj *) ((ObjSlice *) object)->source);
+      break;
+
+    case OBJ_INTERNAL: {
+      ObjInternal *internal = (ObjInternal *) object;
+
+      if (internal->object)
+        internal->object->mark();
+      break;
+    }
+
+    case OBJ_NATIVE:
+    case OBJ_STRING:
+      break;
+  }
+}
+
 static void freeObject(Obj *object) {
   switch (object->type) {
     case OBJ_INTERNAL: {
@@ -27,20 +333,15 @@ static void freeObject(Obj *object) {
       if (internal->object)
         delete internal->object;
 
-      FREE(ObjInstance, object);
       break;
     }
 
     case OBJ_THREAD: {
       CoThread *coThread = (CoThread *) object;
 
-      if (coThread->getFormFlag())
-        for (int ndx = 0; ndx < coThread->frameCount; ndx++)
-          FREE(OBJ_THREAD, coThread->frames[ndx].uiValuesInstance);
-
 //      delete[] coThread->fields;
-      FREE_ARRAY(Value, coThread->fields, 64);
-      FREE(CoThread, object);
+      FREE_ARRAY(Value, coThread->fields, coThread->fieldCapacity);
+      FREE_ARRAY(CallFrame, coThread->frames, coThread->frameCapacity);
       break;
     }
 
@@ -48,57 +349,233 @@ static void freeObject(Obj *object) {
       ObjClosure *closure = (ObjClosure *) object;
 //      delete closure->uiClosure;
       FREE_ARRAY(ObjUpvalue*, closure->upvalues, closure->upvalueCount);
-      FREE(ObjClosure, object);
       break;
     }
 
     case OBJ_FUNCTION: {
       ObjFunction *function = (ObjFunction *)object;
 //      delete function->uiFunction;
+      freeJit(function);
+      freeStackMap(function);
+
+      if (function->declarationCount == &function->detachedCount)
+        FREE_ARRAY(Declaration, function->declarations, function->detachedCount);
+
+      FREE_ARRAY(Upvalue, function->upvalues, function->upvalueCount);
       function->chunk.uninit();
       delete function->instanceIndexes;
-      FREE(ObjFunction, object);
       break;
     }
 
-    case OBJ_INSTANCE:
-      FREE(ObjInstance, object);
+    case OBJ_STRING:
+      removeString((ObjString *) object);
       break;
 
-    case OBJ_NATIVE:
-      FREE(ObjNative, object);
-      break;
+    case OBJ_FUNCTION_PTR: {
+      ObjFunctionPtr *functionPtr = (ObjFunctionPtr *)object;
+
+      if (functionPtr->parms)
+        delete[] functionPtr->parms;
 
-    case OBJ_PRIMITIVE:
-      FREE(ObjPrimitive, object);
       break;
+    }
+
+    case OBJ_ARRAY: {
+      ObjArray *array = (ObjArray *) object;
 
-    case OBJ_STRING: {
-      ObjString *string = (ObjString *)object;
-      FREE_ARRAY(char, string->chars, string->length + 1);
-      FREE(ObjString, object);
+      FREE_ARRAY(bool, array->booleans, array->capacity * arrayElementSize(array->elementType.valueType));
       break;
     }
 
+    case OBJ_INSTANCE:
+    case OBJ_NATIVE:
+    case OBJ_NATIVE_CLASS:
+    case OBJ_PRIMITIVE:
+    case OBJ_ROPE:
+    case OBJ_SLICE:
     case OBJ_UPVALUE:
-      FREE(ObjUpvalue, object);
       break;
+  }
 
-    case OBJ_ARRAY:
-      FREE(ObjArray, object);
-      break;
+  freePooled(object, object->size);
+}
 
-    case OBJ_FUNCTION_PTR:
-      ObjFunctionPtr *functionPtr = (ObjFunctionPtr *)object;
+static void markRoots(Obj *running) {
+  markObject(running);
 
-      if (functionPtr->parms)
-        delete[] functionPtr->parms;
+  for (size_t index = 0; index < pinnedObjects.size(); index++)
+    markObject(pinnedObjects[index]);
 
-      FREE(ObjFunctionPtr, object);
-      break;
+  for (int index = 0; index < INT_STRINGS_MAX; index++)
+    markObject((Obj *) intStrings[index]);
+
+  markCompilerRoots();
+}
+
+static void traceReferences() {
+  while (!grayStack.empty()) {
+    Obj *object = grayStack.back();
+
+    grayStack.pop_back();
+    blackenObject(object);
   }
 }
 
+// Frees the unmarked objects in front of end; survivors are promoted to
+// the old generation when collecting generationally
+static void sweep(Obj *end) {
+  Obj *previous = NULL;
+  Obj *object = objects;
+
+  while (object != end)
+    if (object->isMarked) {
+      object->isMarked = false;
+      object->isOld = gcGenerational;
+      previous = object;
+      object = object->next;
+    }
+    else {
+      Obj *unreached = object;
+
+      object = object->next;
+
+      if (previous != NULL)
+        previous->next = object;
+      else
+        objects = object;
+
+      freeObject(unreached);
+    }
+}
+
+// The running threads keep writing to their stacks without barriers
+static void rememberRunning(Obj *running) {
+  if (gcGenerational)
+    for (CoThread *thread = (CoThread *) running; thread != NULL; thread = thread->caller)
+      WRITE_BARRIER(&thread->obj);
+}
+
+static void endCollection(clock_t start, size_t before, bool minor) {
+  double pause = ((double) (clock() - start)) * 1000 / CLOCKS_PER_SEC;
+
+  firstOld = objects;
+  oldBytes = bytesAllocated;
+  gcStats.collections++;
+  gcStats.minorCollections += minor;
+  gcStats.bytesFreed += before - bytesAllocated;
+  gcStats.totalPause += pause;
+  gcStats.pauses.push_back(pause);
+#ifdef DEBUG_LOG_GC
+  printf("-- gc end (%s)\n", minor ? "minor" : "major");
+  printf("   collected %zu bytes (from %zu to %zu) next at %zu\n",
+         before - bytesAllocated, before, bytesAllocated, nextGC);
+#endif
+}
+
+// Only traces the nursery: old objects are presumed live and the
+// remembered ones are scanned for references into the nursery. The
+// nursery is resized to keep the pause under gcMaxPause
+static void collectNursery(Obj *running) {
+  clock_t start = clock();
+  size_t before = bytesAllocated;
+
+#ifdef DEBUG_LOG_GC
+  printf("-- gc begin (minor)\n");
+#endif
+  minorCollection = true;
+  markRoots(running);
+
+  for (size_t index = 0; index < rememberedSet.size(); index++)
+    blackenObject(rememberedSet[index]);
+
+  traceReferences();
+  minorCollection = false;
+  forgetRemembered();
+  sweep(firstOld);
+  rememberRunning(running);
+
+  double pause = ((double) (clock() - start)) * 1000 / CLOCKS_PER_SEC;
+
+  if (pause > gcMaxPause)
+    nurserySize = std::max(nurserySize / 2, (size_t) GC_NURSERY_SIZE / 16);
+  else if (pause < gcMaxPause / 4)
+    nurserySize = std::min(nurserySize * 2, (size_t) GC_NURSERY_SIZE * 16);
+
+  endCollection(start, before, true);
+}
+
+// Only called where every live object is reachable from the roots: between
+// instructions of the interpreter and before a repaint
+void gcSafePoint(Obj *running) {
+#ifndef DEBUG_STRESS_GC
+  if (!gcGenerational ? bytesAllocated <= nextGC : bytesAllocated <= oldBytes + nurserySize)
+    return;
+#endif
+  // the old generation is only collected once it outgrows its threshold
+  if (gcGenerational && oldBytes <= nextGC)
+    collectNursery(running);
+  else
+    collectGarbage(running);
+}
+
+void collectGarbage(Obj *running) {
+  clock_t start = clock();
+  size_t before = bytesAllocated;
+
+#ifdef DEBUG_LOG_GC
+  printf("-- gc begin\n");
+#endif
+  markRoots(running);
+  traceReferences();
+  forgetRemembered();
+  sweep(NULL);
+  rememberRunning(running);
+
+  nextGC = bytesAllocated * GC_HEAP_GROW_FACTOR;
+
+  if (nextGC < GC_INITIAL_THRESHOLD)
+    nextGC = GC_INITIAL_THRESHOLD;
+
+  endCollection(start, before, false);
+}
+
+static double percentile(std::vector<double> &pauses, int percent) {
+  return pauses.empty() ? 0 : pauses[(pauses.size() - 1) * percent / 100];
+}
+
+void printGCStats() {
+  std::vector<double> pauses = gcStats.pauses;
+
+  std::sort(pauses.begin(), pauses.end());
+  fprintf(stderr, "gc: %d collections (%d minor), %zu bytes freed, %zu bytes allocated\n",
+          gcStats.collections, gcStats.minorCollections, gcStats.bytesFreed, bytesAllocated);
+  fprintf(stderr, "gc: %.3f ms paused, p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+          gcStats.totalPause, percentile(pauses, 50), percentile(pauses, 99), percentile(pauses, 100));
+}
+
+void printMemReport() {
+  size_t total = 0;
+  int count = 0;
+
+  for (Obj *object = objects; object != NULL; object = object->next)
+    if (object->type == OBJ_FUNCTION) {
+      ObjFunction *function = (ObjFunction *) object;
+      Chunk &chunk = function->chunk;
+      size_t upvalues = function->upvalueCount * sizeof(Upvalue);
+      size_t declarations = function->declarationCount ? *function->declarationCount * sizeof(Declaration) : 0;
+      size_t code = chunk.capacity * (sizeof(uint8_t) + sizeof(int));
+      size_t constants = chunk.constants.capacity * sizeof(Value);
+      size_t bytes = object->size + upvalues + declarations + code + constants;
+
+      fprintf(stderr, "mem: %-20s %7zu bytes (object %u, upvalues %zu, declarations %zu, code %zu, constants %zu)\n",
+              function->name ? function->name->chars : "<script>", bytes, object->size, upvalues, declarations, code, constants);
+      total += bytes;
+      count++;
+    }
+
+  fprintf(stderr, "mem: %d functions, %zu bytes of metadata\n", count, total);
+}
+
 void freeObjects() {
   Obj *object = objects;
 
@@ -8,6 +8,7 @@
 #define qed_memory_h
 
 #include "common.h"
+#include "value.h"
 
 #define ALLOCATE(type, count) \
     (type*)reallocate(NULL, 0, sizeof(type) * (count))
@@ -23,6 +24,41 @@
 #define FREE_ARRAY(type, pointer, oldCount) \
   reallocate(pointer, sizeof(type) * (oldCount), 0)
 
+#define POOL_GRANULARITY 16
+#define POOL_SMALL_MAX 256
+#define POOL_LARGE_GRANULARITY 256
+#define POOL_MAX 4096
+#define POOL_CLASSES \
+  (POOL_SMALL_MAX / POOL_GRANULARITY + (POOL_MAX - POOL_SMALL_MAX) / POOL_LARGE_GRANULARITY)
+#define SLAB_SIZE (64 * 1024)
+
+#define GC_HEAP_GROW_FACTOR 2
+#define GC_INITIAL_THRESHOLD (1024 * 1024)
+#define GC_NURSERY_SIZE (256 * 1024)
+#define GC_MAX_PAUSE_MS 2.0
+
+// Records an old object about to reference objects of the nursery
+#define WRITE_BARRIER(object) \
+  do { \
+    if ((object)->isOld && !(object)->isRemembered) \
+      rememberObject(object); \
+  } while (false)
+
+extern bool gcGenerational;
+extern double gcMaxPause;
+
 void *reallocate(void *pointer, size_t oldSize, size_t newSize);
+void *allocatePooled(size_t size);
+void freePooled(void *pointer, size_t size);
+void markObject(Obj *object);
+void markValue(Value value, ValueType type);
+void markType(Type &type);
+void rememberObject(Obj *object);
+void pinObject(Obj *object);
+void unpinObject(Obj *object);
+void gcSafePoint(Obj *running);
+void collectGarbage(Obj *running);
+void printGCStats();
+void printMemReport();
 
 #endif
\ No newline at end of file
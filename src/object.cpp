@@ -6,11 +6,14 @@
  */
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
+#include <time.h>
 #include <cstdarg>
 
 #include "memory.h"
 #include "parser.hpp"
 #include "attrset.hpp"
+#include "jit.hpp"
 
 #ifdef DEBUG_TRACE_EXECUTION
 #include "debug.hpp"
@@ -20,20 +23,35 @@
 //#define PUSH(value) do {Value val = (value); *stackTop++ = val;} while (false)
 #define POP (*--stackTop)
 
-Value *stackTop;
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(NO_COMPUTED_GOTO)
+#define COMPUTED_GOTO
+#endif
 
-void concatenate() {
-  ObjString *b = AS_STRING(POP);
-  ObjString *a = AS_STRING(POP);
+Value *stackTop;
 
-  int length = a->length + b->length;
-  char *chars = ALLOCATE(char, length + 1);
-  memcpy(chars, a->chars, a->length);
-  memcpy(chars + a->length, b->chars, b->length);
-  chars[length] = '\0';
+#define ROPE_MIN_LENGTH 24
 
-  ObjString *result = takeString(chars, length);
-  PUSH(OBJ_VAL(result));
+// Short results are copied right away, longer ones become ropes
+void concatenate() {
+  Obj *right = AS_OBJ(POP);
+  Obj *left = AS_OBJ(POP);
+  int leftLength = ((ObjString *) left)->length;
+  int rightLength = ((ObjString *) right)->length;
+  int length = leftLength + rightLength;
+
+  if (rightLength == 0)
+    PUSH(OBJ_VAL(left));
+  else if (leftLength == 0)
+    PUSH(OBJ_VAL(right));
+  else if (length <= ROPE_MIN_LENGTH) {
+    char chars[ROPE_MIN_LENGTH];
+
+    memcpy(chars, stringChars(left), leftLength);
+    memcpy(chars + leftLength, stringChars(right), rightLength);
+    PUSH(OBJ_VAL(copyString(chars, length)));
+  }
+  else
+    PUSH(OBJ_VAL(newRope(left, right, length)));
 }
 
 static bool isFalsey(Value value) {
@@ -42,6 +60,10 @@ static bool isFalsey(Value value) {
 
 bool eventFlag;
 
+#ifdef COMPUTED_GOTO
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
 InterpretResult run(CoThread *current) {
   CallFrame *frame = &current->frames[current->frameCount - 1];
 #define PEEK(distance) (stackTop[-1 - distance])
@@ -55,253 +77,370 @@ InterpretResult run(CoThread *current) {
     primitiveType a = convertMacro(POP);                                     \
     PUSH(valueConst(a op b));                                                  \
   } while (false)
+#define LOCAL_CONST_OP(op)                                                     \
+  do {                                                                         \
+    uint8_t slot = READ_BYTE();                                                 \
+    long b = AS_INT(READ_CONSTANT());                                          \
+    PUSH(INT_VAL(AS_INT(frame->slots[slot]) op b));                            \
+  } while (false)
+#define JUMP_IF_NOT_OP(op)                                                     \
+  do {                                                                         \
+    int16_t offset = READ_SHORT();                                             \
+    long b = AS_INT(POP);                                                      \
+    long a = AS_INT(POP);                                                      \
+    if (!(a op b)) frame->ip += offset;                                        \
+  } while (false)
+#define REGISTER(operand)                                                      \
+  (*((operand) & REGISTER_TEMP ? &stackTop[(operand) & ~REGISTER_TEMP] : &frame->slots[operand]))
 #define STRING_OP(op)                                                          \
   do {                                                                         \
     Value b = POP;                                                           \
     Value a = POP;                                                           \
     PUSH(BOOL_VAL(valuesCompare(a, b) op 0));                                  \
   } while (false)
+#ifdef DEBUG_TRACE_EXECUTION
+#define TRACE_INSTRUCTION()                                                    \
+  do {                                                                         \
+    current->printStack();                                                     \
+    disassembleInstruction(&frame->closure->function->chunk,                   \
+                           (int)(frame->ip - frame->closure->function->chunk.code)); \
+  } while (false)
+#else
+#define TRACE_INSTRUCTION() do {} while (false)
+#endif
+#ifdef COMPUTED_GOTO
+// One indirect jump per handler instead of the single shared switch jump
+#define REGISTER_HELPER_OP_DEF REGISTER_OP_DEF
+#define REGISTER_OP_DEF( identifier, valueConst, convertMacro, primitiveType, op ) \
+    OPCODE_DEF( OP_R_ ## identifier ), OPCODE_DEF( OP_R_ ## identifier ## _K ),
+#define OPCODE_DEF( identifier )  &&LABEL_ ## identifier
+  static void *dispatchTable[] = { OPCODES_DEF };
+#undef OPCODE_DEF
+#undef REGISTER_OP_DEF
+#undef REGISTER_HELPER_OP_DEF
+#define SWITCH(instruction) goto *dispatchTable[instruction];
+#define CASE(opCode) LABEL_ ## opCode
+#define DISPATCH()                                                             \
+  do {                                                                         \
+    TRACE_INSTRUCTION();                                                       \
+    goto *dispatchTable[READ_BYTE()];                                          \
+  } while (false)
+#else
+#define SWITCH(instruction) switch (instruction)
+#define CASE(opCode) case opCode
+#define DISPATCH() break
+#endif
 
   stackTop = current->savedStackTop;
+  WRITE_BARRIER(&current->obj);
 
   for (;;) {
-#ifdef DEBUG_TRACE_EXECUTION
-    current->printStack();
-    disassembleInstruction(&frame->closure->function->chunk, (int)(frame->ip - frame->closure->function->chunk.code));
-#endif
+    TRACE_INSTRUCTION();
     uint8_t instruction = READ_BYTE();
 
-    switch (instruction) {
-    case OP_CONSTANT: {
+    SWITCH (instruction) {
+    CASE(OP_CONSTANT): {
 //      Value constant = READ_CONSTANT();
       uint8_t byte = READ_BYTE();
       Value value = frame->closure->function->chunk.constants.values[byte];
 
       PUSH(value);//frame->closure->function->type.valueType == VAL_OBJ && AS_OBJ(value)->type == OBJ_INTERNAL ? OBJ_VAL(newInternal()) : value);
-      break;
+      DISPATCH();
     }
-    case OP_TRUE:
+    CASE(OP_TRUE):
       PUSH(BOOL_VAL(true));
-      break;
-    case OP_FALSE:
+      DISPATCH();
+    CASE(OP_FALSE):
       PUSH(BOOL_VAL(false));
-      break;
-    case OP_POP:
+      DISPATCH();
+    CASE(OP_POP):
       POP;
-      break;
-    case OP_GET_UPVALUE: {
+      DISPATCH();
+    CASE(OP_GET_UPVALUE): {
       uint8_t slot = READ_BYTE();
       PUSH(*frame->closure->upvalues[slot]->location);
-      break;
+      DISPATCH();
     }
-    case OP_SET_UPVALUE: {
-      uint8_t slot = READ_BYTE();
-      *frame->closure->upvalues[slot]->location = PEEK(0);
-      break;
+    CASE(OP_SET_UPVALUE): {
+      ObjUpvalue *upvalue = frame->closure->upvalues[READ_BYTE()];
+
+      *upvalue->location = PEEK(0);
+      WRITE_BARRIER(&upvalue->obj);
+      DISPATCH();
     }
-    case OP_GET_PROPERTY: {
+    CASE(OP_GET_PROPERTY): {
       CoThread *coThread = AS_THREAD(POP);
       PUSH(coThread->fields[READ_BYTE()]);
-      break;
+      DISPATCH();
     }
-    case OP_SET_PROPERTY: {
+    CASE(OP_SET_PROPERTY): {
       Value value = POP;
       CoThread *coThread = AS_THREAD(POP);
       coThread->fields[READ_BYTE()] = value;
+      WRITE_BARRIER(&coThread->obj);
       PUSH(value);
-      break;
+      DISPATCH();
     }
-    case OP_GET_LOCAL_DIR: {
+    CASE(OP_GET_LOCAL_DIR): {
       int8_t dir = READ_BYTE();
-      int8_t slot = READ_BYTE();
+      uint8_t slot = READ_BYTE();
 
       PUSH(INT_VAL(AS_INT(frame->slots[slot])));
-      break;
+      DISPATCH();
     }
-    case OP_ADD_LOCAL: {
-      int8_t a = READ_BYTE();
-      int8_t b = READ_BYTE();
+    CASE(OP_ADD_LOCAL): {
+      uint8_t a = READ_BYTE();
+      uint8_t b = READ_BYTE();
 
       PUSH(INT_VAL(AS_INT(frame->slots[a]) + AS_INT(frame->slots[b])));
-      break;
+      DISPATCH();
     }
-    case OP_MAX_LOCAL: {
-      int8_t a = READ_BYTE();
-      int8_t b = READ_BYTE();
+    CASE(OP_MAX_LOCAL): {
+      uint8_t a = READ_BYTE();
+      uint8_t b = READ_BYTE();
 
       PUSH(INT_VAL(std::max(AS_INT(frame->slots[a]), AS_INT(frame->slots[b]))));
-      break;
+      DISPATCH();
     }
-    case OP_GET_LOCAL: {
-      int8_t slot = READ_BYTE();
+    CASE(OP_GET_LOCAL): {
+      uint8_t slot = READ_BYTE();
 
       PUSH(frame->slots[slot]);
-      break;
+      DISPATCH();
     }
-    case OP_SET_LOCAL: {
-      int8_t slot = READ_BYTE();
+    CASE(OP_SET_LOCAL): {
+      uint8_t slot = READ_BYTE();
       frame->slots[slot] = PEEK(0);
-      break;
+      DISPATCH();
+    }
+    CASE(OP_SET_LOCAL_POP): {
+      uint8_t slot = READ_BYTE();
+      frame->slots[slot] = POP;
+      DISPATCH();
+    }
+    CASE(OP_ADD_LOCAL_CONST):
+      LOCAL_CONST_OP(+);
+      DISPATCH();
+    CASE(OP_SUBTRACT_LOCAL_CONST):
+      LOCAL_CONST_OP(-);
+      DISPATCH();
+    CASE(OP_MULTIPLY_LOCAL_CONST):
+      LOCAL_CONST_OP(*);
+      DISPATCH();
+    CASE(OP_INC_LOCAL): {
+      uint8_t slot = READ_BYTE();
+      long b = AS_INT(READ_CONSTANT());
+
+      frame->slots[slot] = INT_VAL(AS_INT(frame->slots[slot]) + b);
+      DISPATCH();
     }
-    case OP_INT_TO_FLOAT: {
+    CASE(OP_INT_TO_FLOAT): {
       Value val = FLOAT_VAL((double) AS_INT(POP));
       PUSH(val);
-      break;
+      DISPATCH();
     }
-    case OP_FLOAT_TO_INT: {
+    CASE(OP_FLOAT_TO_INT): {
       Value val = INT_VAL((long) AS_FLOAT(POP));
       PUSH(val);
-      break;
+      DISPATCH();
     }
-    case OP_INT_TO_STRING: {
-      char buffer [sizeof(long)*8+1];
-
-      sprintf(buffer, "%ld", AS_INT(POP));
-      {
-        Value val = OBJ_VAL(copyString(buffer, strlen(buffer)));
-        PUSH(val);
-      }
-      break;
+    CASE(OP_INT_TO_STRING): {
+      Value val = OBJ_VAL(intToString(AS_INT(POP)));
+      PUSH(val);
+      gcSafePoint(&current->obj);
+      DISPATCH();
     }
-    case OP_FLOAT_TO_STRING: {
-      char buffer[64];
-
-      sprintf(buffer, "%g", AS_FLOAT(POP));
-      {
-        Value val = OBJ_VAL(copyString(buffer, strlen(buffer)));
-        PUSH(val);
-      }
-      break;
+    CASE(OP_FLOAT_TO_STRING): {
+      Value val = OBJ_VAL(floatToString(AS_FLOAT(POP)));
+      PUSH(val);
+      gcSafePoint(&current->obj);
+      DISPATCH();
     }
-    case OP_BOOL_TO_STRING: {
+    CASE(OP_BOOL_TO_STRING): {
       const char *buffer = AS_BOOL(POP) ? "true" : "false";
 
       {
         Value val = OBJ_VAL(copyString(buffer, strlen(buffer)));
         PUSH(val);
       }
-      break;
+      gcSafePoint(&current->obj);
+      DISPATCH();
     }
-    case OP_EQUAL_STRING:
-      STRING_OP(==);
-      break;
-    case OP_GREATER_STRING:
+    CASE(OP_EQUAL_STRING): {
+      Obj *b = AS_OBJ(POP);
+      Obj *a = AS_OBJ(POP);
+      Value val = BOOL_VAL(stringsEqual(a, b));
+
+      PUSH(val);
+      DISPATCH();
+    }
+    CASE(OP_GREATER_STRING):
       STRING_OP(>);
-      break;
-    case OP_LESS_STRING:
+      DISPATCH();
+    CASE(OP_LESS_STRING):
       STRING_OP(<);
-      break;
-    case OP_EQUAL_FLOAT:
-      BINARY_OP(BOOL_VAL, AS_FLOAT, double, ==);
-      break;
-    case OP_GREATER_FLOAT:
+      DISPATCH();
+    CASE(OP_EQUAL_FLOAT): {
+      double b = AS_FLOAT(POP);
+      double a = AS_FLOAT(POP);
+
+      PUSH(BOOL_VAL(floatsEqual(a, b)));
+      DISPATCH();
+    }
+    CASE(OP_GREATER_FLOAT):
       BINARY_OP(BOOL_VAL, AS_FLOAT, double, >);
-      break;
-    case OP_LESS_FLOAT:
+      DISPATCH();
+    CASE(OP_LESS_FLOAT):
       BINARY_OP(BOOL_VAL, AS_FLOAT, double, <);
-      break;
-    case OP_EQUAL_INT:
+      DISPATCH();
+    CASE(OP_EQUAL_INT):
       BINARY_OP(BOOL_VAL, AS_INT, long, ==);
-      break;
-    case OP_GREATER_INT:
+      DISPATCH();
+    CASE(OP_GREATER_INT):
       BINARY_OP(BOOL_VAL, AS_INT, long, >);
-      break;
-    case OP_LESS_INT:
+      DISPATCH();
+    CASE(OP_LESS_INT):
       BINARY_OP(BOOL_VAL, AS_INT, long, <);
-      break;
-    case OP_ADD_STRING:
+      DISPATCH();
+    CASE(OP_ADD_STRING):
       concatenate();
-      break;
-    case OP_ADD_INT:
+      gcSafePoint(&current->obj);
+      DISPATCH();
+    CASE(OP_ADD_INT):
       BINARY_OP(INT_VAL, AS_INT, long, +);
-      break;
-    case OP_SUBTRACT_INT:
+      DISPATCH();
+    CASE(OP_SUBTRACT_INT):
       BINARY_OP(INT_VAL, AS_INT, long, -);
-      break;
-    case OP_MULTIPLY_INT:
+      DISPATCH();
+    CASE(OP_MULTIPLY_INT):
       BINARY_OP(INT_VAL, AS_INT, long, *);
-      break;
-    case OP_DIVIDE_INT:
+      DISPATCH();
+    CASE(OP_DIVIDE_INT):
       BINARY_OP(INT_VAL, AS_INT, long, /);
-      break;
-    case OP_ADD_FLOAT:
+      DISPATCH();
+    CASE(OP_ADD_FLOAT):
       BINARY_OP(FLOAT_VAL, AS_FLOAT, double, +);
-      break;
-    case OP_SUBTRACT_FLOAT:
+      DISPATCH();
+    CASE(OP_SUBTRACT_FLOAT):
       BINARY_OP(FLOAT_VAL, AS_FLOAT, double, -);
-      break;
-    case OP_MULTIPLY_FLOAT:
+      DISPATCH();
+    CASE(OP_MULTIPLY_FLOAT):
       BINARY_OP(FLOAT_VAL, AS_FLOAT, double, *);
-      break;
-    case OP_DIVIDE_FLOAT:
+      DISPATCH();
+    CASE(OP_DIVIDE_FLOAT):
       BINARY_OP(FLOAT_VAL, AS_FLOAT, double, /);
-      break;
-    case OP_NOT: {
+      DISPATCH();
+    CASE(OP_NOT): {
       Value val = BOOL_VAL(isFalsey(POP));
       PUSH(val);
-      break;
+      DISPATCH();
     }
-    case OP_NEGATE_FLOAT:
-      PUSH(FLOAT_VAL(-AS_FLOAT(POP)));
-      break;
-    case OP_NEGATE_INT:
-      PUSH(INT_VAL(-AS_INT(POP)));
-      break;
-    case OP_BITWISE_OR:
+    CASE(OP_NEGATE_FLOAT): {
+      Value val = FLOAT_VAL(-AS_FLOAT(POP));
+      PUSH(val);
+      DISPATCH();
+    }
+    CASE(OP_NEGATE_INT): {
+      Value val = INT_VAL(-AS_INT(POP));
+      PUSH(val);
+      DISPATCH();
+    }
+    CASE(OP_BITWISE_OR):
       BINARY_OP(INT_VAL, AS_INT, long, |);
-      break;
-    case OP_BITWISE_AND:
+      DISPATCH();
+    CASE(OP_BITWISE_AND):
       BINARY_OP(INT_VAL, AS_INT, long, &);
-      break;
-    case OP_BITWISE_XOR:
+      DISPATCH();
+    CASE(OP_BITWISE_XOR):
       BINARY_OP(INT_VAL, AS_INT, long, ^);
-      break;
-    case OP_LOGICAL_OR:
+      DISPATCH();
+    CASE(OP_LOGICAL_OR):
       BINARY_OP(BOOL_VAL, AS_BOOL, bool, ||);
-      break;
-    case OP_LOGICAL_AND:
+      DISPATCH();
+    CASE(OP_LOGICAL_AND):
       BINARY_OP(BOOL_VAL, AS_BOOL, bool, &&);
-      break;
-    case OP_SHIFT_LEFT:
+      DISPATCH();
+    CASE(OP_SHIFT_LEFT):
       BINARY_OP(INT_VAL, AS_INT, long, <<);
-      break;
-    case OP_SHIFT_RIGHT:
+      DISPATCH();
+    CASE(OP_SHIFT_RIGHT):
       BINARY_OP(INT_VAL, AS_INT, long, >>);
-      break;
-    case OP_SHIFT_URIGHT:
+      DISPATCH();
+    CASE(OP_SHIFT_URIGHT):
 #ifdef __EMSCRIPTEN__
       BINARY_OP(INT_VAL, AS_INT, long, >>);
 #else
       BINARY_OP(INT_VAL, AS_INT, unsigned long, >>);
 #endif
-      break;
-    case OP_PRINT: {
+      DISPATCH();
+    CASE(OP_MAX_INT): {
+      long b = AS_INT(POP);
+      long a = AS_INT(POP);
+
+      PUSH(INT_VAL(std::max(a, b)));
+      DISPATCH();
+    }
+    CASE(OP_PACK_POINT): {
+      long y = AS_INT(POP);
+      long x = AS_INT(POP);
+
+      PUSH(INT_VAL((x << 16) | y));
+      DISPATCH();
+    }
+    CASE(OP_POINT_X):
+      stackTop[-1] = INT_VAL(AS_INT(stackTop[-1]) >> 16);
+      DISPATCH();
+    CASE(OP_POINT_Y):
+      stackTop[-1] = INT_VAL(AS_INT(stackTop[-1]) & 0xFFFF);
+      DISPATCH();
+    CASE(OP_CLOCK):
+      PUSH(FLOAT_VAL(((double) clock()) / CLOCKS_PER_SEC));
+      DISPATCH();
+    CASE(OP_PRINT): {
       Value value = POP;
       printObject(value);
       printf("\n");
-      break;
+      DISPATCH();
     }
-    case OP_JUMP: {
+    CASE(OP_JUMP): {
       int16_t offset = READ_SHORT();
       frame->ip += offset;
-      break;
+      DISPATCH();
     }
-    case OP_JUMP_IF_FALSE: {
+    CASE(OP_JUMP_IF_FALSE): {
       int16_t offset = READ_SHORT();
       if (isFalsey(PEEK(0))) frame->ip += offset;
-      break;
+      DISPATCH();
     }
-    case OP_POP_JUMP_IF_FALSE: {
+    CASE(OP_POP_JUMP_IF_FALSE): {
       int16_t offset = READ_SHORT();
       if (isFalsey(POP)) frame->ip += offset;
-      break;
+      DISPATCH();
     }
-    case OP_NEW: {
+    CASE(OP_JUMP_IF_NOT_EQUAL_INT):
+      JUMP_IF_NOT_OP(==);
+      DISPATCH();
+    CASE(OP_JUMP_IF_NOT_GREATER_INT):
+      JUMP_IF_NOT_OP(>);
+      DISPATCH();
+    CASE(OP_JUMP_IF_NOT_LESS_INT):
+      JUMP_IF_NOT_OP(<);
+      DISPATCH();
+    CASE(OP_JUMP_IF_NOT_LESS_LOCAL_CONST): {
+      uint8_t slot = READ_BYTE();
+      long b = AS_INT(READ_CONSTANT());
+      int16_t offset = READ_SHORT();
+
+      if (!(AS_INT(frame->slots[slot]) < b)) frame->ip += offset;
+      DISPATCH();
+    }
+    CASE(OP_NEW): {
       int argCount = READ_BYTE();
       int handlerCount = 1;
       CoThread *thread = newThread(current);
       int size = argCount + 1 + handlerCount;
 
+      thread->reserve(size);
       memcpy(thread->fields, stackTop - size, size * sizeof(Value));
       thread->savedStackTop += size;
       stackTop -= size;
@@ -315,9 +454,10 @@ InterpretResult run(CoThread *current) {
       }
       else
         return INTERPRET_RUNTIME_ERROR;
-      break;
+      gcSafePoint(&current->obj);
+      DISPATCH();
     }
-    case OP_CALL: {
+    CASE(OP_CALL): {
       int argCount = READ_BYTE();
 
       current->savedStackTop = stackTop;
@@ -326,22 +466,111 @@ InterpretResult run(CoThread *current) {
         return INTERPRET_RUNTIME_ERROR;
 
       frame = &current->frames[current->frameCount - 1];
-      break;
+      gcSafePoint(&current->obj);
+      DISPATCH();
     }
-    case OP_ARRAY_INDEX: {
+    CASE(OP_CALL_DIRECT): {
       int argCount = READ_BYTE();
 
       current->savedStackTop = stackTop;
 
-      if (!current->callValue(PEEK(argCount), argCount))
+      if (!current->call(AS_CLOSURE(PEEK(argCount)), argCount))
         return INTERPRET_RUNTIME_ERROR;
 
       frame = &current->frames[current->frameCount - 1];
-      break;
+      gcSafePoint(&current->obj);
+      DISPATCH();
     }
-    case OP_CLOSURE: {
+    CASE(OP_CALL_NATIVE): {
+      // the frame stays inside the instruction while the native runs, as
+      // the threads it may run can collect with the arguments still pushed
+      ObjFunction *function = AS_FUNCTION(frame->closure->function->chunk.constants.values[frame->ip[0]]);
+      int argCount = frame->ip[1];
+
+      current->savedStackTop = stackTop;
+
+      Value result = ((ObjNative *) function->native)->function(argCount, stackTop - argCount);
+
+      frame->ip += 2;
+      stackTop = current->savedStackTop - argCount; // natives may run other threads
+      if (function->type.valueType != VAL_VOID)
+        PUSH(result);
+      gcSafePoint(&current->obj);
+      DISPATCH();
+    }
+    CASE(OP_ARRAY): {
+      ObjArray *type = AS_ARRAY(READ_CONSTANT());
+      int count = READ_BYTE();
+      ObjArray *array = newArray(type->elementType, count);
+
+      stackTop -= count;
+
+      for (int index = 0; index < count; index++)
+        setArrayElement(array, index, stackTop[index]);
+
+      array->count = count;
+      PUSH(OBJ_VAL(array));
+      gcSafePoint(&current->obj);
+      DISPATCH();
+    }
+    CASE(OP_ARRAY_GET): {
+      long index = AS_INT(POP);
+      ObjArray *array = AS_ARRAY(POP);
+
+      if ((unsigned long) index >= (unsigned long) array->count) {
+        current->runtimeError("Array index %ld out of bounds [0, %d).", index, array->count);
+        return INTERPRET_RUNTIME_ERROR;
+      }
+
+      PUSH(getArrayElement(array, index));
+      DISPATCH();
+    }
+    CASE(OP_ARRAY_GET_UNCHECKED): {
+      long index = AS_INT(POP);
+      ObjArray *array = AS_ARRAY(POP);
+
+      PUSH(getArrayElement(array, index));
+      DISPATCH();
+    }
+    CASE(OP_ARRAY_SET): {
+      Value value = POP;
+      long index = AS_INT(POP);
+      ObjArray *array = AS_ARRAY(POP);
+
+      if ((unsigned long) index < (unsigned long) array->count)
+        setArrayElement(array, index, value);
+      else if (index == array->count)
+        appendArray(array, value);
+      else {
+        current->runtimeError("Array index %ld out of bounds [0, %d].", index, array->count);
+        return INTERPRET_RUNTIME_ERROR;
+      }
+
+      WRITE_BARRIER(&array->obj);
+      PUSH(value);
+      gcSafePoint(&current->obj);
+      DISPATCH();
+    }
+    CASE(OP_ARRAY_SET_UNCHECKED): {
+      Value value = POP;
+      long index = AS_INT(POP);
+      ObjArray *array = AS_ARRAY(POP);
+
+      setArrayElement(array, index, value);
+      WRITE_BARRIER(&array->obj);
+      PUSH(value);
+      DISPATCH();
+    }
+    CASE(OP_ARRAY_LEN): {
+      ObjArray *array = AS_ARRAY(POP);
+
+      PUSH(INT_VAL(array->count));
+      DISPATCH();
+    }
+    CASE(OP_CLOSURE): {
       ObjFunction *function = AS_FUNCTION(READ_CONSTANT());
-      ObjClosure *closure = newClosure(function, current);
+      // a native method finds its instance through the closure's parent
+      ObjClosure *closure = function->upvalueCount || function->native ? newClosure(function, current) : function->getSharedClosure();
 
       PUSH(OBJ_VAL(closure));
 
@@ -349,15 +578,16 @@ InterpretResult run(CoThread *current) {
         uint8_t isField = READ_BYTE();
         uint8_t index = READ_BYTE();
 
-        closure->upvalues[i] = isField ? current->captureUpvalue(frame->slots + index) : frame->closure->upvalues[index];
+        closure->upvalues[i] = isField ? current->captureUpvalue(frame->slots + index, function->upvalues[i].type.valueType) : frame->closure->upvalues[index];
       }
-      break;
+      gcSafePoint(&current->obj);
+      DISPATCH();
     }
-    case OP_CLOSE_UPVALUE:
+    CASE(OP_CLOSE_UPVALUE):
       current->closeUpvalues(stackTop - 1);
       POP;
-      break;
-    case OP_RETURN:/*
+      DISPATCH();
+    CASE(OP_RETURN):/*
       if (IS_FIRST_INSTANCE && current->isInInstance()) {
         current->closeUpvalues(current->frames[0].slots);
         POP;
@@ -370,8 +600,8 @@ InterpretResult run(CoThread *current) {
         current->onReturn(result);
         frame = &current->frames[current->frameCount - 1];
       }
-      break;
-    case OP_HALT: {
+      DISPATCH();
+    CASE(OP_HALT): {
       Obj *native = frame->closure->function->native;
 
       if (native && native->type == OBJ_NATIVE) {
@@ -385,49 +615,126 @@ InterpretResult run(CoThread *current) {
         frame = &current->frames[current->frameCount - 1];
       }
       else {
-        Obj *native = frame->closure->function->native;
-
         if (native && native->type == OBJ_NATIVE_CLASS) {
           int argCount = stackTop - frame->slots - 1;
           NativeClassFn nativeClassFn = ((ObjNativeClass *) native)->classFn;
-          InterpretResult result = nativeClassFn(*((VM *) NULL), argCount, stackTop - argCount);
+
+          if (nativeClassFn(current, argCount, stackTop - argCount) != INTERPRET_OK)
+            return INTERPRET_RUNTIME_ERROR;
         }
-        else
-          if (current->isInInstance() && (!eventFlag || !IS_FIRST_INSTANCE))
-            if (IS_FIRST_INSTANCE)
-              return INTERPRET_OK;
-            else {
-    //        CallFrame *frame = &current->frames[--current->frameCount];
-
-    //TODO: fix this        current->closeUpvalues(frame->slots);
-    //        caller->coinstance = caller;
-              if (current->isDone()) {
-    //            FREE(CoThread, coThread->coThread);
-    //            coThread->coThread = NULL;
-              }
-              current->savedStackTop = stackTop;
-              current = current->caller;
-              frame = &current->frames[current->frameCount - 1];
-              stackTop = current->savedStackTop;
-            }
+
+        if (current->isInInstance() && (!eventFlag || !IS_FIRST_INSTANCE))
+          if (IS_FIRST_INSTANCE)
+            return INTERPRET_OK;
           else {
+  //        CallFrame *frame = &current->frames[--current->frameCount];
+
+  //TODO: fix this        current->closeUpvalues(frame->slots);
+  //        caller->coinstance = caller;
             current->savedStackTop = stackTop;
-            // suspend app
-            return INTERPRET_SUSPEND;
+            if (current->isDone()) {
+  //            FREE(CoThread, coThread->coThread);
+  //            coThread->coThread = NULL;
+              current->trim();
+            }
+            current = current->caller;
+            WRITE_BARRIER(&current->obj);
+            frame = &current->frames[current->frameCount - 1];
+            stackTop = current->savedStackTop;
           }
+        else {
+          current->savedStackTop = stackTop;
+          // suspend app
+          return INTERPRET_SUSPEND;
+        }
       }
-      break;
+      DISPATCH();
+    }
+    CASE(OP_JIT): {
+      ObjFunction *function = frame->closure->function;
+      JitCode *jitCode = function->jitCode;
+      JitState state = {frame->slots, stackTop, frame->closure->upvalues, function->chunk.constants.values, current};
+      int offset = jitCode->function(&state, jitCode->entries[frame->ip - 1 - function->chunk.code]);
+
+      frame->ip = function->chunk.code + offset;
+      stackTop = state.stackTop;
+      DISPATCH();
+    }
+    CASE(OP_R_MOVE): {
+      uint8_t dest = READ_BYTE();
+      uint8_t source = READ_BYTE();
+
+      REGISTER(dest) = REGISTER(source);
+      DISPATCH();
+    }
+    CASE(OP_R_LOADK): {
+      uint8_t dest = READ_BYTE();
+
+      REGISTER(dest) = READ_CONSTANT();
+      DISPATCH();
+    }
+    CASE(OP_R_PUSH): {
+      uint8_t source = READ_BYTE();
+
+      Value value = REGISTER(source);
+
+      PUSH(value);
+      DISPATCH();
     }
+    CASE(OP_R_JUMP_IF_FALSE): {
+      uint8_t source = READ_BYTE();
+      int16_t offset = READ_SHORT();
+
+      if (isFalsey(REGISTER(source))) frame->ip += offset;
+      DISPATCH();
+    }
+#define REGISTER_OP_CASES( identifier, valueConst, convertMacro, primitiveType, result ) \
+    CASE(OP_R_ ## identifier): {                                               \
+      uint8_t *operands = frame->ip;                                           \
+      primitiveType a = convertMacro(REGISTER(operands[1]));                   \
+      primitiveType b = convertMacro(REGISTER(operands[2]));                   \
+                                                                               \
+      frame->ip += 3;                                                          \
+      REGISTER(operands[0]) = valueConst(result);                              \
+      DISPATCH();                                                              \
+    }                                                                          \
+    CASE(OP_R_ ## identifier ## _K): {                                         \
+      uint8_t *operands = frame->ip;                                           \
+      primitiveType a = convertMacro(REGISTER(operands[1]));                   \
+      primitiveType b = convertMacro(frame->closure->function->chunk.constants.values[operands[2]]); \
+                                                                               \
+      frame->ip += 3;                                                          \
+      REGISTER(operands[0]) = valueConst(result);                              \
+      DISPATCH();                                                              \
+    }
+#define REGISTER_OP_DEF( identifier, valueConst, convertMacro, primitiveType, op ) \
+    REGISTER_OP_CASES( identifier, valueConst, convertMacro, primitiveType, a op b )
+#define REGISTER_HELPER_OP_DEF( identifier, valueConst, convertMacro, primitiveType, helper ) \
+    REGISTER_OP_CASES( identifier, valueConst, convertMacro, primitiveType, helper(a, b) )
+    REGISTER_OPS_DEF
+#undef REGISTER_HELPER_OP_DEF
+#undef REGISTER_OP_DEF
+#undef REGISTER_OP_CASES
     }
   }
+#undef DISPATCH
+#undef CASE
+#undef SWITCH
+#undef TRACE_INSTRUCTION
 #undef READ_BYTE
 #undef READ_SHORT
 #undef READ_CONSTANT
 #undef STRING_OP
+#undef REGISTER
+#undef JUMP_IF_NOT_OP
+#undef LOCAL_CONST_OP
 #undef BINARY_OP
 #undef IS_FIRST_INSTANCE
 #undef PEEK
 }
+#ifdef COMPUTED_GOTO
+#pragma GCC diagnostic pop
+#endif
 
 bool CoThread::call(ObjClosure *closure, int argCount) {
   if (frameCount == FRAMES_MAX) {
@@ -435,25 +742,49 @@ bool CoThread::call(ObjClosure *closure, int argCount) {
     return false;
   }
 
+  if (frameCount == frameCapacity) {
+    int oldCapacity = frameCapacity;
+
+    frameCapacity = frameCapacity < 4 ? frameCapacity + 1 : frameCapacity * 2;
+    frames = RESIZE_ARRAY(CallFrame, frames, oldCapacity, frameCapacity);
+  }
+
+  reserve(closure->function->stackSize + closure->function->tempCount);
+
   CallFrame *frame = &frames[frameCount++];
-  ObjFunction *outFunction = closure->function->uiFunction;
+
+  WRITE_BARRIER(&obj);
+
+  if (++closure->function->invocationCount == JIT_THRESHOLD)
+    jitFunction(closure->function);
 
   frame->closure = closure;
   frame->ip = closure->function->chunk.code;
   frame->slots = savedStackTop - argCount - 1;
-  frame->uiClosure = outFunction ? newClosure(outFunction, this) : NULL;
+  frame->uiClosure = NULL; // see getUiClosure()
   frame->uiValuesInstance = NULL;
   frame->uiLayoutInstance = NULL;
+  return true;
+}
+
+// The closure of the frame's UI function, created when the frame is
+// first rendered rather than on every call
+ObjClosure *CoThread::getUiClosure(CallFrame &frame) {
+  ObjFunction *outFunction = frame.closure->function->uiFunction;
+
+  if (frame.uiClosure == NULL && outFunction != NULL) {
+    frame.uiClosure = newClosure(outFunction, this);
+    WRITE_BARRIER(&obj);
 
-  if (outFunction)
     for (int i = 0; i < outFunction->upvalueCount; i++) {
       uint8_t isField = outFunction->upvalues[i].isField;
       uint8_t index = outFunction->upvalues[i].index;
 
-      frame->uiClosure->upvalues[i] = isField ? captureUpvalue(frame->slots + index) : frame->closure->upvalues[index];
+      frame.uiClosure->upvalues[i] = isField ? captureUpvalue(frame.slots + index, outFunction->upvalues[i].type.valueType) : frame.closure->upvalues[index];
     }
+  }
 
-  return true;
+  return frame.uiClosure;
 }
 
 Obj *objects = NULL;
@@ -461,10 +792,17 @@ Obj *objects = NULL;
 Internal::~Internal() {
 }
 
+void Internal::mark() {
+}
+
 Obj *allocateObject(size_t size, ObjType type) {
-  Obj *object = (Obj *)reallocate(NULL, 0, size);
+  Obj *object = (Obj *)allocatePooled(size);
 
   object->type = type;
+  object->size = size;
+  object->isMarked = false;
+  object->isOld = false;
+  object->isRemembered = false;
   object->next = objects;
   objects = object;
   return object;
@@ -474,7 +812,9 @@ const char *Obj::toString() {
   static char buf[256];
 
   switch (type) {
-    case OBJ_STRING: return "String";
+    case OBJ_STRING:
+    case OBJ_ROPE:
+    case OBJ_SLICE: return "String";
     case OBJ_ARRAY: {
       char buf2[256] = "??";
 
@@ -525,6 +865,7 @@ int ObjFunction::addUpvalue(uint8_t index, bool isField, Type type, Parser &pars
     return 0;
   }
 
+  upvalues = RESIZE_ARRAY(Upvalue, upvalues, upvalueCount, upvalueCount + 1);
   upvalues[upvalueCount].isField = isField;
   upvalues[upvalueCount].index = index;
   upvalues[upvalueCount].type = type;
@@ -659,7 +1000,7 @@ bool CoThread::callValue(Value callee, int argCount) {
   return true;
 }
 
-ObjUpvalue *CoThread::captureUpvalue(Value *field) {
+ObjUpvalue *CoThread::captureUpvalue(Value *field, ValueType type) {
   ObjUpvalue *prevUpvalue = NULL;
   ObjUpvalue *upvalue = openUpvalues;
 
@@ -671,7 +1012,7 @@ ObjUpvalue *CoThread::captureUpvalue(Value *field) {
   if (upvalue != NULL && upvalue->location == field)
     return upvalue;
 
-  ObjUpvalue *createdUpvalue = newUpvalue(field);
+  ObjUpvalue *createdUpvalue = newUpvalue(field, type);
 
   createdUpvalue->next = upvalue;
 
@@ -690,6 +1031,7 @@ void CoThread::closeUpvalues(Value *last) {
 
     upvalue->closed = *upvalue->location;
     upvalue->location = &upvalue->closed;
+    WRITE_BARRIER(&upvalue->obj);
     openUpvalues = upvalue->next;
   }
 }
@@ -723,6 +1065,7 @@ ObjNativeClass *newNativeClass(NativeClassFn classFn) {
   ObjNativeClass *native = ALLOCATE_OBJ(ObjNativeClass, OBJ_NATIVE_CLASS);
 
   native->classFn = classFn;
+  native->arg = NULL;
   return native;
 }
 
@@ -733,7 +1076,47 @@ void CoThread::reset() {
   frameCount = 0;
 }
 
+void CoThread::reserve(int count) {
+  int needed = (int) (savedStackTop - fields) + count;
+
+  if (needed > fieldCapacity)
+    resizeStack(needed > fieldCapacity * 2 ? needed : fieldCapacity * 2);
+}
+
+// Moves the stack, rebasing every pointer into it: the frame slots, the
+// open upvalues and, for the running thread, stackTop.
+void CoThread::resizeStack(int capacity) {
+  Value *oldFields = fields;
+  long top = stackTop > fields && stackTop <= fields + fieldCapacity ? stackTop - fields : -1;
+
+  fields = RESIZE_ARRAY(Value, fields, fieldCapacity, capacity);
+  fieldCapacity = capacity;
+  savedStackTop = fields + (savedStackTop - oldFields);
+
+  if (top != -1)
+    stackTop = fields + top;
+
+  for (int ndx = 0; ndx < frameCount; ndx++)
+    frames[ndx].slots = fields + (frames[ndx].slots - oldFields);
+
+  for (ObjUpvalue *upvalue = openUpvalues; upvalue != NULL; upvalue = upvalue->next)
+    upvalue->location = fields + (upvalue->location - oldFields);
+}
+
+void CoThread::push(Value value) {
+  reserve(1);
+  *savedStackTop++ = value;
+}
+
+// A finished instance only keeps its fields, so drop the headroom.
+void CoThread::trim() {
+  resizeStack(savedStackTop - fields);
+  frames = RESIZE_ARRAY(CallFrame, frames, frameCapacity, frameCount);
+  frameCapacity = frameCount;
+}
+
 ObjClosure *CoThread::pushClosure(ObjFunction *function) {
+  reserve(1);
   stackTop = savedStackTop;
 //  if (mainClosure == NULL) {
     PUSH(OBJ_VAL(function));
@@ -797,13 +1180,14 @@ bool CoThread::getFormFlag() {
 void CoThread::initValues() {
   for (int ndx = 0; ndx < frameCount; ndx++) {
     CallFrame &frame = frames[ndx];
-    ObjClosure *outClosure = frame.uiClosure;
+    ObjClosure *outClosure = getUiClosure(frame);
 
     frame.uiValuesInstance = newThread(NULL);
+    WRITE_BARRIER(&obj);
 
     CoThread *instanceThread = frame.uiValuesInstance;
 
-    *instanceThread->savedStackTop++ = OBJ_VAL(outClosure);
+    instanceThread->push(OBJ_VAL(outClosure));
     instanceThread->call(outClosure, 0);
     run(instanceThread);
     instanceThread->savedStackTop = stackTop;
@@ -822,10 +1206,7 @@ void CoThread::uninitValues() {
       for (int ndx2 = -1; (ndx2 = outClosure->function->instanceIndexes->getNext(ndx2)) != -1;)
         ((CoThread *) AS_OBJ(frame.uiValuesInstance->fields[ndx2]))->uninitValues();
 
-      if (frame.uiValuesInstance) {
-        FREE(OBJ_THREAD, frame.uiValuesInstance);
-        frame.uiValuesInstance = NULL;
-      }
+      frame.uiValuesInstance = NULL;
     }
 }
 
@@ -839,10 +1220,11 @@ Point CoThread::recalculateLayout() {
     ObjClosure *layoutClosure = AS_CLOSURE(valuesThread->fields[valuesClosure->function->declarationCount[0] - 1]);
 
     frames[ndx].uiLayoutInstance = newThread(NULL);
+    WRITE_BARRIER(&obj);
 
     CoThread *layoutThread = frames[ndx].uiLayoutInstance;
 
-    *layoutThread->savedStackTop++ = OBJ_VAL(layoutClosure);
+    layoutThread->push(OBJ_VAL(layoutClosure));
     layoutThread->call(layoutClosure, 0);
     run(layoutThread);
     layoutThread->savedStackTop = stackTop;
@@ -861,6 +1243,7 @@ extern void uninitDisplay();
 
 Point CoThread::repaint() {
   if (getFormFlag()) {
+    gcSafePoint(&obj);
     uninitValues();
     initValues();
     Point totalSize = recalculateLayout();
@@ -881,13 +1264,13 @@ void CoThread::paint(Point pos, Point size) {
     ObjClosure *paintClosure = AS_CLOSURE(layoutThread->fields[layoutClosure->function->declarationCount[0] - 2]);
     Value value = {VOID_VAL};
 
-    *layoutThread->savedStackTop++ = OBJ_VAL(paintClosure);
+    layoutThread->push(OBJ_VAL(paintClosure));
 
     for (int dir = 0; dir < NUM_DIRS; dir++)
-      *layoutThread->savedStackTop++ = INT_VAL(pos[dir]);
+      layoutThread->push(INT_VAL(pos[dir]));
 
     for (int dir = 0; dir < NUM_DIRS; dir++)
-      *layoutThread->savedStackTop++ = INT_VAL(size[dir]);
+      layoutThread->push(INT_VAL(size[dir]));
 
     layoutThread->call(paintClosure, NUM_DIRS << 1);
     run(layoutThread);
@@ -906,14 +1289,14 @@ bool CoThread::onEvent(Event event, Point pos, Point size) {
     Value value = {VOID_VAL};
     int frameCount = layoutThread->frameCount;
 
-    *layoutThread->savedStackTop++ = OBJ_VAL(eventClosure);
-    *layoutThread->savedStackTop++ = INT_VAL((int) event);
+    layoutThread->push(OBJ_VAL(eventClosure));
+    layoutThread->push(INT_VAL((int) event));
 
     for (int dir = 0; dir < NUM_DIRS; dir++)
-      *layoutThread->savedStackTop++ = INT_VAL(pos[dir]);
+      layoutThread->push(INT_VAL(pos[dir]));
 
     for (int dir = 0; dir < NUM_DIRS; dir++)
-      *layoutThread->savedStackTop++ = INT_VAL(size[dir]);
+      layoutThread->push(INT_VAL(size[dir]));
 
     layoutThread->call(eventClosure, (NUM_DIRS << 1) + 1);
     run(layoutThread);
@@ -934,7 +1317,7 @@ bool CoThread::runHandler(ObjClosure *closure) {
   Value value = {VOID_VAL};
   int oldFrameCount = frameCount;
 
-  *savedStackTop++ = OBJ_VAL(closure);
+  push(OBJ_VAL(closure));
   call(closure, 0);
   run(this);
 
@@ -944,6 +1327,7 @@ bool CoThread::runHandler(ObjClosure *closure) {
   printStack();
 #endif
   onReturn(value);
+  savedStackTop = stackTop;
 #ifdef DEBUG_TRACE_EXECUTION
   printStack();
 #endif
@@ -999,9 +1383,11 @@ CoThread *newThread(CoThread *caller) {
   CoThread *coThread = ALLOCATE_OBJ(CoThread, OBJ_THREAD);
 
   coThread->caller = caller;
-  coThread->fields = ALLOCATE(Value, 64);
+  coThread->fields = NULL;
+  coThread->fieldCapacity = 0;
   coThread->resetStack();
-  coThread->frameCount = 0;
+  coThread->frames = NULL;
+  coThread->frameCapacity = 0;
   coThread->openUpvalues = NULL;
   return coThread;
 }
@@ -1035,27 +1421,47 @@ ObjFunction *newFunction(Type type, ObjString *name, int arity) {
   function->type = type;
   function->arity = arity;
   function->upvalueCount = 0;
+  function->upvalues = NULL;
   function->name = name;
+  function->declarationCount = NULL;
+  function->declarations = NULL;
+  function->detachedCount = 0;
   function->chunk.init();
   function->native = NULL;
   function->instanceIndexes = new IndexList();
   function->eventFlags = 0L;
   function->uiFunction = NULL;
+  function->closure = NULL;
+  function->invocationCount = 0;
+  function->jitCode = NULL;
+  function->tempCount = 0;
+  function->stackSize = 0;
+  function->stackMap = NULL;
 //  function->uiFunctions = new std::unordered_map<std::string, ObjFunction*>();
   return function;
 }
 
+ObjClosure *ObjFunction::getSharedClosure() {
+  if (closure == NULL) {
+    closure = newClosure(this, NULL);
+    WRITE_BARRIER(&obj);
+  }
+
+  return closure;
+}
+
 ObjNative *newNative(NativeFn function) {
   ObjNative *native = ALLOCATE_OBJ(ObjNative, OBJ_NATIVE);
 
   native->function = function;
+  native->opCode = -1;
   return native;
 }
 
 ObjPrimitive *newPrimitive(char *name, Type type) {
   ObjPrimitive *primitive = ALLOCATE_OBJ(ObjPrimitive, OBJ_PRIMITIVE);
 
-  primitive->name = takeString(name, strlen(name));
+  primitive->name = copyString(name, strlen(name));
   primitive->type = type;
   return primitive;
 }
@@ -1073,40 +1479,312 @@ ObjFunctionPtr *newFunctionPtr(Type type, int arity, Type *parms) {
   return functionPtr;
 }
 
-static ObjString *allocateString(char *chars, int length) {
-  ObjString *string = ALLOCATE_OBJ(ObjString, OBJ_STRING);
+// Every string is interned, so equal strings are the same object. The
+// table is weak: freeObject() removes the strings the GC collects.
+#define STRING_TOMBSTONE ((ObjString *) &strings)
+#define STRINGS_MAX_LOAD 0.75
+
+static ObjString **strings = NULL;
+static int stringCount = 0;
+static int stringCapacity = 0;
+
+uint32_t hashString(const char *chars, int length) {
+  uint32_t hash = 2166136261u;
+
+  for (int index = 0; index < length; index++) {
+    hash ^= (uint8_t) chars[index];
+    hash *= 16777619;
+  }
+
+  return hash;
+}
+
+static ObjString **findStringSlot(ObjString **entries, int capacity, const char *chars, int length, uint32_t hash) {
+  ObjString **tombstone = NULL;
+
+  for (uint32_t index = hash & (capacity - 1);; index = (index + 1) & (capacity - 1)) {
+    ObjString **entry = &entries[index];
+
+    if (*entry == NULL)
+      return tombstone != NULL ? tombstone : entry;
+
+    if (*entry == STRING_TOMBSTONE) {
+      if (tombstone == NULL)
+        tombstone = entry;
+    }
+    else if ((*entry)->hash == hash && (*entry)->length == length && !memcmp((*entry)->chars, chars, length))
+      return entry;
+  }
+}
+
+// Rehashes without the tombstones, only growing if still mostly live
+static void growStrings() {
+  int live = 0;
+
+  for (int index = 0; index < stringCapacity; index++)
+    live += strings[index] != NULL && strings[index] != STRING_TOMBSTONE;
+
+  int capacity = live + 1 > stringCapacity * STRINGS_MAX_LOAD / 2 ? GROW_CAPACITY(stringCapacity) : stringCapacity;
+  ObjString **entries = ALLOCATE(ObjString *, capacity);
+
+  for (int index = 0; index < capacity; index++)
+    entries[index] = NULL;
+
+  stringCount = 0;
+
+  for (int index = 0; index < stringCapacity; index++) {
+    ObjString *string = strings[index];
+
+    if (string != NULL && string != STRING_TOMBSTONE) {
+      *findStringSlot(entries, capacity, string->chars, string->length, string->hash) = string;
+      stringCount++;
+    }
+  }
+
+  FREE_ARRAY(ObjString *, strings, stringCapacity);
+  strings = entries;
+  stringCapacity = capacity;
+}
+
+ObjString *copyString(const char *chars, int length) {
+  uint32_t hash = hashString(chars, length);
+
+  if (stringCount + 1 > stringCapacity * STRINGS_MAX_LOAD)
+    growStrings();
+
+  ObjString **entry = findStringSlot(strings, stringCapacity, chars, length, hash);
+
+  if (*entry != NULL && *entry != STRING_TOMBSTONE)
+    return *entry;
+
+  ObjString *string = (ObjString *) allocateObject(sizeof(ObjString) + length + 1, OBJ_STRING);
+
   string->length = length;
-  string->chars = chars;
+  string->hash = hash;
+  string->chars = (char *) (string + 1);
+  memcpy(string->chars, chars, length);
+  string->chars[length] = '\0';
+
+  if (*entry == NULL)
+    stringCount++;
+
+  *entry = string;
   return string;
 }
 
 ObjString *takeString(char *chars, int length) {
-  return allocateString(chars, length);
+  ObjString *string = copyString(chars, length);
+
+  FREE_ARRAY(char, chars, length + 1);
+  return string;
 }
 
-ObjString *copyString(const char *chars, int length) {
-  char *heapChars = ALLOCATE(char, length + 1);
+void removeString(ObjString *string) {
+  ObjString **entry = findStringSlot(strings, stringCapacity, string->chars, string->length, string->hash);
+
+  if (*entry != string)
+    return;
+
+  if (strings[(entry - strings + 1) & (stringCapacity - 1)] == NULL) {
+    *entry = NULL; // end of a probe chain, no tombstone needed
+    stringCount--;
+  }
+  else
+    *entry = STRING_TOMBSTONE;
+}
+
+ObjString *intStrings[INT_STRINGS_MAX];
+
+// Formats without sprintf; small values come from a cache that the GC
+// treats as roots
+ObjString *intToString(long value) {
+  if (value >= 0 && value < INT_STRINGS_MAX && intStrings[value] != NULL)
+    return intStrings[value];
+
+  char buffer[sizeof(long) * 3 + 2];
+  char *start = buffer + sizeof(buffer);
+  unsigned long digits = value < 0 ? 0 - (unsigned long) value : value;
+
+  do
+    *--start = '0' + digits % 10;
+  while ((digits /= 10) != 0);
+
+  if (value < 0)
+    *--start = '-';
+
+  ObjString *string = copyString(start, buffer + sizeof(buffer) - start);
+
+  if (value >= 0 && value < INT_STRINGS_MAX)
+    intStrings[value] = string;
+
+  return string;
+}
+
+// Same output as %g, whole values in its integer range skip sprintf
+ObjString *floatToString(double value) {
+  if (value > -1e6 && value < 1e6 && floatsEqual(value, (long) value) && ((long) value != 0 || !signbit(value)))
+    return intToString((long) value);
+
+  char buffer[32];
+  int length = snprintf(buffer, sizeof(buffer), "%g", value);
+
+  return copyString(buffer, length);
+}
+
+ObjRope *newRope(Obj *left, Obj *right, int length) {
+  ObjRope *rope = ALLOCATE_OBJ(ObjRope, OBJ_ROPE);
 
-  memcpy(heapChars, chars, length);
-  heapChars[length] = '\0';
-  return allocateString(heapChars, length);
+  rope->length = length;
+  rope->left = left;
+  rope->right = right;
+  return rope;
 }
 
-ObjUpvalue *newUpvalue(Value *slot) {
+// Copies the leaves right to left with an explicit stack, so that
+// ropes built by long concatenation chains cannot overflow the C stack
+ObjString *flattenString(Obj *object) {
+  if (object->type == OBJ_STRING)
+    return (ObjString *) object;
+
+  if (object->type == OBJ_SLICE) {
+    ObjSlice *slice = (ObjSlice *) object;
+
+    if (slice->start != 0 || slice->length != slice->source->length) {
+      slice->source = copyString(slice->source->chars + slice->start, slice->length);
+      slice->start = 0;
+      WRITE_BARRIER(&slice->obj);
+    }
+
+    return slice->source;
+  }
+
+  ObjRope *rope = (ObjRope *) object;
+
+  if (rope->right == NULL)
+    return (ObjString *) rope->left;
+
+  char *chars = ALLOCATE(char, rope->length + 1);
+  char *end = chars + rope->length;
+  int pendingCapacity = 8;
+  Obj **pending = ALLOCATE(Obj *, pendingCapacity);
+  int pendingCount = 0;
+
+  pending[pendingCount++] = rope->left;
+  pending[pendingCount++] = rope->right;
+
+  while (pendingCount > 0) {
+    Obj *node = pending[--pendingCount];
+
+    if (node->type == OBJ_ROPE && ((ObjRope *) node)->right != NULL) {
+      if (pendingCount + 2 > pendingCapacity) {
+        int oldCapacity = pendingCapacity;
+
+        pendingCapacity = GROW_CAPACITY(oldCapacity);
+        pending = RESIZE_ARRAY(Obj *, pending, oldCapacity, pendingCapacity);
+      }
+
+      pending[pendingCount++] = ((ObjRope *) node)->left;
+      pending[pendingCount++] = ((ObjRope *) node)->right;
+    }
+    else {
+      int length = ((ObjString *) node)->length;
+
+      end -= length;
+      memcpy(end, stringChars(node), length);
+    }
+  }
+
+  FREE_ARRAY(Obj *, pending, pendingCapacity);
+  chars[rope->length] = '\0';
+
+  ObjString *string = takeString(chars, rope->length);
+
+  rope->left = &string->obj;
+  rope->right = NULL;
+  WRITE_BARRIER(&rope->obj);
+  return string;
+}
+
+ObjSlice *newSlice(ObjString *source, int start, int length) {
+  ObjSlice *slice = ALLOCATE_OBJ(ObjSlice, OBJ_SLICE);
+
+  slice->length = length;
+  slice->source = source;
+  slice->start = start;
+  return slice;
+}
+
+// Characters start to start + length of string, in range, without copying
+Obj *substring(Obj *string, int start, int length) {
+  if (length == ((ObjString *) string)->length)
+    return string;
+
+  if (length == 0)
+    return &copyString("", 0)->obj;
+
+  if (string->type == OBJ_SLICE) {
+    ObjSlice *slice = (ObjSlice *) string;
+
+    return &newSlice(slice->source, slice->start + start, length)->obj;
+  }
+
+  return &newSlice(flattenString(string), start, length)->obj;
+}
+
+// The characters of any string, only NUL-terminated for flat strings
+const char *stringChars(Obj *string) {
+  if (string->type == OBJ_SLICE)
+    return ((ObjSlice *) string)->source->chars + ((ObjSlice *) string)->start;
+
+  return flattenString(string)->chars;
+}
+
+// Flat strings are interned and compare by pointer
+bool stringsEqual(Obj *a, Obj *b) {
+  if (a->type == OBJ_STRING && b->type == OBJ_STRING)
+    return a == b;
+
+  int length = ((ObjString *) a)->length;
+
+  return length == ((ObjString *) b)->length && !memcmp(stringChars(a), stringChars(b), length);
+}
+
+ObjUpvalue *newUpvalue(Value *slot, ValueType type) {
   ObjUpvalue *upvalue = ALLOCATE_OBJ(ObjUpvalue, OBJ_UPVALUE);
 
   upvalue->closed = OBJ_VAL(NULL);
   upvalue->location = slot;
+  upvalue->type = type;
   upvalue->next = NULL;
   return upvalue;
 }
 
 ObjArray *newArray() {
+  return newArray({VAL_VOID, NULL}, 0);
+}
+
+ObjArray *newArray(Type elementType, int capacity) {
   ObjArray *array = ALLOCATE_OBJ(ObjArray, OBJ_ARRAY);
-  array->elementType = {VAL_VOID};
+
+  array->elementType = elementType;
+  array->count = 0;
+  array->capacity = capacity;
+  array->booleans = capacity ? ALLOCATE(bool, capacity * arrayElementSize(elementType.valueType)) : NULL;
   return array;
 }
 
+void appendArray(ObjArray *array, Value value) {
+  if (array->count == array->capacity) {
+    int oldCapacity = array->capacity;
+    size_t size = arrayElementSize(array->elementType.valueType);
+
+    array->capacity = GROW_CAPACITY(oldCapacity);
+    array->booleans = RESIZE_ARRAY(bool, array->booleans, oldCapacity * size, array->capacity * size);
+  }
+
+  setArrayElement(array, array->count++, value);
+}
+
 static void printFunction(ObjCallable *function) {
   if (function->name == NULL) {
     printf("<script>");
@@ -1144,15 +1822,32 @@ void printObject(Value value) {
     printFunction(AS_CALLABLE(value));
     break;
   case OBJ_STRING:
+  case OBJ_ROPE:
+  case OBJ_SLICE:
     printf("%s", AS_CSTRING(value));
     break;
   case OBJ_UPVALUE:
     printf("upvalue");
     break;
-  case OBJ_ARRAY:
-    printf("[]");
+  case OBJ_ARRAY: {
+    ObjArray *array = AS_ARRAY(value);
+
+    printf("[");
+    for (int index = 0; index < array->count; index++) {
+      Value element = getArrayElement(array, index);
+
+      if (index) printf(", ");
+      switch (array->elementType.valueType) {
+      case VAL_BOOL: printf(AS_BOOL(element) ? "true" : "false"); break;
+      case VAL_INT: printf("%ld", AS_INT(element)); break;
+      case VAL_FLOAT: printf("%g", AS_FLOAT(element)); break;
+      default: printObject(element); break;
+      }
+    }
+    printf("]");
     break;
   }
+  }
 }
 #if 0
 /*
@@ -22,8 +22,8 @@
 #define AS_NATIVE(value)       (((ObjNative*)AS_OBJ(value))->function)
 #define AS_NATIVE_CLASS(value) (((ObjNativeClass*)AS_OBJ(value))->classFn)
 #define AS_PRIMITIVE(value)    ((ObjPrimitive*)AS_OBJ(value))
-#define AS_STRING(value)       ((ObjString*)AS_OBJ(value))
-#define AS_CSTRING(value)      (((ObjString*)AS_OBJ(value))->chars)
+#define AS_STRING(value)       flattenString(AS_OBJ(value))
+#define AS_CSTRING(value)      (flattenString(AS_OBJ(value))->chars)
 #define AS_ARRAY(value)        ((ObjArray*)AS_OBJ(value))
 
 typedef struct ObjString ObjString;
@@ -37,6 +37,8 @@ typedef enum {
   OBJ_NATIVE_CLASS,
   OBJ_PRIMITIVE,
   OBJ_STRING,
+  OBJ_ROPE,
+  OBJ_SLICE,
   OBJ_UPVALUE,
   OBJ_ARRAY,
   OBJ_FUNCTION_PTR,
@@ -46,6 +48,10 @@ typedef enum {
 struct Obj {
   ObjType type;
   struct Obj *next;
+  bool isMarked;
+  bool isOld;
+  bool isRemembered;
+  unsigned int size;
 
   const char *toString();
 };
@@ -74,6 +80,7 @@ typedef struct {
   Type type;
   Token name;
   bool isField;
+  bool isAssigned;
   int realIndex;
 } Declaration;
 
@@ -101,18 +108,29 @@ struct IndexList {
 
 struct Expr;
 struct DeclarationExpr;
+struct JitCode;
+struct StackMap;
+struct ObjClosure;
 
 struct ObjFunction : ObjCallable {
   int upvalueCount;
-  Upvalue upvalues[UINT8_COUNT];
+  Upvalue *upvalues;
   Expr *bodyExpr;
   Chunk chunk;
   Obj *native;
   IndexList *instanceIndexes;
   long eventFlags;
   ObjFunction *uiFunction;
+  ObjClosure *closure; // shared by the calls of an upvalue-free function
+  int invocationCount;
+  JitCode *jitCode;
+  int detachedCount;
+  int tempCount; // register temporaries, kept just above the stack top
+  int stackSize; // the most slots a frame of it uses, set by endCompiler
+  StackMap *stackMap; // built with stackSize
 
   int addUpvalue(uint8_t index, bool isField, Type type, Parser &parser);
+  ObjClosure *getSharedClosure();
 };
 
 typedef Value (*NativeFn)(int argCount, Value *args);
@@ -120,6 +138,7 @@ typedef Value (*NativeFn)(int argCount, Value *args);
 struct ObjNative {
   Obj obj;
   NativeFn function;
+  int opCode; // inline lowering of a pure native, -1 if none
 };
 
 struct ObjPrimitive : ObjNamed {
@@ -129,18 +148,39 @@ struct ObjPrimitive : ObjNamed {
 struct ObjString {
   Obj obj;
   int length;
+  uint32_t hash;
   char *chars;
 };
 
+// A deferred concatenation, flattened into an interned string the first
+// time its characters are needed (see flattenString())
+struct ObjRope {
+  Obj obj;
+  int length; // same offset as in ObjString
+  Obj *left;  // the flattened string once right is NULL
+  Obj *right;
+};
+
+// Characters start to start + length of an interned string, shared rather
+// than copied; becomes a view of its own interned copy the first time a
+// NUL-terminated string is needed (see flattenString())
+struct ObjSlice {
+  Obj obj;
+  int length; // same offset as in ObjString
+  ObjString *source;
+  int start;
+};
+
 typedef struct ObjUpvalue {
   Obj obj;
   Value *location;
   Value closed;
+  ValueType type;
   struct ObjUpvalue *next;
 } ObjUpvalue;
 
-#define FRAMES_MAX 64
-#define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
+#define FRAMES_MAX 1024
+#define INT_STRINGS_MAX 1024
 
 typedef enum {
   INTERPRET_OK,
@@ -152,7 +192,8 @@ typedef enum {
 struct VM;
 struct CoThread;
 
-typedef InterpretResult (*NativeClassFn)(VM &vm, int argCount, Value *args);
+// Runs at the end of a native class body, in the thread of the new instance
+typedef InterpretResult (*NativeClassFn)(CoThread *thread, int argCount, Value *args);
 
 struct ObjNativeClass {
   Obj obj;
@@ -181,19 +222,27 @@ struct CoThread {
   Obj obj;
   CoThread *caller;
   Value *fields;
+  int fieldCapacity;
   int frameCount;
-  CallFrame frames[FRAMES_MAX];
+  int frameCapacity;
+  CallFrame *frames;
   ObjUpvalue *openUpvalues;
   Value *savedStackTop;
 
   bool call(ObjClosure *closure, int argCount);
+  ObjClosure *getUiClosure(CallFrame &frame);
   bool callValue(Value callee, int argCount);
-  ObjUpvalue *captureUpvalue(Value *field);
+  ObjUpvalue *captureUpvalue(Value *field, ValueType type);
   void closeUpvalues(Value *last);
 
   ObjClosure *pushClosure(ObjFunction *function);
   void reset();
 
+  void reserve(int count);
+  void resizeStack(int capacity);
+  void push(Value value);
+  void trim();
+
   void resetStack();
   void runtimeError(const char *format, ...);
 #ifdef DEBUG_TRACE_EXECUTION
@@ -215,9 +264,19 @@ struct CoThread {
   bool runHandler(ObjClosure *closure);
 };
 
+// Also the type of arrays, with no elements. Elements are stored unboxed,
+// in the representation of their type
 typedef struct {
   Obj obj;
   Type elementType;
+  int count;
+  int capacity;
+  union {
+    bool *booleans;
+    long *integers;
+    double *floats;
+    Obj **objects;
+  };
 } ObjArray;
 
 struct ObjInstance {
@@ -227,6 +286,7 @@ struct ObjInstance {
 
 struct Internal {
   virtual ~Internal();
+  virtual void mark();
 };
 
 struct ObjInternal {
@@ -246,17 +306,52 @@ ObjFunction *newFunction(Type type, ObjString *name, int arity);
 ObjNative *newNative(NativeFn function);
 ObjPrimitive *newPrimitive(char *name, Type type);
 ObjFunctionPtr *newFunctionPtr(Type type, int arity, Type *parms);
+uint32_t hashString(const char *chars, int length);
 ObjString *takeString(char *chars, int length);
 ObjString *copyString(const char *chars, int length);
-ObjUpvalue *newUpvalue(Value *slot);
+void removeString(ObjString *string);
+ObjString *intToString(long value);
+ObjString *floatToString(double value);
+ObjRope *newRope(Obj *left, Obj *right, int length);
+ObjString *flattenString(Obj *object);
+ObjSlice *newSlice(ObjString *source, int start, int length);
+Obj *substring(Obj *string, int start, int length);
+const char *stringChars(Obj *string);
+bool stringsEqual(Obj *a, Obj *b);
+ObjUpvalue *newUpvalue(Value *slot, ValueType type);
 ObjArray *newArray();
+ObjArray *newArray(Type elementType, int capacity);
+void appendArray(ObjArray *array, Value value);
 void printObject(Value value);
 void freeObjects();
 
 extern Obj *objects;
+extern ObjString *intStrings[INT_STRINGS_MAX];
 
 static inline bool isObjType(Type &type, ObjType objType) {
   return AS_OBJ_TYPE(type) == objType;
 }
 
+static inline size_t arrayElementSize(ValueType type) {
+  return type == VAL_BOOL ? sizeof(bool) : sizeof(As);
+}
+
+static inline Value getArrayElement(ObjArray *array, int index) {
+  switch (array->elementType.valueType) {
+  case VAL_BOOL: return BOOL_VAL(array->booleans[index]);
+  case VAL_INT: return INT_VAL(array->integers[index]);
+  case VAL_FLOAT: return FLOAT_VAL(array->floats[index]);
+  default: return OBJ_VAL(array->objects[index]);
+  }
+}
+
+static inline void setArrayElement(ObjArray *array, int index, Value value) {
+  switch (array->elementType.valueType) {
+  case VAL_BOOL: array->booleans[index] = AS_BOOL(value); break;
+  case VAL_INT: array->integers[index] = AS_INT(value); break;
+  case VAL_FLOAT: array->floats[index] = AS_FLOAT(value); break;
+  default: array->objects[index] = AS_OBJ(value); break;
+  }
+}
+
 #endif
\ No newline at end of file
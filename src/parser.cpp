@@ -7,6 +7,7 @@
 #include "parser.hpp"
 #include "memory.h"
 #include "object.hpp"
+#include "arena.hpp"
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
@@ -66,7 +67,7 @@ ParseExpRule expRules[] = {
     [TOKEN_EOF] = {NULL, NULL, PREC_NONE},
 };
 */
-Obj objString = {OBJ_STRING, NULL};
+Obj objString = {OBJ_STRING, NULL, false, false, false, 0};
 Type stringType = {VAL_OBJ, &objString};
 
 ParseExpRule *getExpRule(TokenType type) {
@@ -159,7 +160,17 @@ void Parser::errorAt(Token *token, const char *fmt, ...) {
 #undef FORMAT_MESSAGE
 
 ObjFunction *Parser::compile() {
-  return parse() ? expr->_compiler.compile(*this) : NULL;
+  Arena arena;
+  Arena *enclosingArena = astArena;
+
+  astArena = &arena;
+
+  ObjFunction *function = parse() ? expr->_compiler.compile(*this) : NULL;
+
+  detachFunctions(arena);
+  expr = NULL;
+  astArena = enclosingArena;
+  return function;
 }
 
 bool Parser::parse() {
@@ -209,6 +220,11 @@ Expr *Parser::assignment(Expr *left) {
 
     return new SetExpr(getExpr->object, getExpr->name, op, right, -1);
   }
+  case EXPR_ARRAYELEMENT: {
+    ArrayElementExpr *elementExpr = (ArrayElementExpr *) left;
+
+    return new SetExpr(elementExpr, elementExpr->bracket, op, right, -1);
+  }
   default:
     errorAt(&op, "Invalid assignment target."); // [no-throw]
     return left;
@@ -275,6 +291,11 @@ Expr *Parser::suffix(Expr *left) {
   switch (op.type) {
     case TOKEN_PLUS_PLUS:
     case TOKEN_MINUS_MINUS:
+      if (left->type != EXPR_REFERENCE) {
+        errorAt(&op, "Invalid increment target.");
+        return left;
+      }
+
       return new AssignExpr((ReferenceExpr *) left, op, NULL, OP_FALSE, true);
 
     default:
@@ -322,7 +343,7 @@ Expr *Parser::call(Expr *left) {
       if (argCount == 255)
         error("Can't have more than 255 arguments.");
 
-      expList = RESIZE_ARRAY(Expr *, expList, argCount, argCount + 1);
+      expList = ARENA_RESIZE(Expr *, expList, argCount, argCount + 1);
       expList[argCount++] = expr;
     } while (match(TOKEN_COMMA));
   }
@@ -358,7 +379,7 @@ Expr *Parser::arrayElement(Expr *left) {
     if (indexCount == 255)
       error("Can't have more than 255 indexes.");
 
-    expList = RESIZE_ARRAY(Expr *, expList, indexCount, indexCount + 1);
+    expList = ARENA_RESIZE(Expr *, expList, indexCount, indexCount + 1);
     expList[indexCount++] = expr;
   } while (match(TOKEN_COMMA));
 
@@ -500,7 +521,7 @@ UIDirectiveExpr *Parser::directive(TokenType endGroupType, UIDirectiveExpr *prev
   while (check(TOKEN_IDENTIFIER)) {
     UIAttributeExpr *att = attribute(endGroupType);
 
-    attributeList = RESIZE_ARRAY(UIAttributeExpr *, attributeList, attCount, attCount + 1);
+    attributeList = ARENA_RESIZE(UIAttributeExpr *, attributeList, attCount, attCount + 1);
     attributeList[attCount++] = att;
     passSeparator();
   }
@@ -519,6 +540,7 @@ UIDirectiveExpr *Parser::directive(TokenType endGroupType, UIDirectiveExpr *prev
 
 Expr *Parser::grouping(TokenType endGroupType, const char *errorMessage) {
   int count = 0;
+  int capacity = 0;
   Expr **expList = NULL;
   bool uiFlag = false;
 
@@ -534,7 +556,13 @@ Expr *Parser::grouping(TokenType endGroupType, const char *errorMessage) {
       statementExprs &= ~(1 << scopeDepth);
       Expr *exp = declaration(endGroupType);
 
-      expList = RESIZE_ARRAY(Expr *, expList, count, count + 1);
+      if (count == capacity) {
+        int oldCapacity = capacity;
+
+        capacity = GROW_CAPACITY(oldCapacity);
+        expList = ARENA_RESIZE(Expr *, expList, oldCapacity, capacity);
+      }
+
       expList[count++] = exp;
     }
   }
@@ -550,7 +578,7 @@ Expr *Parser::grouping(TokenType endGroupType, const char *errorMessage) {
     delete (StatementExpr *) expList[count - 1];
 
     if (count == 1)
-      RESIZE_ARRAY(Expr *, expList, 1, 0);
+      ARENA_RESIZE(Expr *, expList, 1, 0);
     else {
       expList[count - 1] = exp;
       exp = NULL;
@@ -578,7 +606,7 @@ Expr *Parser::array() {
       if (count >= 255)
         errorAtCurrent("Can't have more than 255 parameters.");
 
-      expList = RESIZE_ARRAY(Expr *, expList, count, count + 1);
+      expList = ARENA_RESIZE(Expr *, expList, count, count + 1);
       expList[count++] = exp;
     }
 
@@ -586,7 +614,7 @@ Expr *Parser::array() {
   } while (match(TOKEN_COMMA));
 
   consume(TOKEN_RIGHT_BRACKET, "Expect ']' after expression.");
-  return new ArrayExpr(count, expList, NULL);
+  return new ArrayExpr(count, expList);
 }
 
 Expr *Parser::floatNumber() {
@@ -634,6 +662,11 @@ Expr *Parser::unary() {
     case TOKEN_MINUS_MINUS: {
       Expr *right = parsePrecedence(PREC_CALL);
 
+      if (right == NULL || right->type != EXPR_REFERENCE) {
+        errorAt(&op, "Invalid increment target.");
+        return right;
+      }
+
       return new AssignExpr((ReferenceExpr *) right, op, NULL, OP_FALSE, false);
     }
     default:
@@ -694,11 +727,11 @@ Expr *Parser::expression(TokenType *endGroupTypes) {
       error("Expect expression.");
 
     if (expList == NULL) {
-      expList = RESIZE_ARRAY(Expr *, expList, count, count + 1);
+      expList = ARENA_RESIZE(Expr *, expList, count, count + 1);
       expList[count++] = exp;
     }
 
-    expList = RESIZE_ARRAY(Expr *, expList, count, count + 1);
+    expList = ARENA_RESIZE(Expr *, expList, count, count + 1);
     expList[count++] = exp2;
   }
 
@@ -720,7 +753,7 @@ Expr *Parser::function(Type *type, TokenType endGroupType) {
 
       Expr *param = parseVariable(endGroupType, "Expect parameter name.");
 
-      parameters = RESIZE_ARRAY(Expr *, parameters, arity, arity + 1);
+      parameters = ARENA_RESIZE(Expr *, parameters, arity, arity + 1);
       parameters[arity++] = param;
     } while (match(TOKEN_COMMA));
   }
@@ -800,17 +833,17 @@ Expr *Parser::forStatement(TokenType endGroupType) {
   Expr *body = statement(endGroupType);
 
   if (increment != NULL) {
-    Expr **expList = RESIZE_ARRAY(Expr *, NULL, 0, 2);
+    Expr **expList = ARENA_RESIZE(Expr *, NULL, 0, 2);
 
-    expList[0] = new UnaryExpr(buildToken(TOKEN_PRINT, "print", 5, -1), body);
-    expList[1] = new UnaryExpr(buildToken(TOKEN_PRINT, "print", 5, -1), increment);
+    expList[0] = new StatementExpr(body);
+    expList[1] = new StatementExpr(increment);
     body = new GroupingExpr(buildToken(TOKEN_RIGHT_BRACE, "}", 1, -1), 2, expList, 0, NULL);
   }
 
   body = new BinaryExpr(condition, buildToken(TOKEN_WHILE, "while", 5, -1), body, OP_FALSE, false);
 
   if (initializer != NULL) {
-    Expr **expList = RESIZE_ARRAY(Expr *, NULL, 0, 2);
+    Expr **expList = ARENA_RESIZE(Expr *, NULL, 0, 2);
 
     expList[0] = initializer;
     expList[1] = body;
@@ -10,12 +10,21 @@
 #include "parser.hpp"
 #include "vm.hpp"
 #include "qni.hpp"
+#include "regcodegen.hpp"
+#include "reifier.hpp"
+#include "jit.hpp"
+#include "cppgen.hpp"
+#include "simd.hpp"
+#include "memory.h"
 
 const char *qedLib =
 "void println(String str);"
 "//void print(String str)\n"
 "void post(int handlerFn);"
 "int max(int a, int b);"
+"int packPoint(int x, int y);"
+"int pointX(int point);"
+"int pointY(int point);"
 ""
 "var WIDTH = 1;"
 "var HEIGHT = 2;"
@@ -26,6 +35,24 @@ const char *qedLib =
 "int COLOR_BLUE = 0x0000FF;"
 "int COLOR_BLACK = 0x000000;"
 "float clock();"
+"int arraySum(int[] a);"
+"float arraySum(float[] a);"
+"int arrayMin(int[] a);"
+"float arrayMin(float[] a);"
+"int arrayMax(int[] a);"
+"float arrayMax(float[] a);"
+"void arrayScale(int[] a, int k);"
+"void arrayScale(float[] a, float k);"
+"int arrayDot(int[] a, int[] b);"
+"float arrayDot(float[] a, float[] b);"
+"void arrayPrefixSum(int[] a);"
+"void arrayPrefixSum(float[] a);"
+"int length(String s);"
+"String substring(String s, int start, int end);"
+"int indexOf(String s, String part);"
+"int indexOf(String s, String part, int from);"
+"String[] split(String s, String separator);"
+"String trim(String s);"
 "void saveContext();"
 "void restoreContext();"
 "void oval(int pos, int size);"
@@ -58,6 +85,40 @@ const char *qedLib =
 "  bool remove(int index);"
 "  bool yield();"
 "  bool process();"
+"};"
+""
+"void Map() {"
+"  var _map;"
+""
+"  int size();"
+"  void clear();"
+"  void put(int key, int value);"
+"  void put(int key, float value);"
+"  void put(int key, bool value);"
+"  void put(int key, String value);"
+"  void put(String key, int value);"
+"  void put(String key, float value);"
+"  void put(String key, bool value);"
+"  void put(String key, String value);"
+"  int get(int key, int default);"
+"  float get(int key, float default);"
+"  bool get(int key, bool default);"
+"  String get(int key, String default);"
+"  int get(String key, int default);"
+"  float get(String key, float default);"
+"  bool get(String key, bool default);"
+"  String get(String key, String default);"
+"  bool has(int key);"
+"  bool has(String key);"
+"  bool remove(int key);"
+"  bool remove(String key);"
+"  int next(int slot);"
+"  int keyAt(int slot, int default);"
+"  String keyAt(int slot, String default);"
+"  int valueAt(int slot, int default);"
+"  float valueAt(int slot, float default);"
+"  bool valueAt(int slot, bool default);"
+"  String valueAt(int slot, String default);"
 "}\n"
 ;
 
@@ -78,6 +139,8 @@ static void repl() {
   VM vm(coThread, false);
   ObjClosure *closure = coThread->pushClosure(function);
 
+  pinObject(&closure->obj);
+
 //  strcpy(buffer, "");
 //  scanner.reset(buffer);
 
@@ -90,6 +153,7 @@ static void repl() {
         scanner.reset(&buffer[length]);
       }
 
+      freeJit(function);
       function->chunk.reset();
       coThread->reset();
     }
@@ -104,6 +168,7 @@ static void repl() {
     strcat(buffer, line);
 
     parser.compile();
+    WRITE_BARRIER(&function->obj);
   }
 
   freeObjects();
@@ -142,6 +207,8 @@ static char *readFile(const char *path) {
   return buffer;
 }
 
+static const char *emitPath = NULL;
+
 extern "C" {
 void runSource(const char *source) {
   int qedLibLength = strlen(qedLib);
@@ -165,6 +232,15 @@ void runSource(const char *source) {
   if (!function)
     return;
 
+  if (emitPath) {
+    if (!emitCpp(emitPath, source, function))
+      exit(74);
+
+    return;
+  }
+
+  bindAot(function);
+
   CoThread *coThread = newThread(NULL);
   VM vm(coThread, true);
   ObjClosure *closure = coThread->pushClosure(function);
@@ -181,19 +257,69 @@ void runSource(const char *source) {
 }
 }
 
+static void usage() {
+  fprintf(stderr, "Usage: qed [--registers] [--no-inline] [--no-simd] [--emit-cpp] [--gc-stats] [--gc-generational]\n"
+                  "           [--gc-max-pause=<ms>] [--gc-bench=<frames>] [--mem-report] [path]\n");
+  exit(64);
+}
+
+// app.qed becomes app.cpp
+static char *cppPath(const char *path) {
+  int length = strlen(path);
+  char *cppPath = (char *) malloc(length + 5);
+
+  strcpy(cppPath, path);
+
+  if (length > 4 && !strcmp(&cppPath[length - 4], ".qed"))
+    cppPath[length - 4] = '\0';
+
+  strcat(cppPath, ".cpp");
+  return cppPath;
+}
+
 int main(int argc, const char *argv[]) {
-  if (argc == 1)
-    repl();
-  else if (argc == 2) {
-    char *source = readFile(argv[1]);
+  int argIndex = 1;
+  bool emitFlag = false;
+
+  for (; argIndex < argc && !strncmp(argv[argIndex], "--", 2); argIndex++)
+    if (!strcmp(argv[argIndex], "--registers"))
+      registerFlag = true;
+    else if (!strcmp(argv[argIndex], "--no-inline"))
+      inlineFlag = false;
+    else if (!strcmp(argv[argIndex], "--no-simd"))
+      simdFlag = false;
+    else if (!strcmp(argv[argIndex], "--emit-cpp"))
+      emitFlag = true;
+    else if (!strcmp(argv[argIndex], "--gc-stats"))
+      atexit(printGCStats);
+    else if (!strcmp(argv[argIndex], "--gc-generational"))
+      gcGenerational = true;
+    else if (!strncmp(argv[argIndex], "--gc-max-pause=", 15))
+      gcMaxPause = atof(&argv[argIndex][15]);
+    else if (!strncmp(argv[argIndex], "--gc-bench=", 11))
+      benchFrames = atoi(&argv[argIndex][11]);
+    else if (!strcmp(argv[argIndex], "--mem-report"))
+      atexit(printMemReport);
+    else
+      usage();
+
+  if (argIndex == argc && !emitFlag) {
+    if (getAotSource())
+      runSource(getAotSource());
+    else
+      repl();
+  }
+  else if (argIndex == argc - 1) {
+    char *source = readFile(argv[argIndex]);
+
+    if (emitFlag)
+      emitPath = cppPath(argv[argIndex]);
 
     runSource(source);
     free(source);
   }
-  else {
-    fprintf(stderr, "Usage: qed [path]\n");
-    exit(64);
-  }
+  else
+    usage();
 
   return 0;
 }
@@ -20,6 +20,12 @@ static std::map<std::string, NativeClassFn> &getQniClassMap() {
   return qniClassMap;
 }
 
+static std::map<std::string, OpCode> &getQniIntrinsicMap() {
+  static std::map<std::string, OpCode> qniIntrinsicMap;
+
+  return qniIntrinsicMap;
+}
+
 bool addNativeFn(const char *name, NativeFn nativeFn) {
   getQniFnMap()[name] = nativeFn;
   return true;
@@ -30,13 +36,34 @@ bool addNativeClassFn(const char *name, NativeClassFn nativeClassFn) {
   return true;
 }
 
+bool addIntrinsic(const char *name, OpCode opCode) {
+  getQniIntrinsicMap()[name] = opCode;
+  return true;
+}
+
+// The C++ name a native function was registered under, or NULL
+const char *nativeFnName(NativeFn nativeFn) {
+  for (std::map<std::string, NativeFn>::iterator i = getQniFnMap().begin(); i != getQniFnMap().end(); i++)
+    if (i->second == nativeFn)
+      return i->first.c_str();
+
+  return NULL;
+}
+
 bool bindFunction(std::string prefix, ObjFunction *function) {
   std::string name = prefix + "_" + function->name->chars;
   std::map<std::string, NativeFn>::iterator i = getQniFnMap().find(name);
   bool rc = i != getQniFnMap().end();
 
-  if (rc)
-    function->native = &newNative(i->second)->obj;
+  if (rc) {
+    ObjNative *native = newNative(i->second);
+    std::map<std::string, OpCode>::iterator intrinsic = getQniIntrinsicMap().find(name);
+
+    if (intrinsic != getQniIntrinsicMap().end())
+      native->opCode = intrinsic->second;
+
+    function->native = &native->obj;
+  }
   else {
     std::map<std::string, NativeClassFn>::iterator i = getQniClassMap().find(name);
 
@@ -34,16 +34,23 @@ struct ValueStack2 {
   }
 };
 
+// Not static, so that code from qed --emit-cpp can call them by name
 #define QNI_FN(name) \
-  static Value qni_ ## name(int argCount, Value *args); \
+  Value qni_ ## name(int argCount, Value *args); \
   static bool qni_ ## name ## Var = addNativeFn("qni_" #name, qni_ ## name); \
-  static Value qni_ ## name(int argCount, Value *args)
+  Value qni_ ## name(int argCount, Value *args)
+
+// Lets the code generator replace calls to a pure native by one opcode
+#define QNI_INTRINSIC(name, opCode) \
+  static bool qni_ ## name ## Intrinsic = addIntrinsic("qni_" #name, opCode)
 
 #define QNI_CLASS(name) \
-  static InterpretResult qni_ ## name(VM &vm, int argCount, Value *args); \
+  static InterpretResult qni_ ## name(CoThread *thread, int argCount, Value *args); \
   static bool qni_ ## name ## Var = addNativeClassFn("qni_" #name, qni_ ## name); \
-  static InterpretResult qni_ ## name(VM &vm, int argCount, Value *args)
+  static InterpretResult qni_ ## name(CoThread *thread, int argCount, Value *args)
 
 bool addNativeFn(const char *name, NativeFn nativeFn);
 bool addNativeClassFn(const char *name, NativeClassFn nativeClassFn);
+bool addIntrinsic(const char *name, OpCode opCode);
+const char *nativeFnName(NativeFn nativeFn);
 bool bindFunction(std::string prefix, ObjFunction *function);
\ No newline at end of file
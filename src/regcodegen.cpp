@@ -0,0 +1,204 @@
+/*
+ * The QED Programming Language
+ * Copyright (C) 2022-2023  Hocus Codus Software inc.
+ *
+ * All rights reserved.
+ */
+#include "regcodegen.hpp"
+
+bool registerFlag = false;
+
+static OpCode registerOp(OpCode opCode) {
+  switch (opCode) {
+#define REGISTER_HELPER_OP_DEF REGISTER_OP_DEF
+#define REGISTER_OP_DEF( identifier, valueConst, convertMacro, primitiveType, op ) \
+    case OP_ ## identifier: return OP_R_ ## identifier;
+    REGISTER_OPS_DEF
+#undef REGISTER_OP_DEF
+#undef REGISTER_HELPER_OP_DEF
+    default: return OP_FALSE;
+  }
+}
+
+// The constant form always directly follows its register form
+static OpCode constantOp(OpCode opCode) {
+  return (OpCode) (opCode + 1);
+}
+
+RegisterGenerator::RegisterGenerator(CodeGenerator &codeGenerator) : generator(codeGenerator) {
+  tempCount = 0;
+}
+
+uint8_t RegisterGenerator::newTemp() {
+  uint8_t temp = REGISTER_TEMP | tempCount++;
+
+  if (generator.function->tempCount < tempCount)
+    generator.function->tempCount = tempCount;
+
+  return temp;
+}
+
+bool RegisterGenerator::isOperand(Expr *expr) {
+  switch (expr->type) {
+    case EXPR_REFERENCE: {
+      ReferenceExpr *reference = (ReferenceExpr *) expr;
+
+      // slots from REGISTER_TEMP up would alias the temporaries
+      return !reference->upvalueFlag && !(reference->index & REGISTER_TEMP);
+    }
+    case EXPR_LITERAL: {
+      ValueType type = ((LiteralExpr *) expr)->type;
+
+      return type == VAL_BOOL || type == VAL_INT || type == VAL_FLOAT;
+    }
+    default:
+      return false;
+  }
+}
+
+bool RegisterGenerator::isRegisterExpr(Expr *expr, int depth) {
+  if (expr == NULL || depth >= REGISTER_MAX / 2)
+    return false;
+
+  if (isOperand(expr))
+    return true;
+
+  if (expr->type != EXPR_BINARY)
+    return false;
+
+  BinaryExpr *binary = (BinaryExpr *) expr;
+
+  return binary->op.type != TOKEN_WHILE && !binary->notFlag && registerOp(binary->opCode) != OP_FALSE &&
+         isRegisterExpr(binary->left, depth + 1) && isRegisterExpr(binary->right, depth + 1);
+}
+
+uint8_t RegisterGenerator::emitOperand(Expr *expr) {
+  if (expr->type == EXPR_REFERENCE)
+    return ((ReferenceExpr *) expr)->index;
+
+  uint8_t temp = newTemp();
+
+  emitInto(expr, temp);
+  return temp;
+}
+
+void RegisterGenerator::emitInto(Expr *expr, uint8_t dest) {
+  switch (expr->type) {
+    case EXPR_REFERENCE: {
+      uint8_t source = ((ReferenceExpr *) expr)->index;
+
+      if (source != dest) {
+        generator.emitBytes(OP_R_MOVE, dest);
+        generator.emitByte(source);
+      }
+      break;
+    }
+    case EXPR_LITERAL: {
+      LiteralExpr *literal = (LiteralExpr *) expr;
+
+      generator.emitBytes(OP_R_LOADK, dest);
+      generator.emitByte(generator.makeConstant(VALUE(literal->type, literal->as), literal->type));
+      break;
+    }
+    case EXPR_BINARY: {
+      BinaryExpr *binary = (BinaryExpr *) expr;
+      int mark = tempCount;
+      uint8_t a = emitOperand(binary->left);
+
+      if (binary->right->type == EXPR_LITERAL) {
+        LiteralExpr *literal = (LiteralExpr *) binary->right;
+
+        generator.emitBytes(constantOp(registerOp(binary->opCode)), dest);
+        generator.emitBytes(a, generator.makeConstant(VALUE(literal->type, literal->as), literal->type));
+      }
+      else {
+        uint8_t b = emitOperand(binary->right);
+
+        generator.emitBytes(registerOp(binary->opCode), dest);
+        generator.emitBytes(a, b);
+      }
+
+      tempCount = mark;
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+// Assignment to a local whose value is discarded, as in "x = y * 2 + z"
+// or "i++"; the result goes straight into the local's slot
+bool RegisterGenerator::emitStatement(Expr *expr) {
+  if (expr == NULL || expr->type != EXPR_ASSIGN)
+    return false;
+
+  AssignExpr *assign = (AssignExpr *) expr;
+  ReferenceExpr *var = assign->varExp;
+
+  if (var->upvalueFlag || (var->index & REGISTER_TEMP))
+    return false;
+
+  if (assign->op.type == TOKEN_EQUAL) {
+    if (assign->opCode != OP_FALSE || !isRegisterExpr(assign->value))
+      return false;
+
+    emitInto(assign->value, var->index);
+    return true;
+  }
+
+  OpCode opCode = registerOp(assign->opCode);
+
+  if (opCode == OP_FALSE)
+    return false;
+
+  if (assign->value == NULL || assign->value->type == EXPR_LITERAL) {
+    LiteralExpr *literal = (LiteralExpr *) assign->value;
+
+    if (literal && !isOperand(literal))
+      return false;
+
+    Value value = literal ? VALUE(literal->type, literal->as) : INT_VAL(1);
+
+    generator.emitBytes(constantOp(opCode), var->index);
+    generator.emitBytes(var->index, generator.makeConstant(value, literal ? literal->type : VAL_INT));
+    return true;
+  }
+
+  if (!isRegisterExpr(assign->value))
+    return false;
+
+  uint8_t b = emitOperand(assign->value);
+
+  generator.emitBytes(opCode, var->index);
+  generator.emitBytes(var->index, b);
+  return true;
+}
+
+bool RegisterGenerator::emitValue(Expr *expr) {
+  if (expr->type != EXPR_BINARY || !isRegisterExpr(expr))
+    return false;
+
+  uint8_t temp = newTemp();
+
+  emitInto(expr, temp);
+  generator.emitBytes(OP_R_PUSH, temp);
+  return true;
+}
+
+// Returns the offset to patch, or -1 if the condition needs the stack
+int RegisterGenerator::emitJumpIfFalse(Expr *condition) {
+  uint8_t source;
+
+  if (condition->type == EXPR_REFERENCE && isOperand(condition))
+    source = ((ReferenceExpr *) condition)->index;
+  else if (condition->type == EXPR_BINARY && isRegisterExpr(condition)) {
+    source = newTemp();
+    emitInto(condition, source);
+  }
+  else
+    return -1;
+
+  generator.emitBytes(OP_R_JUMP_IF_FALSE, source);
+  generator.emitBytes(0xff, 0xff);
+  return generator.currentChunk()->count - 2;
+}
@@ -0,0 +1,33 @@
+/*
+ * The QED Programming Language
+ * Copyright (C) 2022-2023  Hocus Codus Software inc.
+ *
+ * All rights reserved.
+ */
+#ifndef qed_regcodegen_h
+#define qed_regcodegen_h
+
+#include "codegen.hpp"
+
+extern bool registerFlag;
+
+// Emits three-address register code for the arithmetic parts of a function
+// whose operands are locals or constants; CodeGenerator keeps the rest
+class RegisterGenerator {
+  CodeGenerator &generator;
+  int tempCount;
+
+  uint8_t newTemp();
+  bool isOperand(Expr *expr);
+  bool isRegisterExpr(Expr *expr, int depth = 0);
+  uint8_t emitOperand(Expr *expr);
+  void emitInto(Expr *expr, uint8_t dest);
+public:
+  RegisterGenerator(CodeGenerator &codeGenerator);
+
+  bool emitStatement(Expr *expr);
+  bool emitValue(Expr *expr);
+  int emitJumpIfFalse(Expr *condition);
+};
+
+#endif
@@ -6,10 +6,18 @@
  */
 
 #include <stack>
+#include <string.h>
+#include <unordered_map>
+#include <vector>
 #include "reifier.hpp"
 #include "object.hpp"
 #include "memory.h"
 
+// largest function body, in expression nodes, substituted for its calls
+#define INLINE_MAX_SIZE 16
+
+bool inlineFlag = true;
+
 typedef struct {
   Compiler *compiler;
   int localStart;
@@ -17,16 +25,452 @@ typedef struct {
 
 static std::stack<ReinferData> reinferStack;
 
+// never-assigned locals initialized with a literal
+static std::unordered_map<Declaration *, LiteralExpr *> constants;
+
+// never-assigned locals initialized with an array literal, with its length,
+// which arrays never go under
+static std::unordered_map<Declaration *, int> arrayLengths;
+
+// A loop running while (index < array.length), that only increments its
+// index at the end of its body. Array accesses of the body with this index
+// keep in range unless something else writes the index or the array
+typedef struct {
+  Declaration *index;
+  Declaration *array;
+  AssignExpr *increment;
+  bool fieldFlag; // calls may write fields
+  bool validFlag;
+  std::vector<ArrayElementExpr *> accesses;
+} RangeData;
+
+static std::vector<RangeData> ranges;
+
 ReinferData *top() {
   return reinferStack.empty() ? NULL : &reinferStack.top();
 }
 
+static bool isLiteral(Expr *expr, ValueType type) {
+  return expr != NULL && expr->type == EXPR_LITERAL && ((LiteralExpr *) expr)->type == type;
+}
+
+#define LITERAL_AS(expr) (((LiteralExpr *) (expr))->as)
+
+static Expr *boolLiteral(bool value) {
+  As as;
+
+  as.boolean = value;
+  return new LiteralExpr(VAL_BOOL, as);
+}
+
+static Expr *intLiteral(long value) {
+  As as;
+
+  as.integer = value;
+  return new LiteralExpr(VAL_INT, as);
+}
+
+static Expr *floatLiteral(double value) {
+  As as;
+
+  as.floating = value;
+  return new LiteralExpr(VAL_FLOAT, as);
+}
+
+static Expr *stringLiteral(ObjString *string) {
+  As as;
+
+  as.obj = &string->obj;
+  return new LiteralExpr(VAL_OBJ, as);
+}
+
+static ObjString *literalString(Expr *expr) {
+  return isLiteral(expr, VAL_OBJ) && LITERAL_AS(expr).obj->type == OBJ_STRING ? (ObjString *) LITERAL_AS(expr).obj : NULL;
+}
+
+static Declaration *referenceDeclaration(Expr *expr) {
+  ReferenceExpr *refExpr = (ReferenceExpr *) expr;
+
+  return expr != NULL && expr->type == EXPR_REFERENCE && refExpr->_compiler && !refExpr->upvalueFlag ? &refExpr->_compiler->getDeclaration(refExpr->index) : NULL;
+}
+
+static Expr *unwrapStatement(Expr *expr) {
+  while (expr->type == EXPR_STATEMENT)
+    expr = ((StatementExpr *) expr)->expr;
+
+  if (expr->type == EXPR_OPCODE && ((OpcodeExpr *) expr)->op == OP_POP)
+    expr = ((OpcodeExpr *) expr)->right;
+
+  return expr;
+}
+
+// an int declared with a non-negative literal
+static Declaration *getCounter(Expr *expr) {
+  ListExpr *listExpr = (ListExpr *) (expr = unwrapStatement(expr));
+
+  if (expr->type != EXPR_LIST || listExpr->listType != EXPR_ASSIGN || !listExpr->_compiler)
+    return NULL;
+
+  Declaration *dec = &listExpr->_compiler->getDeclaration(listExpr->_index);
+  Expr *value = ((AssignExpr *) listExpr->expressions[listExpr->count - 1])->value;
+
+  return IS_INT(dec->type) && isLiteral(value, VAL_INT) && LITERAL_AS(value).integer >= 0 ? dec : NULL;
+}
+
+// the index++ ending a loop body
+static AssignExpr *getIncrement(Expr *body, Declaration *index) {
+  if ((body = unwrapStatement(body))->type == EXPR_GROUPING) {
+    GroupingExpr *group = (GroupingExpr *) body;
+
+    if (!group->count)
+      return NULL;
+
+    body = group->expressions[group->count - 1];
+  }
+
+  AssignExpr *assignExpr = (AssignExpr *) (body = unwrapStatement(body));
+
+  return body->type == EXPR_ASSIGN && !assignExpr->value && assignExpr->op.type == TOKEN_PLUS_PLUS &&
+         referenceDeclaration(assignExpr->varExp) == index ? assignExpr : NULL;
+}
+
+// what is left of a dropped statement
+static Expr *emptyExpr() {
+  return new ListExpr(0, NULL, EXPR_LIST);
+}
+
+// an expression that can be evaluated any number of times, or not at all
+static bool isPure(Expr *expr) {
+  switch (expr->type) {
+  case EXPR_LITERAL:
+  case EXPR_REFERENCE:
+    return true;
+
+  case EXPR_BINARY: {
+    BinaryExpr *binaryExpr = (BinaryExpr *) expr;
+
+    return binaryExpr->op.type != TOKEN_WHILE && binaryExpr->right && isPure(binaryExpr->left) && isPure(binaryExpr->right);
+  }
+  case EXPR_UNARY: {
+    UnaryExpr *unaryExpr = (UnaryExpr *) expr;
+
+    return (unaryExpr->op.type == TOKEN_BANG || unaryExpr->op.type == TOKEN_PERCENT) && isPure(unaryExpr->right);
+  }
+  case EXPR_OPCODE: {
+    OpcodeExpr *opcodeExpr = (OpcodeExpr *) expr;
+
+    return opcodeExpr->op != OP_POP && opcodeExpr->right && isPure(opcodeExpr->right);
+  }
+  case EXPR_LOGICAL:
+    return isPure(((LogicalExpr *) expr)->left) && isPure(((LogicalExpr *) expr)->right);
+
+  default:
+    return false;
+  }
+}
+
+typedef struct {
+  Compiler *compiler; // the callee's, whose parameters are slots 1..arity
+  int arity;
+  Expr **arguments;
+  int size;
+  int lastImpure;
+  int impureCount;
+} InlineData;
+
+// Checks that an inlined body evaluates each impure argument exactly once,
+// in order, and returns false if the body is too big or too complex
+static bool canInline(Expr *expr, InlineData &data, bool conditional) {
+  if (++data.size > INLINE_MAX_SIZE)
+    return false;
+
+  switch (expr->type) {
+  case EXPR_LITERAL:
+    return true;
+
+  case EXPR_REFERENCE: {
+    ReferenceExpr *refExpr = (ReferenceExpr *) expr;
+
+    if (refExpr->upvalueFlag || refExpr->_compiler != data.compiler || refExpr->index < 1 || refExpr->index > data.arity)
+      return false;
+
+    if (isPure(data.arguments[refExpr->index - 1]))
+      return true;
+
+    if (conditional || refExpr->index <= data.lastImpure)
+      return false;
+
+    data.lastImpure = refExpr->index;
+    data.impureCount++;
+    return true;
+  }
+  case EXPR_BINARY: {
+    BinaryExpr *binaryExpr = (BinaryExpr *) expr;
+
+    return binaryExpr->op.type != TOKEN_WHILE && binaryExpr->right &&
+           canInline(binaryExpr->left, data, conditional) && canInline(binaryExpr->right, data, conditional);
+  }
+  case EXPR_UNARY: {
+    UnaryExpr *unaryExpr = (UnaryExpr *) expr;
+
+    return (unaryExpr->op.type == TOKEN_BANG || unaryExpr->op.type == TOKEN_PERCENT) && canInline(unaryExpr->right, data, conditional);
+  }
+  case EXPR_OPCODE: {
+    OpcodeExpr *opcodeExpr = (OpcodeExpr *) expr;
+
+    return opcodeExpr->op != OP_POP && opcodeExpr->right && canInline(opcodeExpr->right, data, conditional);
+  }
+  case EXPR_LOGICAL:
+    return canInline(((LogicalExpr *) expr)->left, data, conditional) && canInline(((LogicalExpr *) expr)->right, data, true);
+
+  case EXPR_TERNARY: {
+    TernaryExpr *ternaryExpr = (TernaryExpr *) expr;
+
+    return ternaryExpr->op.type != TOKEN_IF && ternaryExpr->right && canInline(ternaryExpr->left, data, conditional) &&
+           canInline(ternaryExpr->middle, data, true) && canInline(ternaryExpr->right, data, true);
+  }
+  default:
+    return false;
+  }
+}
+
+// A copy of an inlinable body with the arguments in place of the parameters
+static Expr *substitute(Expr *expr, InlineData &data) {
+  switch (expr->type) {
+  case EXPR_REFERENCE:
+    return data.arguments[((ReferenceExpr *) expr)->index - 1];
+
+  case EXPR_BINARY: {
+    BinaryExpr *binaryExpr = new BinaryExpr(*(BinaryExpr *) expr);
+
+    binaryExpr->left = substitute(binaryExpr->left, data);
+    binaryExpr->right = substitute(binaryExpr->right, data);
+    return binaryExpr;
+  }
+  case EXPR_UNARY: {
+    UnaryExpr *unaryExpr = new UnaryExpr(*(UnaryExpr *) expr);
+
+    unaryExpr->right = substitute(unaryExpr->right, data);
+    return unaryExpr;
+  }
+  case EXPR_OPCODE: {
+    OpcodeExpr *opcodeExpr = new OpcodeExpr(*(OpcodeExpr *) expr);
+
+    opcodeExpr->right = substitute(opcodeExpr->right, data);
+    return opcodeExpr;
+  }
+  case EXPR_LOGICAL: {
+    LogicalExpr *logicalExpr = new LogicalExpr(*(LogicalExpr *) expr);
+
+    logicalExpr->left = substitute(logicalExpr->left, data);
+    logicalExpr->right = substitute(logicalExpr->right, data);
+    return logicalExpr;
+  }
+  case EXPR_TERNARY: {
+    TernaryExpr *ternaryExpr = new TernaryExpr(*(TernaryExpr *) expr);
+
+    ternaryExpr->left = substitute(ternaryExpr->left, data);
+    ternaryExpr->middle = substitute(ternaryExpr->middle, data);
+    ternaryExpr->right = substitute(ternaryExpr->right, data);
+    return ternaryExpr;
+  }
+  default:
+    return expr;
+  }
+}
+
 Reifier::Reifier(Parser &parser) : ExprVisitor(), parser(parser) {
+  folded = NULL;
+  counter = NULL;
+  foldCount = 0;
+  propagateCount = 0;
+  branchCount = 0;
+  inlineCount = 0;
+  elideCount = 0;
+}
+
+// Reifies a subexpression and returns what should replace it
+Expr *Reifier::fold(Expr *expr) {
+  if (expr == NULL)
+    return NULL;
+
+  Expr *oldFolded = folded;
+
+  folded = expr;
+  expr->accept(this);
+  expr = folded;
+  folded = oldFolded;
+  return expr;
+}
+
+// The conversions the resolver inserted, applied to a literal
+Expr *Reifier::foldOpcode(OpcodeExpr *expr) {
+  Expr *right = expr->right;
+
+  switch (expr->op) {
+  case OP_INT_TO_FLOAT:
+    return isLiteral(right, VAL_INT) ? floatLiteral((double) LITERAL_AS(right).integer) : NULL;
+
+  case OP_FLOAT_TO_INT:
+    return isLiteral(right, VAL_FLOAT) ? intLiteral((long) LITERAL_AS(right).floating) : NULL;
+
+  case OP_INT_TO_STRING:
+    return isLiteral(right, VAL_INT) ? stringLiteral(intToString(LITERAL_AS(right).integer)) : NULL;
+
+  case OP_FLOAT_TO_STRING:
+    return isLiteral(right, VAL_FLOAT) ? stringLiteral(floatToString(LITERAL_AS(right).floating)) : NULL;
+
+  case OP_NEGATE_INT:
+    return isLiteral(right, VAL_INT) ? intLiteral(-LITERAL_AS(right).integer) : NULL;
+
+  case OP_NEGATE_FLOAT:
+    return isLiteral(right, VAL_FLOAT) ? floatLiteral(-LITERAL_AS(right).floating) : NULL;
+
+  case OP_BOOL_TO_STRING: {
+    if (!isLiteral(right, VAL_BOOL))
+      return NULL;
+
+    const char *buffer = LITERAL_AS(right).boolean ? "true" : "false";
+
+    return stringLiteral(copyString(buffer, strlen(buffer)));
+  }
+  default:
+    return NULL;
+  }
+}
+
+// A binary operation on two literals, evaluated the way the VM would
+Expr *Reifier::foldBinary(BinaryExpr *expr) {
+  Expr *left = expr->left;
+  Expr *right = expr->right;
+
+  if (left->type != EXPR_LITERAL || right == NULL || right->type != EXPR_LITERAL)
+    return NULL;
+
+  As a = LITERAL_AS(left);
+  As b = LITERAL_AS(right);
+  Expr *result = NULL;
+
+  switch (expr->opCode) {
+  case OP_ADD_INT: result = intLiteral((long) ((unsigned long) a.integer + b.integer)); break;
+  case OP_SUBTRACT_INT: result = intLiteral((long) ((unsigned long) a.integer - b.integer)); break;
+  case OP_MULTIPLY_INT: result = intLiteral((long) ((unsigned long) a.integer * b.integer)); break;
+  case OP_DIVIDE_INT: result = b.integer ? intLiteral(a.integer / b.integer) : NULL; break;
+  case OP_ADD_FLOAT: result = floatLiteral(a.floating + b.floating); break;
+  case OP_SUBTRACT_FLOAT: result = floatLiteral(a.floating - b.floating); break;
+  case OP_MULTIPLY_FLOAT: result = floatLiteral(a.floating * b.floating); break;
+  case OP_DIVIDE_FLOAT: result = floatLiteral(a.floating / b.floating); break;
+  case OP_EQUAL_INT: result = boolLiteral(a.integer == b.integer); break;
+  case OP_GREATER_INT: result = boolLiteral(a.integer > b.integer); break;
+  case OP_LESS_INT: result = boolLiteral(a.integer < b.integer); break;
+  case OP_EQUAL_FLOAT: result = boolLiteral(floatsEqual(a.floating, b.floating)); break;
+  case OP_GREATER_FLOAT: result = boolLiteral(a.floating > b.floating); break;
+  case OP_LESS_FLOAT: result = boolLiteral(a.floating < b.floating); break;
+  case OP_BITWISE_OR: result = intLiteral(a.integer | b.integer); break;
+  case OP_BITWISE_AND: result = intLiteral(a.integer & b.integer); break;
+  case OP_BITWISE_XOR: result = intLiteral(a.integer ^ b.integer); break;
+  case OP_LOGICAL_OR: result = boolLiteral(a.boolean || b.boolean); break;
+  case OP_LOGICAL_AND: result = boolLiteral(a.boolean && b.boolean); break;
+  case OP_SHIFT_LEFT:
+  case OP_SHIFT_RIGHT:
+  case OP_SHIFT_URIGHT:
+    if (b.integer < 0 || b.integer >= 64)
+      break;
+
+    result = intLiteral(expr->opCode == OP_SHIFT_LEFT ? (long) ((unsigned long) a.integer << b.integer) :
+#ifdef __EMSCRIPTEN__
+                        a.integer >> b.integer);
+#else
+                        expr->opCode == OP_SHIFT_RIGHT ? a.integer >> b.integer : (long) ((unsigned long) a.integer >> b.integer));
+#endif
+    break;
+
+  case OP_ADD_STRING: {
+    ObjString *aString = literalString(left);
+    ObjString *bString = literalString(right);
+
+    if (aString && bString) {
+      int length = aString->length + bString->length;
+      char *chars = ALLOCATE(char, length + 1);
+
+      memcpy(chars, aString->chars, aString->length);
+      memcpy(chars + aString->length, bString->chars, bString->length);
+      chars[length] = '\0';
+      result = stringLiteral(takeString(chars, length));
+    }
+    break;
+  }
+  case OP_EQUAL_STRING: {
+    ObjString *aString = literalString(left);
+    ObjString *bString = literalString(right);
+
+    if (aString && bString)
+      result = boolLiteral(aString == bString); // interned
+    break;
+  }
+  default:
+    break;
+  }
+
+  if (result && expr->notFlag)
+    LITERAL_AS(result).boolean = !LITERAL_AS(result).boolean;
+
+  return result;
+}
+
+// The body of a small function called by name, in place of the call.
+// Only plain functions qualify: no class (coroutine), no UI, no upvalues
+// and a body that is a single return of an expression without calls, so
+// no frame or captured variable can be observed missing.
+Expr *Reifier::inlineCall(CallExpr *expr) {
+  ObjFunction *function = expr->_function;
+
+  if (!function || expr->newFlag || function->native || function->isClass() || function->uiFunction ||
+      function->upvalueCount || function->arity != expr->count || expr->callee->type != EXPR_REFERENCE)
+    return NULL;
+
+  Expr *body = function->bodyExpr;
+  Expr *returnExpr = body && body->type == EXPR_GROUPING && ((GroupingExpr *) body)->count == 1 ? ((GroupingExpr *) body)->expressions[0] : NULL;
+
+  if (returnExpr && returnExpr->type == EXPR_STATEMENT)
+    returnExpr = ((StatementExpr *) returnExpr)->expr;
+
+  if (!returnExpr || returnExpr->type != EXPR_RETURN || !((ReturnExpr *) returnExpr)->value)
+    return NULL;
+
+  Expr *value = ((ReturnExpr *) returnExpr)->value;
+  InlineData data = {&((GroupingExpr *) body)->_compiler, function->arity, expr->arguments, 0, 0, 0};
+
+  if (!canInline(value, data, false))
+    return NULL;
+
+  // an impure argument the body never reads must still be evaluated
+  int impureCount = 0;
+
+  for (int index = 0; index < expr->count; index++)
+    impureCount += !isPure(expr->arguments[index]);
+
+  if (data.impureCount != impureCount)
+    return NULL;
+
+  // the body may read the other arguments after the side effects, so they
+  // must not read variables at all
+  if (impureCount)
+    for (int index = 0; index < expr->count; index++)
+      if (isPure(expr->arguments[index]) && expr->arguments[index]->type != EXPR_LITERAL)
+        return NULL;
+
+  return substitute(value, data);
 }
 
 void Reifier::visitAssignExpr(AssignExpr *expr) {
-  if (expr->value)
-    expr->value->accept(this);
+  expr->value = fold(expr->value);
+
+  Declaration *dec = referenceDeclaration(expr->varExp);
+
+  for (RangeData &range : ranges)
+    if (expr != range.increment && (dec ? dec == range.index || dec == range.array : range.fieldFlag))
+      range.validFlag = false;
 }
 
 void Reifier::visitUIAttributeExpr(UIAttributeExpr *expr) {
@@ -36,53 +480,119 @@ void Reifier::visitUIDirectiveExpr(UIDirectiveExpr *expr) {
 }
 
 void Reifier::visitBinaryExpr(BinaryExpr *expr) {
-  expr->left->accept(this);
-  expr->right->accept(this);
+  bool rangeFlag = expr->op.type == TOKEN_WHILE && beginRange(expr);
+
+  expr->left = fold(expr->left);
+  expr->right = fold(expr->right);
+
+  if (expr->op.type == TOKEN_WHILE) {
+    if (rangeFlag)
+      endRange();
+
+    if (isLiteral(expr->left, VAL_BOOL) && !LITERAL_AS(expr->left).boolean) {
+      folded = emptyExpr();
+      branchCount++;
+    }
+    return;
+  }
+
+  Expr *result = foldBinary(expr);
+
+  if (result) {
+    folded = result;
+    foldCount++;
+  }
 }
 
 void Reifier::visitCallExpr(CallExpr *expr) {
-  expr->callee->accept(this);
+  fold(expr->callee);
   for (int index = 0; index < expr->count; index++) {
-    expr->arguments[index]->accept(this);
+    expr->arguments[index] = fold(expr->arguments[index]);
+  }
+
+  Expr *result = inlineFlag ? inlineCall(expr) : NULL;
+
+  if (result) {
+    folded = fold(result);
+    inlineCount++;
   }
+  else
+    invalidateFieldRanges();
 }
 
 void Reifier::visitArrayElementExpr(ArrayElementExpr *expr) {
-  expr->callee->accept(this);
+  fold(expr->callee);
   for (int index = 0; index < expr->count; index++) {
-    expr->indexes[index]->accept(this);
+    expr->indexes[index] = fold(expr->indexes[index]);
+  }
+
+  Declaration *array = expr->count == 1 ? referenceDeclaration(expr->callee) : NULL;
+
+  if (array == NULL)
+    return;
+
+  Expr *indexExpr = expr->indexes[0];
+
+  if (isLiteral(indexExpr, VAL_INT)) {
+    auto length = arrayLengths.find(array);
+    long index = LITERAL_AS(indexExpr).integer;
+
+    if (length != arrayLengths.end() && index >= 0 && index < length->second) {
+      expr->_uncheckedFlag = true;
+      elideCount++;
+    }
+    return;
+  }
+
+  Declaration *index = referenceDeclaration(indexExpr);
+
+  for (int rangeIndex = ranges.size() - 1; rangeIndex >= 0; rangeIndex--) {
+    RangeData &range = ranges[rangeIndex];
+
+    if (range.validFlag && range.index == index && range.array == array) {
+      expr->_uncheckedFlag = true;
+      range.accesses.push_back(expr);
+      return;
+    }
   }
 }
 
 void Reifier::visitDeclarationExpr(DeclarationExpr *expr) {
-  accept<int>(expr->initExpr, 0);
+  expr->initExpr = fold(expr->initExpr);
 }
 
 void Reifier::visitFunctionExpr(FunctionExpr *expr) {
-  accept<int>(expr->body, 0);
+  expr->body = fold(expr->body);
 }
 
 void Reifier::visitGetExpr(GetExpr *expr) {
-  expr->object->accept(this);
+  fold(expr->object);
 }
 
 void Reifier::visitGroupingExpr(GroupingExpr *expr) {
   reinferStack.push({&expr->_compiler, expr->_compiler.inBlock() ? top()->localStart : 0});
 
-  for (int index = 0; index < expr->count; index++)
-    expr->expressions[index]->accept(this);
+  for (int index = 0; index < expr->count; index++) {
+    Expr *subExpr = expr->expressions[index];
+
+    // a loop right after the declaration of its index
+    counter = index && subExpr->type == EXPR_BINARY && ((BinaryExpr *) subExpr)->op.type == TOKEN_WHILE ? getCounter(expr->expressions[index - 1]) : NULL;
+    expr->expressions[index] = fold(expr->expressions[index]);
+  }
 
+  // the generated UI functions
+  fold(expr->ui);
   reinferStack.pop();
 }
 
 void Reifier::visitArrayExpr(ArrayExpr *expr) {
   for (int index = 0; index < expr->count; index++) {
-    expr->expressions[index]->accept(this);
+    expr->expressions[index] = fold(expr->expressions[index]);
   }
 }
 
 void Reifier::visitListExpr(ListExpr *expr) {
-  Declaration *dec = expr->_declaration;
+  Declaration *dec = expr->_compiler ? &expr->_compiler->getDeclaration(expr->_index) : NULL;
 
   if (dec) {
     dec->realIndex = dec->isField ? top()->compiler->fieldCount++ : top()->localStart++;
@@ -104,7 +614,16 @@ void Reifier::visitListExpr(ListExpr *expr) {
   }
 
   for (int index = 0; index < expr->count; index++) {
-    expr->expressions[index]->accept(this);
+    expr->expressions[index] = fold(expr->expressions[index]);
+  }
+
+  if (dec && expr->listType == EXPR_ASSIGN && !dec->isField && !dec->isAssigned) {
+    AssignExpr *subExpr = (AssignExpr *) expr->expressions[expr->count - 1];
+
+    if (subExpr->value && subExpr->value->type == EXPR_LITERAL)
+      constants[dec] = (LiteralExpr *) subExpr->value;
+    else if (subExpr->value && subExpr->value->type == EXPR_ARRAY)
+      arrayLengths[dec] = ((ArrayExpr *) subExpr->value)->count;
   }
 }
 
@@ -112,38 +631,97 @@ void Reifier::visitLiteralExpr(LiteralExpr *expr) {
 }
 
 void Reifier::visitLogicalExpr(LogicalExpr *expr) {
-  expr->left->accept(this);
-  expr->right->accept(this);
+  expr->left = fold(expr->left);
+  expr->right = fold(expr->right);
+
+  // the right operand is only evaluated when the left one does not decide
+  if (isLiteral(expr->left, VAL_BOOL)) {
+    bool value = LITERAL_AS(expr->left).boolean;
+
+    folded = value == (expr->op.type == TOKEN_OR_OR) ? expr->left : expr->right;
+    foldCount++;
+  }
 }
 
 void Reifier::visitOpcodeExpr(OpcodeExpr *expr) {
-  if (expr->right)
-    expr->right->accept(this);
+  expr->right = fold(expr->right);
+
+  Expr *result = expr->right ? foldOpcode(expr) : NULL;
+
+  if (result) {
+    folded = result;
+    foldCount++;
+  }
 }
 
 void Reifier::visitReturnExpr(ReturnExpr *expr) {
-  if (expr->value != NULL)
-    accept<int>(expr->value, 0);
+  expr->value = fold(expr->value);
 }
 
 void Reifier::visitSetExpr(SetExpr *expr) {
-  expr->object->accept(this);
-  expr->value->accept(this);
+  fold(expr->object);
+  expr->value = fold(expr->value);
+
+  if (expr->object->type != EXPR_ARRAYELEMENT)
+    invalidateFieldRanges();
+}
+
+bool Reifier::beginRange(BinaryExpr *expr) {
+  Declaration *index = counter;
+  BinaryExpr *condition = (BinaryExpr *) expr->left;
+
+  counter = NULL;
+  if (index == NULL || condition->type != EXPR_BINARY || condition->op.type != TOKEN_LESS ||
+      referenceDeclaration(condition->left) != index || condition->right->type != EXPR_GET)
+    return false;
+
+  GetExpr *getExpr = (GetExpr *) condition->right;
+  Declaration *array = getExpr->index == ARRAY_LENGTH_INDEX ? referenceDeclaration(getExpr->object) : NULL;
+  AssignExpr *increment = getIncrement(expr->right, index);
+
+  if (array == NULL || increment == NULL)
+    return false;
+
+  ranges.push_back({index, array, increment, index->isField || array->isField, true, {}});
+  return true;
+}
+
+void Reifier::endRange() {
+  RangeData &range = ranges.back();
+
+  for (ArrayElementExpr *access : range.accesses)
+    if (range.validFlag)
+      elideCount++;
+    else
+      access->_uncheckedFlag = false;
+
+  ranges.pop_back();
+}
+
+void Reifier::invalidateFieldRanges() {
+  for (RangeData &range : ranges)
+    if (range.fieldFlag)
+      range.validFlag = false;
 }
 
 void Reifier::visitStatementExpr(StatementExpr *expr) {
-  expr->expr->accept(this);
+  expr->expr = fold(expr->expr);
 }
 
 void Reifier::visitSuperExpr(SuperExpr *expr) {
 }
 
 void Reifier::visitTernaryExpr(TernaryExpr *expr) {
-  expr->left->accept(this);
-  expr->middle->accept(this);
+  expr->left = fold(expr->left);
+  expr->middle = fold(expr->middle);
+  expr->right = fold(expr->right);
+
+  if (isLiteral(expr->left, VAL_BOOL)) {
+    Expr *branch = LITERAL_AS(expr->left).boolean ? expr->middle : expr->right;
 
-  if (expr->right)
-    expr->right->accept(this);
+    folded = branch ? branch : emptyExpr();
+    branchCount++;
+  }
 }
 
 void Reifier::visitThisExpr(ThisExpr *expr) {
@@ -153,16 +731,54 @@ void Reifier::visitTypeExpr(TypeExpr *expr) {
 }
 
 void Reifier::visitUnaryExpr(UnaryExpr *expr) {
-  expr->right->accept(this);
+  expr->right = fold(expr->right);
+
+  Expr *result = NULL;
+
+  switch (expr->op.type) {
+  case TOKEN_BANG:
+    result = isLiteral(expr->right, VAL_BOOL) ? boolLiteral(!LITERAL_AS(expr->right).boolean) : NULL;
+    break;
+
+  case TOKEN_PERCENT:
+    result = isLiteral(expr->right, VAL_FLOAT) ? floatLiteral(LITERAL_AS(expr->right).floating / 100) : NULL;
+    break;
+
+  case TOKEN_MINUS:
+    result = expr->right->type == EXPR_LITERAL ? expr->right : NULL;
+    break;
+
+  default:
+    break;
+  }
+
+  if (result) {
+    folded = result;
+    foldCount++;
+  }
 }
 
 void Reifier::visitReferenceExpr(ReferenceExpr *expr) {
+  if (expr->_compiler && !expr->upvalueFlag) {
+    auto constant = constants.find(&expr->_compiler->getDeclaration(expr->index));
+
+    if (constant != constants.end()) {
+      folded = constant->second;
+      propagateCount++;
+    }
+  }
 }
 
 void Reifier::visitSwapExpr(SwapExpr *expr) {
+  expr->_expr = fold(expr->_expr);
 }
 
 bool Reifier::reify() {
-  accept(parser.expr, 0);
+  constants.clear();
+  arrayLengths.clear();
+  fold(parser.expr);
+#ifdef DEBUG_PRINT_CODE
+  printf("Folded %d constant expressions, %d local references, %d branches, inlined %d calls, elided %d bounds checks\n", foldCount, propagateCount, branchCount, inlineCount, elideCount);
+#endif
   return !parser.hadError;
 }
@@ -9,11 +9,28 @@
 
 #include "parser.hpp"
 
+extern bool inlineFlag;
+
 /*
  * The palindrome class...
  */
 class Reifier : public ExprVisitor {
   Parser &parser;
+  Expr *folded;
+  Declaration *counter;
+  int foldCount;
+  int propagateCount;
+  int branchCount;
+  int inlineCount;
+  int elideCount;
+
+  Expr *fold(Expr *expr);
+  Expr *foldOpcode(OpcodeExpr *expr);
+  Expr *foldBinary(BinaryExpr *expr);
+  Expr *inlineCall(CallExpr *expr);
+  bool beginRange(BinaryExpr *expr);
+  void endRange();
+  void invalidateFieldRanges();
 public:
   Reifier(Parser &parser);
 
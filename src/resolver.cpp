@@ -11,6 +11,7 @@
 #include <sstream>
 #include "resolver.hpp"
 #include "memory.h"
+#include "arena.hpp"
 #include "qni.hpp"
 
 typedef void (Resolver::*DirectiveFn)(UIDirectiveExpr *expr);
@@ -27,16 +28,21 @@ extern ParseExpRule expRules[];
 #endif
 */
 
-static Obj objInternalType = {OBJ_INTERNAL};
+static ObjInternal objInternalType = {{OBJ_INTERNAL, NULL, false, false, false, 0}, NULL}; // the collector reads it as an internal
 static Obj *primitives[] = {
   &newPrimitive("void", {VAL_VOID})->obj,
   &newPrimitive("bool", {VAL_BOOL})->obj,
   &newPrimitive("int", {VAL_INT})->obj,
   &newPrimitive("float", {VAL_FLOAT})->obj,
   &newPrimitive("String", stringType)->obj,
-  &newPrimitive("var", {VAL_OBJ, &objInternalType})->obj,
+  &newPrimitive("var", {VAL_OBJ, &objInternalType.obj})->obj,
 };
 
+void markPrimitives() {
+  for (int index = 0; index < (int) (sizeof(primitives) / sizeof(primitives[0])); index++)
+    markObject(primitives[index]);
+}
+
 static bool isType(Type &type) {
   switch (AS_OBJ_TYPE(type)) {
   case OBJ_FUNCTION: {
@@ -45,10 +51,14 @@ static bool isType(Type &type) {
     return name != NULL && name->chars[0] >= 'A' && name->chars[0] <= 'Z';
   }
 
-  case OBJ_ARRAY:
   case OBJ_PRIMITIVE:
   case OBJ_FUNCTION_PTR:
     return true;
+
+  case OBJ_STRING:
+  case OBJ_ROPE:
+  case OBJ_SLICE:
+    break;
   }
 
   return false;
@@ -131,9 +141,20 @@ static Expr *convertToFloat(Expr *expr, Type &type, Parser &parser) {
 
 static Expr *convertToObj(Obj *srcObjType, Expr *expr, Type &type, Parser &parser) {
   switch (srcObjType->type) {
-  case OBJ_ARRAY:
-//    expr = convertToArray(OP_BOOL_TO_STRING, expr);
+  case OBJ_ARRAY: {
+    ObjArray *array = (ObjArray *) srcObjType;
+
+    // an empty literal takes the element type of the array it is stored into
+    if (expr->type == EXPR_ARRAY && !((ArrayExpr *) expr)->count && IS_ARRAY(type)) {
+      ObjArray *target = IS_VOID(array->elementType) ? AS_ARRAY_TYPE(type) : array;
+      ArrayExpr *arrayExpr = (ArrayExpr *) expr;
+
+      arrayExpr->_elementType = target->elementType;
+    }
+    else
+      expr = NULL;
     break;
+  }
 /*
   OBJ_CLOSURE
   OBJ_FUNCTION
@@ -263,6 +284,9 @@ void Resolver::visitAssignExpr(AssignExpr *expr) {
 
   accept<int>(expr->varExp, 0);
 
+  if (expr->varExp->_compiler)
+    expr->varExp->_compiler->getDeclaration(expr->varExp->index).isAssigned = true;
+
   Type type1 = removeDeclaration();
   Type type2 = expr->value ? removeDeclaration() : type1;
 
@@ -490,8 +514,8 @@ void Resolver::visitBinaryExpr(BinaryExpr *expr) {
 
 static Expr *generateUIFunction(const char *type, const char *name, char *args, Expr *uiExpr, int count, int restLength, Expr **rest) {
     ReferenceExpr *nameExpr = new ReferenceExpr(buildToken(TOKEN_IDENTIFIER, name, strlen(name), -1), -1, false);
-    Expr **bodyExprs = new Expr *[count + restLength];
-    Expr **functionExprs = new Expr *[3];
+    Expr **bodyExprs = ARENA_ARRAY(Expr *, count + restLength);
+    Expr **functionExprs = ARENA_ARRAY(Expr *, 3);
     int nbParms = 0;
     Expr **parms = NULL;
 
@@ -503,7 +527,7 @@ static Expr *generateUIFunction(const char *type, const char *name, char *args,
       do {
         Expr *expr = parser.expression(tokens);
 
-        parms = RESIZE_ARRAY(Expr *, parms, nbParms, nbParms + 1);
+        parms = ARENA_RESIZE(Expr *, parms, nbParms, nbParms + 1);
         parms[nbParms++] = expr;
       } while (parser.match(TOKEN_COMMA));
 
@@ -566,8 +590,13 @@ void Resolver::visitCallExpr(CallExpr *expr) {
 
       getCurrent()->addDeclaration((Type) {VAL_OBJ, &newInstance(callable)->obj});
     }
-    else
+    else {
+      if (callable->arity != expr->count)
+        parser.error("Expected %d arguments but got %d.", callable->arity, expr->count);
+
+      expr->_function = (ObjFunction *) callable;
       getCurrent()->addDeclaration(callable->type);
+    }
     break;
   }
   case OBJ_FUNCTION_PTR: {
@@ -603,13 +632,15 @@ void Resolver::visitArrayElementExpr(ArrayElementExpr *expr) {
 
   Type type = removeDeclaration();
 
+  expr->_uncheckedFlag = false;
+
   if (!expr->count)
     if (isType(type)) {
       Type returnType = convertType(type);
       ObjArray *array = newArray();
 
       array->elementType = returnType;
-      getCurrent()->addDeclaration({VAL_OBJ, &array->obj});
+      getCurrent()->addDeclaration({VAL_OBJ, &newPrimitive((char *) array->obj.toString(), {VAL_OBJ, &array->obj})->obj});
     }
     else {
       parser.error("No index defined.");
@@ -625,15 +656,8 @@ void Resolver::visitArrayElementExpr(ArrayElementExpr *expr) {
       case OBJ_ARRAY: {
         ObjArray *array = AS_ARRAY_TYPE(type);
 
+        resolveArrayIndex(expr);
         getCurrent()->addDeclaration(array->elementType);
-
-        for (int index = 0; index < expr->count; index++) {
-          accept<int>(expr->indexes[index]);
-
-          Type argType = removeDeclaration();
-
-          argType = argType;
-        }
         break;
       }
       case OBJ_STRING: {/*
@@ -659,6 +683,18 @@ void Resolver::visitArrayElementExpr(ArrayElementExpr *expr) {
       }
 }
 
+void Resolver::resolveArrayIndex(ArrayElementExpr *expr) {
+  if (expr->count != 1)
+    parser.error("Expect a single array index.");
+
+  accept<int>(expr->indexes[0]);
+
+  Type indexType = removeDeclaration();
+
+  if (!IS_INT(indexType))
+    parser.error("Array index must be an int.");
+}
+
 void Resolver::visitDeclarationExpr(DeclarationExpr *expr) {
   getCurrent()->checkDeclaration(&expr->name);
 
@@ -699,21 +735,49 @@ void Resolver::visitFunctionExpr(FunctionExpr *expr) {/*
   expr->function = compiler.function;*/
 }
 
+// Whether a method overload takes the argument types of the pending call
+static bool matchesSignature(Type &type, ObjCallable *signature) {
+  if (signature == NULL || AS_OBJ_TYPE(type) != OBJ_FUNCTION)
+    return true;
+
+  ObjCallable *callable = AS_FUNCTION_TYPE(type);
+  bool isSignature = signature->arity == callable->arity;
+
+  for (int index = 0; isSignature && index < signature->arity; index++)
+    isSignature = signature->declarations[index].type.equals(callable->declarations[index + 1].type);
+
+  return isSignature;
+}
+
 void Resolver::visitGetExpr(GetExpr *expr) {
+  ObjCallable *signature = getSignature();
+
+  // the instance itself is not the call
+  pushSignature(NULL);
   accept<int>(expr->object);
+  popSignature();
 
   Type objectType = removeDeclaration();
 
-  if (AS_OBJ_TYPE(objectType) != OBJ_INSTANCE)
+  if (IS_ARRAY(objectType)) {
+    if (expr->name.length == 6 && !memcmp(expr->name.start, "length", 6)) {
+      expr->index = ARRAY_LENGTH_INDEX;
+      getCurrent()->addDeclaration(VAL_INT);
+      return;
+    }
+
+    parser.errorAt(&expr->name, "Arrays only have a length.");
+  }
+  else if (AS_OBJ_TYPE(objectType) != OBJ_INSTANCE)
     parser.errorAt(&expr->name, "Only instances have properties.");
   else {
-    ObjFunction *type = AS_FUNCTION_TYPE(objectType);
+    ObjCallable *type = AS_INSTANCE_TYPE(objectType)->callable;
 
     for (int count = 0, i = 0; i < *type->declarationCount; i++) {
       Declaration *dec = &type->declarations[i];
 
       if (dec->isField) {
-        if (identifiersEqual(&expr->name, &dec->name)) {
+        if (identifiersEqual(&expr->name, &dec->name) && matchesSignature(dec->type, signature)) {
           expr->index = count;
           getCurrent()->addDeclaration(dec->type);
           return;
@@ -738,13 +802,13 @@ void Resolver::visitGroupingExpr(GroupingExpr *expr) {
   if (groupFlag) {
     expr->_compiler.beginScope();
     acceptGroupingExprUnits(expr);
-    parenType = parenFlag ? removeDeclaration() : (Type){VAL_VOID};
+    parenType = parenFlag ? removeDeclaration() : (Type){VAL_VOID, NULL};
     expr->popLevels = expr->_compiler.declarationCount;
     expr->_compiler.endScope();
   }
   else {
     acceptGroupingExprUnits(expr);
-    parenType = parenFlag ? removeDeclaration() : (Type){VAL_VOID};
+    parenType = parenFlag ? removeDeclaration() : (Type){VAL_VOID, NULL};
   }
 
   if (type != TOKEN_EOF)
@@ -753,24 +817,30 @@ void Resolver::visitGroupingExpr(GroupingExpr *expr) {
 
 void Resolver::visitArrayExpr(ArrayExpr *expr) {
   ObjArray *objArray = newArray();
-  Type type = {VAL_OBJ, &objArray->obj};
-  Compiler compiler;
-
-  compiler.beginScope(newFunction({VAL_VOID}, NULL, 0));
 
+  // the first element decides the type of the others
   for (int index = 0; index < expr->count; index++) {
     acceptSubExpr(expr->expressions[index]);
 
     Type subType = removeDeclaration();
 
-    objArray->elementType = subType;
+    if (!index)
+      objArray->elementType = subType;
+    else if (!subType.equals(objArray->elementType)) {
+      Expr *subExpr = expr->expressions[index];
+
+      expr->expressions[index] = convertToType(objArray->elementType, subExpr, subType, parser);
+
+      if (expr->expressions[index] == NULL || (expr->expressions[index] == subExpr && subExpr->type != EXPR_ARRAY))
+        parser.error("Array elements must have the same type");
+    }
   }
 
-  compiler.endScope();
-  compiler.function->type = type;
-  getCurrent()->setDeclarationType(compiler.function);
-  expr->function = compiler.function;
-  getCurrent()->addDeclaration(type);
+  if (expr->count && IS_VOID(objArray->elementType))
+    parser.error("Value must not be void");
+
+  expr->_elementType = objArray->elementType;
+  getCurrent()->addDeclaration({VAL_OBJ, &objArray->obj});
 }
 
 // DECLARATIONS:
@@ -786,7 +856,7 @@ void Resolver::visitArrayExpr(ArrayExpr *expr) {
 // );
 void Resolver::visitListExpr(ListExpr *expr) {
   accept<int>(expr->expressions[0], 0);
-  expr->_declaration = NULL;
+  expr->_compiler = NULL;
 
   Type type = removeDeclaration();
 
@@ -803,7 +873,7 @@ void Resolver::visitListExpr(ListExpr *expr) {
 
       if (assignExpr->value != NULL) {
         accept<int>(assignExpr->value, 0);
-        Type internalType = {VAL_OBJ, &objInternalType};
+        Type internalType = {VAL_OBJ, &objInternalType.obj};
         Type type1 = removeDeclaration();
 
         //          if (type1.valueType == VAL_VOID)
@@ -822,7 +892,8 @@ void Resolver::visitListExpr(ListExpr *expr) {
 
       getCurrent()->addDeclaration(returnType);
       getCurrent()->setDeclarationName(&assignExpr->varExp->name);
-      expr->_declaration = getCurrent()->peekDeclaration(0);
+      expr->_compiler = getCurrent();
+      expr->_index = getCurrent()->getDeclarationCount() - 1;
 
       if (expr->count > 2)
         parser.error("Expect ';' or newline after variable declaration.");
@@ -850,7 +921,7 @@ void Resolver::visitListExpr(ListExpr *expr) {
         if (bodyExpr && bodyExpr->type == EXPR_GROUPING && ((GroupingExpr *) bodyExpr)->name.type == TOKEN_RIGHT_BRACE)
           body = (GroupingExpr *) bodyExpr;
         else {
-          Expr **expList = bodyExpr ? RESIZE_ARRAY(Expr *, NULL, 0, 1) : NULL;
+          Expr **expList = bodyExpr ? ARENA_RESIZE(Expr *, NULL, 0, 1) : NULL;
 
           if (expList)
             expList[0] = bodyExpr;
@@ -861,7 +932,8 @@ void Resolver::visitListExpr(ListExpr *expr) {
         Compiler &compiler = body->_compiler;
 
         compiler.beginScope(newFunction(returnType, copyString(varExp->name.start, varExp->name.length), callExpr->count));
-        expr->_declaration = getCurrent()->peekDeclaration(0);
+        expr->_compiler = getCurrent();
+        expr->_index = getCurrent()->getDeclarationCount() - 1;
         bindFunction(compiler.prefix, compiler.function);
 
         for (int index = 0; index < callExpr->count; index++)
@@ -937,7 +1009,7 @@ void Resolver::visitListExpr(ListExpr *expr) {
       getCurrent()->addDeclaration(returnType);
       getCurrent()->setDeclarationName(&varExpr->name);
 
-      LiteralExpr *valueExpr = NULL;
+      Expr *valueExpr = NULL;
 
       switch (returnType.valueType) {
       case VAL_VOID:
@@ -959,12 +1031,22 @@ void Resolver::visitListExpr(ListExpr *expr) {
       case VAL_OBJ:
         switch (AS_OBJ_TYPE(returnType)) {
         case OBJ_STRING:
+        case OBJ_ROPE:
+        case OBJ_SLICE:
           valueExpr = new LiteralExpr(VAL_OBJ, {.obj = &copyString("", 0)->obj});
           break;
 
         case OBJ_INTERNAL:
           valueExpr = new LiteralExpr(VAL_OBJ, {.obj = &newInternal()->obj});
           break;
+
+        case OBJ_ARRAY: {
+          ArrayExpr *arrayExpr = new ArrayExpr(0, NULL);
+
+          arrayExpr->_elementType = AS_ARRAY_TYPE(returnType)->elementType;
+          valueExpr = arrayExpr;
+          break;
+        }
         }
         break;
       }
@@ -1052,6 +1134,11 @@ void Resolver::visitReturnExpr(ReturnExpr *expr) {
 }
 
 void Resolver::visitSetExpr(SetExpr *expr) {
+  if (expr->object->type == EXPR_ARRAYELEMENT) {
+    resolveArrayElementSet(expr);
+    return;
+  }
+
   accept<int>(expr->object);
   accept<int>(expr->value);
 
@@ -1083,6 +1170,40 @@ void Resolver::visitSetExpr(SetExpr *expr) {
   getCurrent()->addDeclaration({VAL_VOID});
 }
 
+void Resolver::resolveArrayElementSet(SetExpr *expr) {
+  ArrayElementExpr *elementExpr = (ArrayElementExpr *) expr->object;
+
+  elementExpr->_uncheckedFlag = false;
+  accept<int>(elementExpr->callee);
+
+  Type arrayType = removeDeclaration();
+
+  if (!IS_ARRAY(arrayType)) {
+    parser.errorAt(&expr->name, "Only arrays have indexed elements.");
+    getCurrent()->addDeclaration(VAL_VOID);
+    return;
+  }
+
+  Type elementType = AS_ARRAY_TYPE(arrayType)->elementType;
+
+  if (expr->op.type != TOKEN_EQUAL)
+    parser.errorAt(&expr->op, "Array elements only support simple assignment.");
+
+  resolveArrayIndex(elementExpr);
+  accept<int>(expr->value, 0);
+
+  Type valueType = removeDeclaration();
+
+  if (!valueType.equals(elementType)) {
+    expr->value = convertToType(elementType, expr->value, valueType, parser);
+
+    if (expr->value == NULL)
+      parser.error("Value must match the array element type");
+  }
+
+  getCurrent()->addDeclaration(elementType);
+}
+
 void Resolver::visitStatementExpr(StatementExpr *expr) {
   int oldDeclarationCount = getCurrent()->getDeclarationCount();
 
@@ -1148,6 +1269,11 @@ void Resolver::visitUnaryExpr(UnaryExpr *expr) {
     case OBJ_FUNCTION:
       errorFlag = false;
       break;
+
+    case OBJ_STRING:
+    case OBJ_ROPE:
+    case OBJ_SLICE:
+      break;
     }
 
     if (errorFlag)
@@ -1162,6 +1288,15 @@ void Resolver::visitUnaryExpr(UnaryExpr *expr) {
     getCurrent()->addDeclaration({VAL_FLOAT});
     break;
 
+  case TOKEN_MINUS:
+    if (type.valueType == VAL_INT || type.valueType == VAL_FLOAT)
+      expr->right = new OpcodeExpr(type.valueType == VAL_INT ? OP_NEGATE_INT : OP_NEGATE_FLOAT, expr->right);
+    else
+      parser.error("Operand must be a number");
+
+    getCurrent()->addDeclaration(type);
+    break;
+
   default:
     getCurrent()->addDeclaration(type);
     break;
@@ -1263,7 +1398,7 @@ void Resolver::acceptGroupingExprUnits(GroupingExpr *expr) {
         if (uiParseCount == 3) {
           nTabs++;
           insertTabs();
-          (*ss) << "var size = (" << getGroupName(exprUI, 0) << " << 16) | " << getGroupName(exprUI, 1) << "\n";
+          (*ss) << "var size = packPoint(" << getGroupName(exprUI, 0) << ", " << getGroupName(exprUI, 1) << ")\n";
           nTabs--;
         }
 #ifdef DEBUG_PRINT_CODE
@@ -1273,7 +1408,7 @@ void Resolver::acceptGroupingExprUnits(GroupingExpr *expr) {
       }
       else {
         getCurrent()->function->eventFlags = exprUI->_eventFlags;
-        expr->expressions = RESIZE_ARRAY(Expr *, expr->expressions, expr->count, expr->count + uiExprs.size() - 1);
+        expr->expressions = ARENA_RESIZE(Expr *, expr->expressions, expr->count, expr->count + uiExprs.size() - 1);
         memmove(&expr->expressions[index + uiExprs.size()], &expr->expressions[index + 1], (--expr->count - index) * sizeof(Expr *));
 
         for (Expr *uiExpr : uiExprs)
@@ -1297,13 +1432,13 @@ void Resolver::acceptGroupingExprUnits(GroupingExpr *expr) {
       // Perform the UI AST magic
       Expr *clickFunction = generateUIFunction("void", "onEvent", "int event, int pos0, int pos1, int size0, int size1", expr->ui, 1, 0, NULL);
       Expr *paintFunction = generateUIFunction("void", "paint", "int pos0, int pos1, int size0, int size1", expr->ui, 1, 0, NULL);
-      Expr **uiFunctions = new Expr *[2];
+      Expr **uiFunctions = ARENA_ARRAY(Expr *, 2);
 
       uiFunctions[0] = paintFunction;
       uiFunctions[1] = clickFunction;
 
       Expr *layoutFunction = generateUIFunction("void", "Layout_", NULL, expr->ui, 3, 2, uiFunctions);
-      Expr **layoutExprs = new Expr *[1];
+      Expr **layoutExprs = ARENA_ARRAY(Expr *, 1);
 
       layoutExprs[0] = layoutFunction;
 
@@ -1417,7 +1552,7 @@ void Resolver::acceptSubExpr(Expr *expr) {
 }
 
 Expr *Resolver::parse(const char *source, int index, int replace, Expr *body) {
-  Scanner scanner((new std::string(source))->c_str());
+  Scanner scanner(astArena->copy(source));
   Parser parser(scanner);
   GroupingExpr *group = (GroupingExpr *) parser.parse() ? (GroupingExpr *) parser.expr : NULL;
 
@@ -1427,7 +1562,7 @@ Expr *Resolver::parse(const char *source, int index, int replace, Expr *body) {
     if (group) {
       if (replace || group->count) {
         if (body->type != EXPR_GROUPING) {
-          Expr **newExprList = RESIZE_ARRAY(Expr *, NULL, 0, 1);
+          Expr **newExprList = ARENA_RESIZE(Expr *, NULL, 0, 1);
 
           newExprList[0] = body;
           body = new GroupingExpr(buildToken(TOKEN_RIGHT_BRACE, "}", 1, -1), 1, newExprList, 0, NULL);
@@ -1437,14 +1572,14 @@ Expr *Resolver::parse(const char *source, int index, int replace, Expr *body) {
 
         GroupingExpr *bodyGroup = (GroupingExpr *) body;
 
-        bodyGroup->expressions = RESIZE_ARRAY(Expr *, bodyGroup->expressions, bodyGroup->count, bodyGroup->count + group->count - replace);
+        bodyGroup->expressions = ARENA_RESIZE(Expr *, bodyGroup->expressions, bodyGroup->count, bodyGroup->count + group->count - replace);
         bodyGroup->count -= replace;
 
         if (index < bodyGroup->count)
           memmove(&bodyGroup->expressions[index + group->count], &bodyGroup->expressions[index + replace], (bodyGroup->count - index) * sizeof(Expr *));
 
         memcpy(&bodyGroup->expressions[index], group->expressions, group->count * sizeof(Expr *));
-        group->expressions = RESIZE_ARRAY(Expr *, group->expressions, group->count, 0);
+        group->expressions = ARENA_RESIZE(Expr *, group->expressions, group->count, 0);
         bodyGroup->count += group->count;
       }
 
@@ -1482,11 +1617,7 @@ static char *generateInternalVarName(const char *prefix, int suffix) {
   char buffer[20];
 
   sprintf(buffer, "%s%d", prefix, suffix);
-
-  char *str = new char[strlen(buffer) + 1];
-
-  strcpy(str, buffer);
-  return str;
+  return astArena->copy(buffer);
 }
 
 static bool isEventHandler(UIAttributeExpr *attExpr) {
@@ -1633,7 +1764,7 @@ void Resolver::pushAreas(UIDirectiveExpr *expr) {
 
   if (size != NULL) {
     expr->viewIndex = aCount;
-    (*ss) << "  var a" << aCount++ << " = (" << size << " << 16) | " << size << "\n";
+    (*ss) << "  var a" << aCount++ << " = packPoint(" << size << ", " << size << ")\n";
   }
   else {
     const char *name = getValueVariableName(expr, ATTRIBUTE_OUT);
@@ -1649,6 +1780,8 @@ void Resolver::pushAreas(UIDirectiveExpr *expr) {
           break;
 
         case OBJ_STRING:
+        case OBJ_ROPE:
+        case OBJ_SLICE:
           callee = "getTextSize";
           break;
       }
@@ -1722,7 +1855,7 @@ void Resolver::recalcLayout(UIDirectiveExpr *expr) {
       expr->_layoutIndexes[dir] = aCount++;
 
     if (expr->viewIndex)
-      (*ss) << "  var " << getUnitName(expr, dir) << " = a" << expr->viewIndex << (dir ? " & 0xFFFF" : " >> 16") << "\n";
+      (*ss) << "  var " << getUnitName(expr, dir) << " = " << (dir ? "pointY(a" : "pointX(a") << expr->viewIndex << ")\n";
 
     if (previous) {
       (*ss) << "  var " << getGroupName(expr, dir) << " = ";
@@ -1742,7 +1875,7 @@ static void insertPoint(const char *prefix) {/*
     ss << (dir == 0 ? "" : ", ") << prefix << dir;
 
   (*ss) << ")";*/
-  (*ss) << "((" << prefix << "0 << 16) | " << prefix << "1)";
+  (*ss) << "packPoint(" << prefix << "0, " << prefix << "1)";
 }
 
 int Resolver::adjustLayout(UIDirectiveExpr *expr) {
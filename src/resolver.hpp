@@ -56,6 +56,9 @@ class Resolver : public ExprVisitor {
   Parser &parser;
   Expr *exp;
   int uiParseCount;
+
+  void resolveArrayIndex(ArrayElementExpr *expr);
+  void resolveArrayElementSet(SetExpr *expr);
 public:
   Resolver(Parser &parser, Expr *exp);
 
@@ -0,0 +1,428 @@
+/*
+ * The QED Programming Language
+ * Copyright (C) 2022-2023  Hocus Codus Software inc.
+ *
+ * All rights reserved.
+ */
+#include "simd.hpp"
+
+#ifdef SIMD
+#include <immintrin.h>
+#endif
+
+bool simdFlag = true;
+
+static long sumIntScalar(const long *a, int n) {
+  unsigned long sum = 0;
+
+  for (int i = 0; i < n; i++)
+    sum += a[i];
+
+  return sum;
+}
+
+static double sumFloatScalar(const double *a, int n) {
+  double sum = 0;
+
+  for (int i = 0; i < n; i++)
+    sum += a[i];
+
+  return sum;
+}
+
+static long minIntScalar(const long *a, int n) {
+  long min = a[0];
+
+  for (int i = 1; i < n; i++)
+    min = a[i] < min ? a[i] : min;
+
+  return min;
+}
+
+static double minFloatScalar(const double *a, int n) {
+  double min = a[0];
+
+  for (int i = 1; i < n; i++)
+    min = a[i] < min ? a[i] : min;
+
+  return min;
+}
+
+static long maxIntScalar(const long *a, int n) {
+  long max = a[0];
+
+  for (int i = 1; i < n; i++)
+    max = a[i] > max ? a[i] : max;
+
+  return max;
+}
+
+static double maxFloatScalar(const double *a, int n) {
+  double max = a[0];
+
+  for (int i = 1; i < n; i++)
+    max = a[i] > max ? a[i] : max;
+
+  return max;
+}
+
+static void scaleIntScalar(long *a, int n, long k) {
+  for (int i = 0; i < n; i++)
+    a[i] = (unsigned long) a[i] * k;
+}
+
+static void scaleFloatScalar(double *a, int n, double k) {
+  for (int i = 0; i < n; i++)
+    a[i] *= k;
+}
+
+static long dotIntScalar(const long *a, const long *b, int n) {
+  unsigned long sum = 0;
+
+  for (int i = 0; i < n; i++)
+    sum += (unsigned long) a[i] * b[i];
+
+  return sum;
+}
+
+static double dotFloatScalar(const double *a, const double *b, int n) {
+  double sum = 0;
+
+  for (int i = 0; i < n; i++)
+    sum += a[i] * b[i];
+
+  return sum;
+}
+
+static void prefixSumIntScalar(long *a, int n) {
+  unsigned long sum = 0;
+
+  for (int i = 0; i < n; i++)
+    a[i] = sum += a[i];
+}
+
+static void prefixSumFloatScalar(double *a, int n) {
+  double sum = 0;
+
+  for (int i = 0; i < n; i++)
+    a[i] = sum += a[i];
+}
+
+static const ArrayKernels scalarKernels = {
+  "scalar",
+  sumIntScalar, sumFloatScalar, minIntScalar, minFloatScalar, maxIntScalar, maxFloatScalar,
+  scaleIntScalar, scaleFloatScalar, dotIntScalar, dotFloatScalar, prefixSumIntScalar, prefixSumFloatScalar
+};
+
+#ifdef SIMD
+// SSE2 is part of x86-64, so these need no runtime check. Without 64-bit
+// compares and multiplies, or with a serial dependency, scalar code is faster
+
+static long sumIntSse2(const long *a, int n) {
+  __m128i sum0 = _mm_setzero_si128();
+  __m128i sum1 = _mm_setzero_si128();
+  long lanes[2];
+  int i = 0;
+
+  for (; i + 4 <= n; i += 4) {
+    sum0 = _mm_add_epi64(sum0, _mm_loadu_si128((const __m128i *) &a[i]));
+    sum1 = _mm_add_epi64(sum1, _mm_loadu_si128((const __m128i *) &a[i + 2]));
+  }
+
+  _mm_storeu_si128((__m128i *) lanes, _mm_add_epi64(sum0, sum1));
+  return (unsigned long) lanes[0] + lanes[1] + sumIntScalar(&a[i], n - i);
+}
+
+static double sumFloatSse2(const double *a, int n) {
+  __m128d sum0 = _mm_setzero_pd();
+  __m128d sum1 = _mm_setzero_pd();
+  double lanes[2];
+  int i = 0;
+
+  for (; i + 4 <= n; i += 4) {
+    sum0 = _mm_add_pd(sum0, _mm_loadu_pd(&a[i]));
+    sum1 = _mm_add_pd(sum1, _mm_loadu_pd(&a[i + 2]));
+  }
+
+  _mm_storeu_pd(lanes, _mm_add_pd(sum0, sum1));
+  return lanes[0] + lanes[1] + sumFloatScalar(&a[i], n - i);
+}
+
+static double minFloatSse2(const double *a, int n) {
+  __m128d min = _mm_set1_pd(a[0]);
+  double lanes[2];
+  int i = 0;
+
+  for (; i + 2 <= n; i += 2)
+    min = _mm_min_pd(min, _mm_loadu_pd(&a[i]));
+
+  _mm_storeu_pd(lanes, min);
+
+  double result = minFloatScalar(lanes, 2);
+
+  return i < n && a[i] < result ? a[i] : result;
+}
+
+static double maxFloatSse2(const double *a, int n) {
+  __m128d max = _mm_set1_pd(a[0]);
+  double lanes[2];
+  int i = 0;
+
+  for (; i + 2 <= n; i += 2)
+    max = _mm_max_pd(max, _mm_loadu_pd(&a[i]));
+
+  _mm_storeu_pd(lanes, max);
+
+  double result = maxFloatScalar(lanes, 2);
+
+  return i < n && a[i] > result ? a[i] : result;
+}
+
+static void scaleFloatSse2(double *a, int n, double k) {
+  __m128d factor = _mm_set1_pd(k);
+  int i = 0;
+
+  for (; i + 2 <= n; i += 2)
+    _mm_storeu_pd(&a[i], _mm_mul_pd(_mm_loadu_pd(&a[i]), factor));
+
+  scaleFloatScalar(&a[i], n - i, k);
+}
+
+static double dotFloatSse2(const double *a, const double *b, int n) {
+  __m128d sum0 = _mm_setzero_pd();
+  __m128d sum1 = _mm_setzero_pd();
+  double lanes[2];
+  int i = 0;
+
+  for (; i + 4 <= n; i += 4) {
+    sum0 = _mm_add_pd(sum0, _mm_mul_pd(_mm_loadu_pd(&a[i]), _mm_loadu_pd(&b[i])));
+    sum1 = _mm_add_pd(sum1, _mm_mul_pd(_mm_loadu_pd(&a[i + 2]), _mm_loadu_pd(&b[i + 2])));
+  }
+
+  _mm_storeu_pd(lanes, _mm_add_pd(sum0, sum1));
+  return lanes[0] + lanes[1] + dotFloatScalar(&a[i], &b[i], n - i);
+}
+
+static const ArrayKernels sse2Kernels = {
+  "sse2",
+  sumIntSse2, sumFloatSse2, minIntScalar, minFloatSse2, maxIntScalar, maxFloatSse2,
+  scaleIntScalar, scaleFloatSse2, dotIntScalar, dotFloatSse2, prefixSumIntScalar, prefixSumFloatScalar
+};
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static inline __m256i mulInt64x4(__m256i a, __m256i b) {
+  __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b), _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+
+  return _mm256_add_epi64(_mm256_mul_epu32(a, b), _mm256_slli_epi64(cross, 32));
+}
+
+AVX2 static long sumIntAvx2(const long *a, int n) {
+  __m256i sum0 = _mm256_setzero_si256();
+  __m256i sum1 = _mm256_setzero_si256();
+  long lanes[4];
+  int i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    sum0 = _mm256_add_epi64(sum0, _mm256_loadu_si256((const __m256i *) &a[i]));
+    sum1 = _mm256_add_epi64(sum1, _mm256_loadu_si256((const __m256i *) &a[i + 4]));
+  }
+
+  _mm256_storeu_si256((__m256i *) lanes, _mm256_add_epi64(sum0, sum1));
+  return (unsigned long) lanes[0] + lanes[1] + lanes[2] + lanes[3] + sumIntScalar(&a[i], n - i);
+}
+
+AVX2 static double sumFloatAvx2(const double *a, int n) {
+  __m256d sum0 = _mm256_setzero_pd();
+  __m256d sum1 = _mm256_setzero_pd();
+  double lanes[4];
+  int i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    sum0 = _mm256_add_pd(sum0, _mm256_loadu_pd(&a[i]));
+    sum1 = _mm256_add_pd(sum1, _mm256_loadu_pd(&a[i + 4]));
+  }
+
+  _mm256_storeu_pd(lanes, _mm256_add_pd(sum0, sum1));
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sumFloatScalar(&a[i], n - i);
+}
+
+AVX2 static long minIntAvx2(const long *a, int n) {
+  __m256i min0 = _mm256_set1_epi64x(a[0]);
+  __m256i min1 = min0;
+  long lanes[8];
+  int i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    __m256i x0 = _mm256_loadu_si256((const __m256i *) &a[i]);
+    __m256i x1 = _mm256_loadu_si256((const __m256i *) &a[i + 4]);
+
+    min0 = _mm256_blendv_epi8(min0, x0, _mm256_cmpgt_epi64(min0, x0));
+    min1 = _mm256_blendv_epi8(min1, x1, _mm256_cmpgt_epi64(min1, x1));
+  }
+
+  _mm256_storeu_si256((__m256i *) lanes, min0);
+  _mm256_storeu_si256((__m256i *) &lanes[4], min1);
+
+  long result = minIntScalar(lanes, 8);
+
+  for (; i < n; i++)
+    result = a[i] < result ? a[i] : result;
+
+  return result;
+}
+
+AVX2 static double minFloatAvx2(const double *a, int n) {
+  __m256d min = _mm256_set1_pd(a[0]);
+  double lanes[4];
+  int i = 0;
+
+  for (; i + 4 <= n; i += 4)
+    min = _mm256_min_pd(min, _mm256_loadu_pd(&a[i]));
+
+  _mm256_storeu_pd(lanes, min);
+
+  double result = minFloatScalar(lanes, 4);
+
+  for (; i < n; i++)
+    result = a[i] < result ? a[i] : result;
+
+  return result;
+}
+
+AVX2 static long maxIntAvx2(const long *a, int n) {
+  __m256i max0 = _mm256_set1_epi64x(a[0]);
+  __m256i max1 = max0;
+  long lanes[8];
+  int i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    __m256i x0 = _mm256_loadu_si256((const __m256i *) &a[i]);
+    __m256i x1 = _mm256_loadu_si256((const __m256i *) &a[i + 4]);
+
+    max0 = _mm256_blendv_epi8(max0, x0, _mm256_cmpgt_epi64(x0, max0));
+    max1 = _mm256_blendv_epi8(max1, x1, _mm256_cmpgt_epi64(x1, max1));
+  }
+
+  _mm256_storeu_si256((__m256i *) lanes, max0);
+  _mm256_storeu_si256((__m256i *) &lanes[4], max1);
+
+  long result = maxIntScalar(lanes, 8);
+
+  for (; i < n; i++)
+    result = a[i] > result ? a[i] : result;
+
+  return result;
+}
+
+AVX2 static double maxFloatAvx2(const double *a, int n) {
+  __m256d max = _mm256_set1_pd(a[0]);
+  double lanes[4];
+  int i = 0;
+
+  for (; i + 4 <= n; i += 4)
+    max = _mm256_max_pd(max, _mm256_loadu_pd(&a[i]));
+
+  _mm256_storeu_pd(lanes, max);
+
+  double result = maxFloatScalar(lanes, 4);
+
+  for (; i < n; i++)
+    result = a[i] > result ? a[i] : result;
+
+  return result;
+}
+
+AVX2 static void scaleIntAvx2(long *a, int n, long k) {
+  __m256i factor = _mm256_set1_epi64x(k);
+  int i = 0;
+
+  for (; i + 4 <= n; i += 4)
+    _mm256_storeu_si256((__m256i *) &a[i], mulInt64x4(_mm256_loadu_si256((const __m256i *) &a[i]), factor));
+
+  scaleIntScalar(&a[i], n - i, k);
+}
+
+AVX2 static void scaleFloatAvx2(double *a, int n, double k) {
+  __m256d factor = _mm256_set1_pd(k);
+  int i = 0;
+
+  for (; i + 4 <= n; i += 4)
+    _mm256_storeu_pd(&a[i], _mm256_mul_pd(_mm256_loadu_pd(&a[i]), factor));
+
+  scaleFloatScalar(&a[i], n - i, k);
+}
+
+AVX2 static long dotIntAvx2(const long *a, const long *b, int n) {
+  __m256i sum = _mm256_setzero_si256();
+  long lanes[4];
+  int i = 0;
+
+  for (; i + 4 <= n; i += 4)
+    sum = _mm256_add_epi64(sum, mulInt64x4(_mm256_loadu_si256((const __m256i *) &a[i]), _mm256_loadu_si256((const __m256i *) &b[i])));
+
+  _mm256_storeu_si256((__m256i *) lanes, sum);
+  return (unsigned long) lanes[0] + lanes[1] + lanes[2] + lanes[3] + dotIntScalar(&a[i], &b[i], n - i);
+}
+
+AVX2 static double dotFloatAvx2(const double *a, const double *b, int n) {
+  __m256d sum0 = _mm256_setzero_pd();
+  __m256d sum1 = _mm256_setzero_pd();
+  double lanes[4];
+  int i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    sum0 = _mm256_add_pd(sum0, _mm256_mul_pd(_mm256_loadu_pd(&a[i]), _mm256_loadu_pd(&b[i])));
+    sum1 = _mm256_add_pd(sum1, _mm256_mul_pd(_mm256_loadu_pd(&a[i + 4]), _mm256_loadu_pd(&b[i + 4])));
+  }
+
+  _mm256_storeu_pd(lanes, _mm256_add_pd(sum0, sum1));
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3] + dotFloatScalar(&a[i], &b[i], n - i);
+}
+
+// Shifts lanes up by one then by two, filling with zeros, and adds the
+// broadcast last lane of the previous block. Integer sums stay scalar, as
+// their one-cycle dependency beats the shuffles
+AVX2 static void prefixSumFloatAvx2(double *a, int n) {
+  __m256d zero = _mm256_setzero_pd();
+  __m256d carry = zero;
+  int i = 0;
+
+  for (; i + 4 <= n; i += 4) {
+    __m256d x = _mm256_loadu_pd(&a[i]);
+
+    x = _mm256_add_pd(x, _mm256_blend_pd(_mm256_permute4x64_pd(x, _MM_SHUFFLE(2, 1, 0, 3)), zero, 0x1));
+    x = _mm256_add_pd(x, _mm256_blend_pd(_mm256_permute4x64_pd(x, _MM_SHUFFLE(1, 0, 3, 2)), zero, 0x3));
+    x = _mm256_add_pd(x, carry);
+    _mm256_storeu_pd(&a[i], x);
+    carry = _mm256_permute4x64_pd(x, _MM_SHUFFLE(3, 3, 3, 3));
+  }
+
+  double sum = _mm256_cvtsd_f64(carry);
+
+  for (; i < n; i++)
+    a[i] = sum += a[i];
+}
+
+static const ArrayKernels avx2Kernels = {
+  "avx2",
+  sumIntAvx2, sumFloatAvx2, minIntAvx2, minFloatAvx2, maxIntAvx2, maxFloatAvx2,
+  scaleIntAvx2, scaleFloatAvx2, dotIntAvx2, dotFloatAvx2, prefixSumIntScalar, prefixSumFloatAvx2
+};
+#endif
+
+static const ArrayKernels *selectArrayKernels() {
+#ifdef SIMD
+  if (simdFlag) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? &avx2Kernels : &sse2Kernels;
+  }
+#endif
+  return &scalarKernels;
+}
+
+const ArrayKernels &getArrayKernels() {
+  static const ArrayKernels *kernels = selectArrayKernels();
+
+  return *kernels;
+}
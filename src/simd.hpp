@@ -0,0 +1,39 @@
+/*
+ * The QED Programming Language
+ * Copyright (C) 2022-2023  Hocus Codus Software inc.
+ *
+ * All rights reserved.
+ */
+#ifndef qed_simd_h
+#define qed_simd_h
+
+#include "common.h"
+
+#if defined(__x86_64__) && !defined(__EMSCRIPTEN__) && !defined(NO_SIMD)
+#define SIMD
+#endif
+
+extern bool simdFlag;
+
+// Kernels over the unboxed storage of int[] and float[] arrays. Integer
+// arithmetic wraps; min and max expect at least one element
+struct ArrayKernels {
+  const char *name;
+  long (*sumInt)(const long *a, int n);
+  double (*sumFloat)(const double *a, int n);
+  long (*minInt)(const long *a, int n);
+  double (*minFloat)(const double *a, int n);
+  long (*maxInt)(const long *a, int n);
+  double (*maxFloat)(const double *a, int n);
+  void (*scaleInt)(long *a, int n, long k);
+  void (*scaleFloat)(double *a, int n, double k);
+  long (*dotInt)(const long *a, const long *b, int n);
+  double (*dotFloat)(const double *a, const double *b, int n);
+  void (*prefixSumInt)(long *a, int n);
+  void (*prefixSumFloat)(double *a, int n);
+};
+
+// Picks the widest kernels the CPU supports on first use
+const ArrayKernels &getArrayKernels();
+
+#endif
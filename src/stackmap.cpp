@@ -0,0 +1,356 @@
+/*
+ * The QED Programming Language
+ * Copyright (C) 2022-2023  Hocus Codus Software inc.
+ *
+ * All rights reserved.
+ */
+#include <string.h>
+#include <algorithm>
+#include "stackmap.hpp"
+#include "codegen.hpp"
+
+// The static type of every slot is followed through the bytecode, from the
+// declared types of the parameters: pushed values take the declared type
+// of their local, upvalue or field, the return type of their callee or the
+// element type of their array. Code is statically typed, so the paths
+// meeting at an offset agree on its types.
+
+typedef std::vector<Type> Types;
+
+static Type scalarType(ValueType valueType) {
+  return {valueType, NULL};
+}
+
+// Classes take a return handler after their parameters
+static bool hasReturnHandler(ObjFunction *function) {
+  int index = function->arity + 1;
+
+  if (!function->declarationCount || index >= *function->declarationCount)
+    return false;
+
+  ObjFunction *handler = AS_FUNCTION_TYPE(function->declarations[index].type);
+
+  return handler && handler->name && !strcmp(handler->name->chars, "ReturnHandler_");
+}
+
+static Type constantType(Chunk *chunk, int index) {
+  Value value = chunk->constants.values[index];
+
+  // the shared closure of an OP_CALL_DIRECT
+  if (chunk->constantTypes[index] == VAL_OBJ && AS_OBJ(value) && OBJ_TYPE(value) == OBJ_CLOSURE)
+    return {VAL_OBJ, &AS_CLOSURE(value)->function->obj};
+
+  return scalarType(chunk->constantTypes[index]);
+}
+
+static Type returnType(Type &callee) {
+  switch (AS_OBJ_TYPE(callee)) {
+    case OBJ_FUNCTION: return ((ObjFunction *) callee.objType)->type;
+    case OBJ_FUNCTION_PTR: return ((ObjFunctionPtr *) callee.objType)->type;
+    default: return scalarType(VAL_VOID);
+  }
+}
+
+// Instances are typed by their class, or by an ObjInstance in declarations
+static Type fieldType(Type &instance, int index) {
+  ObjCallable *callable = AS_OBJ_TYPE(instance) == OBJ_INSTANCE ? ((ObjInstance *) instance.objType)->callable
+                                                                 : AS_FUNCTION_TYPE(instance);
+
+  if (callable && callable->declarationCount)
+    for (int count = 0, i = 0; i < *callable->declarationCount; i++)
+      if (callable->declarations[i].isField && count++ == index)
+        return callable->declarations[i].type;
+
+  return scalarType(VAL_VOID);
+}
+
+static Type elementType(Type &array) {
+  return IS_ARRAY(array) ? AS_ARRAY_TYPE(array)->elementType : scalarType(VAL_VOID);
+}
+
+static void addStop(StackMap *stackMap, int offset, Types &types) {
+  if (stackMap->stops[offset] != -1)
+    return;
+
+  stackMap->stops[offset] = stackMap->slots.size();
+  stackMap->slots.push_back(types.size());
+
+  for (size_t index = 0; index < types.size(); index++)
+    stackMap->slots.push_back(IS_OBJ(types[index]));
+}
+
+static void pop(Types &types, int count) {
+  types.resize(types.size() - count);
+}
+
+static void replace(Types &types, int count, Type type) {
+  pop(types, count);
+  types.push_back(type);
+}
+
+static StackMap *buildStackMap(ObjFunction *function) {
+  Chunk *chunk = &function->chunk;
+  StackMap *stackMap = new StackMap();
+  std::vector<Types> states(chunk->count + 1);
+  std::vector<bool> reached(chunk->count + 1, false);
+  std::vector<int> pending;
+  int parameterCount = function->declarationCount ? function->arity + hasReturnHandler(function) : 0;
+
+  stackMap->stops.assign(chunk->count + 1, -1);
+  states[0].push_back({VAL_OBJ, &function->obj});
+
+  for (int index = 1; index <= parameterCount; index++)
+    states[0].push_back(function->declarations[index].type);
+
+  stackMap->depth = states[0].size();
+  reached[0] = true;
+  pending.push_back(0);
+  addStop(stackMap, 0, states[0]);
+
+  while (!pending.empty()) {
+    int offset = pending.back();
+
+    pending.pop_back();
+
+    if (offset >= chunk->count)
+      continue;
+
+    Types types = states[offset];
+    uint8_t instruction = chunk->opCode(offset);
+    uint8_t *code = &chunk->code[offset];
+    int length = instructionLength(chunk, offset);
+    bool stop = false;
+    bool next = true;
+
+    switch (instruction) {
+      case OP_CONSTANT:
+        types.push_back(constantType(chunk, code[1]));
+        break;
+
+      case OP_TRUE:
+      case OP_FALSE:
+        types.push_back(scalarType(VAL_BOOL));
+        break;
+
+      case OP_POP:
+      case OP_SET_LOCAL_POP:
+      case OP_PRINT:
+      case OP_CLOSE_UPVALUE:
+        pop(types, 1);
+        break;
+
+      case OP_GET_LOCAL:
+        types.push_back(types[code[1]]);
+        break;
+
+      case OP_GET_LOCAL_DIR:
+      case OP_ADD_LOCAL:
+      case OP_MAX_LOCAL:
+      case OP_ADD_LOCAL_CONST:
+      case OP_SUBTRACT_LOCAL_CONST:
+      case OP_MULTIPLY_LOCAL_CONST:
+        types.push_back(scalarType(VAL_INT));
+        break;
+
+      case OP_GET_UPVALUE:
+        types.push_back(function->upvalues[code[1]].type);
+        break;
+
+      case OP_GET_PROPERTY:
+        replace(types, 1, fieldType(types.back(), code[1]));
+        break;
+
+      case OP_SET_PROPERTY:
+        replace(types, 2, types.back());
+        break;
+
+      case OP_INT_TO_FLOAT:
+      case OP_NEGATE_FLOAT:
+        replace(types, 1, scalarType(VAL_FLOAT));
+        break;
+
+      case OP_FLOAT_TO_INT:
+      case OP_NEGATE_INT:
+      case OP_POINT_X:
+      case OP_POINT_Y:
+      case OP_ARRAY_LEN:
+        replace(types, 1, scalarType(VAL_INT));
+        break;
+
+      case OP_NOT:
+        replace(types, 1, scalarType(VAL_BOOL));
+        break;
+
+      case OP_INT_TO_STRING:
+      case OP_FLOAT_TO_STRING:
+      case OP_BOOL_TO_STRING:
+        replace(types, 1, scalarType(VAL_OBJ));
+        stop = true;
+        break;
+
+      case OP_ADD_STRING:
+        replace(types, 2, scalarType(VAL_OBJ));
+        stop = true;
+        break;
+
+      case OP_EQUAL_STRING:
+      case OP_GREATER_STRING:
+      case OP_LESS_STRING:
+      case OP_EQUAL_INT:
+      case OP_GREATER_INT:
+      case OP_LESS_INT:
+      case OP_EQUAL_FLOAT:
+      case OP_GREATER_FLOAT:
+      case OP_LESS_FLOAT:
+      case OP_LOGICAL_OR:
+      case OP_LOGICAL_AND:
+        replace(types, 2, scalarType(VAL_BOOL));
+        break;
+
+      case OP_ADD_INT:
+      case OP_SUBTRACT_INT:
+      case OP_MULTIPLY_INT:
+      case OP_DIVIDE_INT:
+      case OP_BITWISE_OR:
+      case OP_BITWISE_AND:
+      case OP_BITWISE_XOR:
+      case OP_SHIFT_LEFT:
+      case OP_SHIFT_RIGHT:
+      case OP_SHIFT_URIGHT:
+      case OP_MAX_INT:
+      case OP_PACK_POINT:
+        replace(types, 2, scalarType(VAL_INT));
+        break;
+
+      case OP_ADD_FLOAT:
+      case OP_SUBTRACT_FLOAT:
+      case OP_MULTIPLY_FLOAT:
+      case OP_DIVIDE_FLOAT:
+        replace(types, 2, scalarType(VAL_FLOAT));
+        break;
+
+      case OP_CLOCK:
+        types.push_back(scalarType(VAL_FLOAT));
+        break;
+
+      case OP_JUMP:
+        next = false;
+        break;
+
+      case OP_POP_JUMP_IF_FALSE:
+        pop(types, 1);
+        break;
+
+      case OP_JUMP_IF_NOT_EQUAL_INT:
+      case OP_JUMP_IF_NOT_GREATER_INT:
+      case OP_JUMP_IF_NOT_LESS_INT:
+        pop(types, 2);
+        break;
+
+      case OP_NEW: {
+        // the closure, the arguments and the return handler
+        Type instance = {VAL_OBJ, types[types.size() - code[1] - 2].objType};
+
+        replace(types, code[1] + 2, instance);
+        stop = true;
+        break;
+      }
+      case OP_CALL:
+      case OP_CALL_DIRECT: {
+        Type type = returnType(types[types.size() - code[1] - 1]);
+
+        pop(types, code[1] + 1);
+
+        if (!IS_VOID(type))
+          types.push_back(type);
+
+        stop = true;
+        break;
+      }
+      case OP_CALL_NATIVE: {
+        Type type = AS_FUNCTION(chunk->constants.values[code[1]])->type;
+
+        addStop(stackMap, offset + 1, types);
+        pop(types, code[2]);
+
+        if (!IS_VOID(type))
+          types.push_back(type);
+
+        stop = true;
+        break;
+      }
+      case OP_ARRAY:
+        replace(types, code[2], {VAL_OBJ, AS_OBJ(chunk->constants.values[code[1]])});
+        stop = true;
+        break;
+
+      case OP_ARRAY_GET:
+      case OP_ARRAY_GET_UNCHECKED:
+        replace(types, 2, elementType(types[types.size() - 2]));
+        break;
+
+      case OP_ARRAY_SET:
+      case OP_ARRAY_SET_UNCHECKED:
+        replace(types, 3, types.back());
+        stop = instruction == OP_ARRAY_SET;
+        break;
+
+      case OP_CLOSURE:
+        types.push_back({VAL_OBJ, AS_OBJ(chunk->constants.values[code[1]])});
+        stop = true;
+        break;
+
+      case OP_RETURN:
+        next = false;
+        break;
+
+      case OP_HALT:
+        stop = true; // resumed after, like a call
+        break;
+
+      case OP_R_PUSH:
+        types.push_back(code[1] & REGISTER_TEMP ? scalarType(VAL_INT) : types[code[1]]);
+        break;
+
+      default:
+        break; // register instructions only write slots of their own type
+    }
+
+    stackMap->depth = std::max(stackMap->depth, (int) types.size());
+
+    int operand = jumpOperand(instruction);
+
+    if (operand) {
+      int target = offset + length + (int16_t) ((code[operand] << 8) | code[operand + 1]);
+
+      if (!reached[target]) {
+        reached[target] = true;
+        states[target] = types;
+        pending.push_back(target);
+      }
+    }
+
+    if (stop)
+      addStop(stackMap, offset + length, types);
+
+    if (next && !reached[offset + length]) {
+      reached[offset + length] = true;
+      states[offset + length] = types;
+      pending.push_back(offset + length);
+    }
+  }
+
+  return stackMap;
+}
+
+StackMap *getStackMap(ObjFunction *function) {
+  if (function->stackMap == NULL)
+    function->stackMap = buildStackMap(function);
+
+  return function->stackMap;
+}
+
+void freeStackMap(ObjFunction *function) {
+  delete function->stackMap;
+  function->stackMap = NULL;
+}
@@ -0,0 +1,25 @@
+/*
+ * The QED Programming Language
+ * Copyright (C) 2022-2023  Hocus Codus Software inc.
+ *
+ * All rights reserved.
+ */
+#ifndef qed_stackmap_h
+#define qed_stackmap_h
+
+#include <vector>
+#include "object.hpp"
+
+// Which slots of a frame hold objects, at each offset a collection can find
+// the frame stopped at: its entry, after an instruction reaching a safe
+// point or calling, after OP_HALT and inside OP_CALL_NATIVE
+struct StackMap {
+  std::vector<int> stops; // per offset, its entry in slots or -1
+  std::vector<int> slots; // per entry, the slot count then 1 for each object
+  int depth; // the most slots a frame uses at once
+};
+
+StackMap *getStackMap(ObjFunction *function);
+void freeStackMap(ObjFunction *function);
+
+#endif
@@ -4,8 +4,12 @@
  *
  * All rights reserved.
  */
+#include <string.h>
 #include <time.h>
 #include "qni.hpp"
+#include "simd.hpp"
+#include "map.hpp"
+#include "memory.h"
 
 // std
 #include <assert.h>
@@ -60,7 +64,7 @@ QNI_FN(onInstanceEvent) {
 }
 
 QNI_FN(println) {
-  printf("%s\n", ((ObjString *) AS_OBJ(args[0]))->chars);
+  printf("%s\n", AS_CSTRING(args[0]));
   return VOID_VAL;
 }
 
@@ -70,10 +74,185 @@ QNI_FN(max) {
 
   return INT_VAL(arg0 > arg1 ? arg0 : arg1);
 }
+QNI_INTRINSIC(max, OP_MAX_INT);
+
+QNI_FN(packPoint) {
+  return INT_VAL((AS_INT(args[0]) << 16) | AS_INT(args[1]));
+}
+QNI_INTRINSIC(packPoint, OP_PACK_POINT);
+
+QNI_FN(pointX) {
+  return INT_VAL(AS_INT(args[0]) >> 16);
+}
+QNI_INTRINSIC(pointX, OP_POINT_X);
+
+QNI_FN(pointY) {
+  return INT_VAL(AS_INT(args[0]) & 0xFFFF);
+}
+QNI_INTRINSIC(pointY, OP_POINT_Y);
 
 QNI_FN(clock) {
   return FLOAT_VAL(((double) clock()) / CLOCKS_PER_SEC);
 }
+QNI_INTRINSIC(clock, OP_CLOCK);
+
+// Numeric array builtins, each declared for int[] and float[]
+QNI_FN(arraySum) {
+  ObjArray *array = AS_ARRAY(args[0]);
+
+  if (array->elementType.valueType == VAL_FLOAT)
+    return FLOAT_VAL(getArrayKernels().sumFloat(array->floats, array->count));
+
+  return INT_VAL(getArrayKernels().sumInt(array->integers, array->count));
+}
+
+// An empty array has 0 for minimum and maximum
+QNI_FN(arrayMin) {
+  ObjArray *array = AS_ARRAY(args[0]);
+
+  if (array->elementType.valueType == VAL_FLOAT)
+    return FLOAT_VAL(array->count ? getArrayKernels().minFloat(array->floats, array->count) : 0);
+
+  return INT_VAL(array->count ? getArrayKernels().minInt(array->integers, array->count) : 0);
+}
+
+QNI_FN(arrayMax) {
+  ObjArray *array = AS_ARRAY(args[0]);
+
+  if (array->elementType.valueType == VAL_FLOAT)
+    return FLOAT_VAL(array->count ? getArrayKernels().maxFloat(array->floats, array->count) : 0);
+
+  return INT_VAL(array->count ? getArrayKernels().maxInt(array->integers, array->count) : 0);
+}
+
+QNI_FN(arrayScale) {
+  ObjArray *array = AS_ARRAY(args[0]);
+
+  if (array->elementType.valueType == VAL_FLOAT)
+    getArrayKernels().scaleFloat(array->floats, array->count, AS_FLOAT(args[1]));
+  else
+    getArrayKernels().scaleInt(array->integers, array->count, AS_INT(args[1]));
+
+  return VOID_VAL;
+}
+
+// Over the length of the shorter array
+QNI_FN(arrayDot) {
+  ObjArray *array0 = AS_ARRAY(args[0]);
+  ObjArray *array1 = AS_ARRAY(args[1]);
+  int count = array0->count < array1->count ? array0->count : array1->count;
+
+  if (array0->elementType.valueType == VAL_FLOAT)
+    return FLOAT_VAL(getArrayKernels().dotFloat(array0->floats, array1->floats, count));
+
+  return INT_VAL(getArrayKernels().dotInt(array0->integers, array1->integers, count));
+}
+
+// Inclusive, in place: [1, 2, 3] becomes [1, 3, 6]
+QNI_FN(arrayPrefixSum) {
+  ObjArray *array = AS_ARRAY(args[0]);
+
+  if (array->elementType.valueType == VAL_FLOAT)
+    getArrayKernels().prefixSumFloat(array->floats, array->count);
+  else
+    getArrayKernels().prefixSumInt(array->integers, array->count);
+
+  return VOID_VAL;
+}
+
+// String builtins, returning slices of their argument rather than copies
+static int stringLength(Value value) {
+  return ((ObjString *) AS_OBJ(value))->length;
+}
+
+static int findString(Obj *string, Obj *part, int from) {
+  int length = ((ObjString *) string)->length;
+  int partLength = ((ObjString *) part)->length;
+  const char *chars = stringChars(string);
+  const char *partChars = stringChars(part);
+
+  if (from < 0)
+    from = 0;
+
+  if (partLength == 0)
+    return from <= length ? from : -1;
+
+  for (int index = from; index <= length - partLength; index++) {
+    const char *first = (const char *) memchr(chars + index, partChars[0], length - partLength - index + 1);
+
+    if (!first)
+      break;
+
+    index = first - chars;
+
+    if (!memcmp(first, partChars, partLength))
+      return index;
+  }
+
+  return -1;
+}
+
+QNI_FN(length) {
+  return INT_VAL(stringLength(args[0]));
+}
+
+// Characters start to end - 1, both clamped to the string
+QNI_FN(substring) {
+  long length = stringLength(args[0]);
+  long start = AS_INT(args[1]) < 0 ? 0 : AS_INT(args[1]) > length ? length : AS_INT(args[1]);
+  long end = AS_INT(args[2]) < start ? start : AS_INT(args[2]) > length ? length : AS_INT(args[2]);
+
+  return OBJ_VAL(substring(AS_OBJ(args[0]), start, end - start));
+}
+
+// -1 when part is not found
+QNI_FN(indexOf) {
+  int from = argCount > 2 ? AS_INT(args[2]) : 0;
+
+  return INT_VAL(findString(AS_OBJ(args[0]), AS_OBJ(args[1]), from));
+}
+
+// An empty separator leaves the string whole
+QNI_FN(split) {
+  Obj *string = AS_OBJ(args[0]);
+  Obj *separator = AS_OBJ(args[1]);
+  int length = stringLength(args[0]);
+  int separatorLength = stringLength(args[1]);
+  ObjArray *array = newArray({VAL_OBJ, NULL}, 0);
+
+  if (separatorLength == 0) {
+    appendArray(array, OBJ_VAL(string));
+    return OBJ_VAL(array);
+  }
+
+  for (int start = 0;;) {
+    int end = findString(string, separator, start);
+
+    if (end == -1) {
+      appendArray(array, OBJ_VAL(substring(string, start, length - start)));
+      return OBJ_VAL(array);
+    }
+
+    appendArray(array, OBJ_VAL(substring(string, start, end - start)));
+    start = end + separatorLength;
+  }
+}
+
+// Strips the spaces and control characters at both ends
+QNI_FN(trim) {
+  int length = stringLength(args[0]);
+  const char *chars = stringChars(AS_OBJ(args[0]));
+  int start = 0;
+  int end = length;
+
+  while (start < end && (unsigned char) chars[start] <= ' ')
+    start++;
+
+  while (end > start && (unsigned char) chars[end - 1] <= ' ')
+    end--;
+
+  return OBJ_VAL(substring(AS_OBJ(args[0]), start, end - start));
+}
 /*
 #ifdef __EMSCRIPTEN__
 void timerCallback(void *param)
@@ -135,7 +314,7 @@ QNI_CLASS(CoList) {/*
   return {INTERPRET_OK};//HALT};
 }
 
-static InterpretResult qni__CoListEnd(VM &vm, int argCount, Value *args) {
+static InterpretResult qni__CoListEnd(CoThread *thread, int argCount, Value *args) {
   ObjNativeClass *objNativeClass = NULL;//(ObjNativeClass *) vm.getFrame()->closure->function->native;
   ObjInternal *objInternal = (ObjInternal *) objNativeClass->arg;
   Value value = BOOL_VAL(true);
@@ -175,6 +354,120 @@ QNI_CLASS(CoList_yield) {
 	  return {INTERPRET_OK};//HALT};
   }
 }
+
+// Map keeps its HashMap in the _map field, after the closure and the
+// return handler; its methods reach it through their closure's parent
+#define MAP_FIELD 2
+
+static HashMap *getMap(Value *args) {
+  ObjInternal *internal = (ObjInternal *) AS_OBJ(AS_CLOSURE(args[-1])->parent->fields[MAP_FIELD]);
+
+  return (HashMap *) internal->object;
+}
+
+// The declared type of parameter index of the overload being run
+static ValueType getParmType(Value *args, int index) {
+  return AS_CLOSURE(args[-1])->function->declarations[index + 1].type.valueType;
+}
+
+static As unbox(ValueType type, Value value) {
+  As as;
+
+  switch (type) {
+    case VAL_BOOL: as.integer = 0; as.boolean = AS_BOOL(value); break;
+    case VAL_INT: as.integer = AS_INT(value); break;
+    case VAL_FLOAT: as.floating = AS_FLOAT(value); break;
+    default: as.obj = AS_OBJ(value); break;
+  }
+
+  return as;
+}
+
+// String keys are interned, so equal keys are the same object
+static As unboxKey(ValueType type, Value value) {
+  As as = unbox(type, value);
+
+  if (type == VAL_OBJ)
+    as.obj = &flattenString(as.obj)->obj;
+
+  return as;
+}
+
+QNI_CLASS(Map) {
+  ObjInternal *internal = newInternal();
+
+  internal->object = new HashMap(internal);
+  thread->fields[MAP_FIELD] = OBJ_VAL(internal);
+  WRITE_BARRIER(&thread->obj);
+  return INTERPRET_OK;
+}
+
+QNI_FN(Map_size) {
+  return INT_VAL(getMap(args)->count);
+}
+
+QNI_FN(Map_clear) {
+  getMap(args)->clear();
+  return VOID_VAL;
+}
+
+QNI_FN(Map_put) {
+  ValueType keyType = getParmType(args, 0);
+  ValueType valueType = getParmType(args, 1);
+
+  getMap(args)->put(keyType, unboxKey(keyType, args[0]), valueType, unbox(valueType, args[1]));
+  return VOID_VAL;
+}
+
+// Returns the default when the key is absent or holds another type
+QNI_FN(Map_get) {
+  ValueType keyType = getParmType(args, 0);
+  ValueType valueType = getParmType(args, 1);
+  MapEntry *entry = getMap(args)->find(keyType, unboxKey(keyType, args[0]));
+
+  return entry && entry->valueType == valueType ? VALUE(valueType, entry->value) : args[1];
+}
+
+QNI_FN(Map_has) {
+  ValueType keyType = getParmType(args, 0);
+
+  return BOOL_VAL(getMap(args)->find(keyType, unboxKey(keyType, args[0])) != NULL);
+}
+
+QNI_FN(Map_remove) {
+  ValueType keyType = getParmType(args, 0);
+
+  return BOOL_VAL(getMap(args)->remove(keyType, unboxKey(keyType, args[0])));
+}
+
+// Iterates the slots: next(-1) is the first, -1 comes after the last.
+// Removing while iterating may skip entries
+QNI_FN(Map_next) {
+  return INT_VAL(getMap(args)->next(AS_INT(args[0])));
+}
+
+static Value slotValue(Value *args, bool key) {
+  HashMap *map = getMap(args);
+  long slot = AS_INT(args[0]);
+  ValueType type = getParmType(args, 1);
+
+  if (slot >= 0 && slot < map->capacity && map->entries[slot].keyType != VAL_VOID) {
+    MapEntry *entry = &map->entries[slot];
+
+    if ((key ? entry->keyType : entry->valueType) == type)
+      return VALUE(type, key ? entry->key : entry->value);
+  }
+
+  return args[1];
+}
+
+QNI_FN(Map_keyAt) {
+  return slotValue(args, true);
+}
+
+QNI_FN(Map_valueAt) {
+  return slotValue(args, false);
+}
 /*
     		put("Timer", new Executer() {
     			public void run(VM &vm, Obj obj) {
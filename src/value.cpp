@@ -11,7 +11,11 @@
 #include "memory.h"
 
 bool Type::equals(Type &type) {
-  return valueType == type.valueType && (valueType != VAL_OBJ || objType == type.objType);
+  if (valueType != type.valueType || valueType != VAL_OBJ || objType == type.objType)
+    return valueType == type.valueType;
+
+  // each array type expression creates its own type object
+  return IS_ARRAY(*this) && IS_ARRAY(type) && AS_ARRAY_TYPE(*this)->elementType.equals(AS_ARRAY_TYPE(type)->elementType);
 }
 
 const char *Type::toString() {
